@@ -0,0 +1,50 @@
+/*++
+* Arminder Singh
+* CPE462 Image Processing Final Project
+* I pledge my Honor that I have abided by the Stevens Honor System.
+* - Arminder Singh
+--*/
+
+//
+// benchmark.h
+//
+// Per-stage benchmark of the color wheel, for tracking performance from release to release.
+//
+// Every stage of the transform is timed on its own: decode (cv::imdecode from memory, so disk speed doesn't count),
+// warp (rotate_image), split (channel extraction, plus the histogram when equalizing), equalize (building the
+// equalization tables), colormap (compiling and applying the per-channel colormap), merge (the in-place channel mix)
+// and each of the seven JPEG encodes. The stages run in the same order and with the same kernels as the real
+// transform, one after another rather than overlapped, so the numbers add up to the time of one image. A stage may
+// still use OpenCV's threads internally (the warp runs under cv::parallel_for_, for one); the JSON records
+// cv::getNumThreads() so runs on different machines can be told apart.
+//
+// Inputs are the test image plus synthetic square images (gradients with noise, so the JPEG encoder and the
+// histograms see something image-like) from 256x256 up to max_side x max_side. Each input runs with rotation off and
+// at BENCHMARK_ROTATION_ANGLE, with and without equalization.
+//
+// Each case is warmed up, then repeated; the median and 95th percentile of every stage are written as JSON.
+// Note: the 16384x16384 case needs roughly 3 GB of memory and takes minutes, so large inputs run fewer repetitions
+// (the JSON records how many).
+//
+
+#ifndef benchmark_h
+#define benchmark_h
+
+#include <opencv2/opencv.hpp>
+
+//
+// Non right angle, so the bilinear warp is what gets measured.
+//
+#define BENCHMARK_ROTATION_ANGLE 30
+
+#define BENCHMARK_DEFAULT_WARMUP 2
+#define BENCHMARK_DEFAULT_REPETITIONS 10
+#define BENCHMARK_DEFAULT_MAX_SIDE 16384
+
+//
+// Runs the benchmark and writes the JSON report to 'json_path'. repetitions/max_side <= 0 mean the defaults.
+// Returns 0 on success, -1 if the test image can't be read or the report can't be written.
+//
+int color_wheel_benchmark(const cv::String& test_image, const cv::String& json_path, int repetitions, int max_side);
+
+#endif
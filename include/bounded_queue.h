@@ -0,0 +1,95 @@
+/*++
+* Arminder Singh
+* CPE462 Image Processing Final Project
+* I pledge my Honor that I have abided by the Stevens Honor System.
+* - Arminder Singh
+--*/
+
+//
+// bounded_queue.h
+//
+// Fixed-capacity blocking FIFO used to connect the stages of the color wheel pipeline.
+// push() blocks while the queue is full, which is what keeps a fast stage from running ahead of a slow one and
+// piling up decoded images in memory. Once close() is called, pushes fail and pops drain what is left.
+//
+
+#ifndef bounded_queue_h
+#define bounded_queue_h
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+
+template <typename T>
+class bounded_queue {
+public:
+	explicit bounded_queue(size_t capacity) : capacity(capacity > 0 ? capacity : 1), closed(false) {}
+
+	bounded_queue(const bounded_queue&) = delete;
+	bounded_queue& operator=(const bounded_queue&) = delete;
+
+	//
+	// Blocks until there is room. Returns false (and drops the item) if the queue was closed.
+	//
+	bool push(T item) {
+		std::unique_lock<std::mutex> guard(lock);
+		not_full.wait(guard, [this] { return closed || items.size() < capacity; });
+		if (closed) {
+			return false;
+		}
+		items.push_back(std::move(item));
+		guard.unlock();
+		not_empty.notify_one();
+		return true;
+	}
+
+	//
+	// Blocks until an item is available. Returns false once the queue is closed and empty.
+	//
+	bool pop(T& item) {
+		std::unique_lock<std::mutex> guard(lock);
+		not_empty.wait(guard, [this] { return closed || !items.empty(); });
+		if (items.empty()) {
+			return false;
+		}
+		item = std::move(items.front());
+		items.pop_front();
+		guard.unlock();
+		not_full.notify_one();
+		return true;
+	}
+
+	//
+	// Non-blocking pop, returns false if nothing is queued right now.
+	//
+	bool try_pop(T& item) {
+		std::unique_lock<std::mutex> guard(lock);
+		if (items.empty()) {
+			return false;
+		}
+		item = std::move(items.front());
+		items.pop_front();
+		guard.unlock();
+		not_full.notify_one();
+		return true;
+	}
+
+	void close() {
+		{
+			std::lock_guard<std::mutex> guard(lock);
+			closed = true;
+		}
+		not_full.notify_all();
+		not_empty.notify_all();
+	}
+
+private:
+	std::mutex lock;
+	std::condition_variable not_full;
+	std::condition_variable not_empty;
+	std::deque<T> items;
+	size_t capacity;
+	bool closed;
+};
+
+#endif
@@ -0,0 +1,61 @@
+/*++
+* Arminder Singh
+* CPE462 Image Processing Final Project
+* I pledge my Honor that I have abided by the Stevens Honor System.
+* - Arminder Singh
+--*/
+
+//
+// channel_view.h
+//
+// Zero-copy access to the individual channels of an interleaved 8-bit image.
+//
+// The color wheel used to cv::split the (rotated) input into three planar copies and cv::merge a permuted
+// fourth copy back together for the mixed output. Instead, per-channel consumers read a strided view of the
+// interleaved BGR buffer, and the mixed image is produced by shuffling that buffer in place.
+//
+
+#ifndef channel_view_h
+#define channel_view_h
+
+#include <opencv2/opencv.hpp>
+
+//
+// A single channel of an interleaved image. Sample (y, x) lives at data[y * row_step + x * pixel_step].
+// The view does not own the memory, the parent Mat must outlive it.
+//
+typedef struct {
+	uchar* data;        // first sample of this channel in row 0 of the parent image
+	int rows;
+	int cols;
+	size_t row_step;    // bytes between rows of the parent image
+	int pixel_step;     // bytes between neighbouring pixels (the parent's channel count)
+} channel_view;
+
+//
+// Creates a view of channel 'channel' (0-based) of an 8-bit image. The image must have at least channel + 1 channels.
+//
+channel_view make_channel_view(cv::Mat& image, int channel);
+
+//
+// Copies the channel into 'plane' (an 8UC1 Mat that is (re)allocated only if its size doesn't match, so callers can
+// reuse one plane for every channel). If 'hist' is not NULL, the 256-bin histogram of the channel is computed in the
+// same pass.
+//
+void channel_view_extract(const channel_view& view, cv::Mat& plane, int* hist);
+
+//
+// Builds the same lookup table cv::equalizeHist derives from a histogram, so equalization can be applied with a
+// single cv::LUT pass (or folded into another pass) without histogramming the channel a second time.
+//
+void build_equalize_lut(const int hist[256], int total, uchar lut[256]);
+
+//
+// Rearranges the channels of a 3-channel 8-bit image in place: out[k] = in[order[k]] for every pixel.
+// If 'luts' is not NULL, luts[c] is applied to source channel c during the same pass, i.e.
+// out[k] = luts[order[k]][in[order[k]]] (used to fold histogram equalization into the shuffle).
+// The plain shuffle path is vectorized with OpenCV universal intrinsics.
+//
+void permute_channels_inplace(cv::Mat& image, const int order[3], const uchar* const* luts);
+
+#endif
@@ -0,0 +1,77 @@
+/*++
+* Arminder Singh
+* CPE462 Image Processing Final Project
+* I pledge my Honor that I have abided by the Stevens Honor System.
+* - Arminder Singh
+--*/
+
+//
+// color_wheel.h
+//
+// The color wheel as a library call, for linking into other programs instead of shelling out to the executable.
+//
+// Everything stays in memory: the input is a cv::Mat or an encoded buffer, the seven results land in storage the
+// caller owns (as Mats, or encoded buffers), and nothing here touches the filesystem. Randomness only comes from
+// options->mix_seed, so there is no global rand() state and the same call always gives the same results.
+//
+// The storage structs are meant to be kept and reused: their Mats and buffers are only reallocated when the image
+// size changes. Separate storage may be used from separate threads concurrently.
+//
+// Functions return 0 on success and -1 on failure (bad input or an OpenCV error), like the rest of the project.
+//
+
+#ifndef color_wheel_h
+#define color_wheel_h
+
+#include <stddef.h>
+#include <vector>
+#include <opencv2/opencv.hpp>
+#include "color_wheel_pipeline.h"
+
+//
+// The seven results as images, indexed by color_wheel_output. The channel outputs are CV_8UC1, the rest CV_8UC3.
+//
+typedef struct {
+	cv::Mat images[COLOR_WHEEL_OUT_MAX];
+} color_wheel_images;
+
+//
+// The seven results encoded, indexed by color_wheel_output.
+//
+typedef struct {
+	std::vector<uchar> buffers[COLOR_WHEEL_OUT_MAX];
+} color_wheel_encoded;
+
+//
+// Fills in the defaults the command line uses: no rotation, no equalization, cropped canvas, mix seed 0.
+//
+void color_wheel_default_options(color_wheel_options* options);
+
+//
+// Runs the color wheel on 'input' (BGR8, BGRA8 or 8-bit grayscale; left untouched).
+//
+int color_wheel_process(const cv::Mat& input, const color_wheel_options* options, color_wheel_images* out);
+
+//
+// Same, for a BGR8 image the caller has put in out->images[COLOR_WHEEL_OUT_MIXED] (say, imread straight into it),
+// which the transform then consumes in place instead of working on a copy.
+//
+int color_wheel_process_in_place(const color_wheel_options* options, color_wheel_images* out);
+
+//
+// Same, for an encoded image (anything cv::imdecode reads). The image is decoded straight into 'out'.
+//
+int color_wheel_process_buffer(const uchar* data, size_t size, const color_wheel_options* options, color_wheel_images* out);
+
+//
+// Encodes results with cv::imencode, the seven in parallel. 'ext' picks the format (".jpg", ".png", ...); 'params'
+// are the usual cv::imencode parameters and may be empty.
+//
+int color_wheel_encode(const color_wheel_images* images, const char* ext, const std::vector<int>& params, color_wheel_encoded* out);
+
+//
+// Encoded bytes in, encoded results out. 'scratch' holds the intermediate images and can be reused between calls.
+//
+int color_wheel_process_encoded(const uchar* data, size_t size, const color_wheel_options* options, const char* ext, color_wheel_images* scratch, color_wheel_encoded* out);
+
+#endif
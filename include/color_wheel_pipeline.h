@@ -0,0 +1,137 @@
+/*++
+* Arminder Singh
+* CPE462 Image Processing Final Project
+* I pledge my Honor that I have abided by the Stevens Honor System.
+* - Arminder Singh
+--*/
+
+//
+// color_wheel_pipeline.h
+//
+// The color wheel as overlapping stages:
+//
+//   decode (imread) --> transform (rotate, channels, equalize, colormap, mix) --> encode (imwrite, x7 per image)
+//
+// Stages are connected by bounded queues, so a stage that runs ahead blocks instead of buffering unbounded numbers
+// of decoded images, and the seven JPEG encodes of every image run concurrently on a work-stealing encoder pool.
+// With several images in flight, per-image wall time approaches the slowest stage instead of the sum of all of them.
+//
+
+#ifndef color_wheel_pipeline_h
+#define color_wheel_pipeline_h
+
+#include <atomic>
+#include <functional>
+#include <thread>
+#include <vector>
+#include <opencv2/opencv.hpp>
+#include "bounded_queue.h"
+#include "rotation.h"
+#include "work_pool.h"
+
+//
+// Options shared by every color wheel mode (and the library API in color_wheel.h).
+//
+typedef struct {
+	int rotation_angle; //default to keeping image angle as is. Degrees counter-clockwise, may be negative.
+	bool do_histogram_equalization; //do not do histogram equalization by default.
+	rotation_canvas canvas; // crop arbitrary angles to the input size by default.
+	unsigned int mix_seed; // picks the channel order of the mixed output; the same seed always gives the same mix.
+} color_wheel_options;
+
+//
+// The seven images the color wheel produces for every input, in the order the transform stage emits them.
+//
+typedef enum {
+	COLOR_WHEEL_OUT_CH_1 = 0,
+	COLOR_WHEEL_OUT_CH_2,
+	COLOR_WHEEL_OUT_CH_3,
+	COLOR_WHEEL_OUT_1,
+	COLOR_WHEEL_OUT_2,
+	COLOR_WHEEL_OUT_3,
+	COLOR_WHEEL_OUT_MIXED,
+	COLOR_WHEEL_OUT_MAX
+} color_wheel_output;
+
+//
+// File name (without the per-image prefix) of each output.
+//
+extern const char* const color_wheel_output_names[COLOR_WHEEL_OUT_MAX];
+
+class color_wheel_pipeline {
+public:
+	//
+	// transform_workers - threads running the transform stage (at least 1).
+	// encode_workers - size of the encoder pool, 0 means one per hardware thread.
+	//
+	color_wheel_pipeline(const color_wheel_options* options, unsigned int transform_workers, unsigned int encode_workers);
+	~color_wheel_pipeline();
+
+	color_wheel_pipeline(const color_wheel_pipeline&) = delete;
+	color_wheel_pipeline& operator=(const color_wheel_pipeline&) = delete;
+
+	//
+	// Queues an input image; its outputs are written as out_prefix + color_wheel_output_names[i].
+	// Every image gets its own mix seed (options->mix_seed plus the order it was added in), so a batch still varies
+	// its channel mixes but is reproducible for a given seed.
+	// Blocks if the decode stage is backed up.
+	//
+	void add(const cv::String& input, const cv::String& out_prefix);
+
+	//
+	// Waits for every queued image to be fully written and shuts the stages down.
+	// Returns the number of failures: inputs that couldn't be decoded plus outputs that couldn't be written.
+	//
+	int finish();
+
+private:
+	typedef struct {
+		cv::String input;
+		cv::String out_prefix;
+		unsigned int mix_seed;
+	} input_job;
+
+	typedef struct {
+		cv::String input;
+		cv::String out_prefix;
+		unsigned int mix_seed;
+		cv::Mat image;
+	} decoded_job;
+
+	typedef struct {
+		cv::String path;
+		cv::Mat image;
+	} encode_job;
+
+	void decode_main();
+	void transform_main();
+	void encode_one();
+
+	color_wheel_options options;
+	bounded_queue<input_job> input_queue;
+	bounded_queue<decoded_job> decoded_queue;
+	bounded_queue<encode_job> encode_queue;
+	work_pool encoders;
+	std::thread decoder;
+	std::vector<std::thread> transformers;
+	std::atomic<int> failures;
+	unsigned int images_added;
+	bool finished;
+};
+
+//
+// Channel order of the mixed output for a given seed: mixed channel k is input channel order[k].
+//
+const int* color_wheel_mix_order(unsigned int mix_seed);
+
+//
+// Runs the color transform on one decoded BGR8 image. 'image' is consumed (it is rotated and then shuffled in place
+// to become the mixed output). 'emit' is called once per output as soon as that output is ready; the Mat handed to it
+// is never modified afterwards, so it can be encoded on another thread while the transform carries on.
+// 'storage', if not NULL, is an array of COLOR_WHEEL_OUT_MAX Mats that hold the channel and colormapped outputs
+// instead of fresh allocations; they are only reallocated when the image size changes, so a long-lived caller can
+// keep them warm between images.
+//
+void color_wheel_transform(cv::Mat& image, const color_wheel_options* options, cv::Mat* storage, const std::function<void(color_wheel_output, const cv::Mat&)>& emit);
+
+#endif
@@ -0,0 +1,51 @@
+/*++
+* Arminder Singh
+* CPE462 Image Processing Final Project
+* I pledge my Honor that I have abided by the Stevens Honor System.
+* - Arminder Singh
+--*/
+
+//
+// color_wheel_service.h
+//
+// Long-lived color wheel daemon listening on a Unix domain socket (AF_UNIX, also available on Windows 10 1803+).
+// Process start-up, OpenCV initialization and buffer allocation are paid once instead of per image: every connection
+// keeps its decode buffer, output Mats and encode buffers warm between requests, and the seven encodes of a request
+// run concurrently on a shared encoder pool.
+//
+// Protocol (a connection may send any number of requests, one after the other):
+//
+//   PATH <angle> <equalize 0|1> <expand_canvas 0|1>\n<input path>\n<output prefix>\n
+//     Reads the input from disk and writes the usual outputs as <output prefix><out_*.jpg name>.
+//     Reply: "OK 7\n" followed by the seven output paths, one per line.
+//
+//   DATA <angle> <equalize 0|1> <expand_canvas 0|1> <byte count>\n<JPEG bytes>
+//     Decodes the JPEG from the request and returns the outputs encoded in memory; nothing touches the disk.
+//     Reply: "OK 7\n" followed by, for each output, "<out_*.jpg name> <byte count>\n<JPEG bytes>".
+//
+//   SHUTDOWN\n
+//     Reply: "OK 0\n", then the service stops accepting connections. Every other open connection is closed for
+//     reading: the requests it has already sent (as far as the service has read them) are served and answered, then
+//     it is closed. The service exits once they all are.
+//
+// A failed request is answered with "ERR <message>\n" and the connection stays usable, except after a malformed
+// request header (or a DATA size over the limit): the service can't tell where that request ends, so it answers and
+// closes the connection.
+// Outputs are always listed in color_wheel_output order.
+//
+
+#ifndef color_wheel_service_h
+#define color_wheel_service_h
+
+//
+// Largest DATA payload the service will accept.
+//
+#define COLOR_WHEEL_SERVICE_MAX_INPUT (256u * 1024u * 1024u)
+
+//
+// Runs the service on 'socket_path' until a SHUTDOWN request arrives. encode_workers == 0 means one encoder per
+// hardware thread. Returns 0 on a clean shutdown, -1 if the socket couldn't be set up.
+//
+int color_wheel_service_run(const char* socket_path, unsigned int encode_workers);
+
+#endif
@@ -14,16 +14,33 @@
 // So resulting files are often quite large. The hope is that it will be handy nonetheless
 // as a quick and easily-integrated way for programs to spit out animations.
 //
-// Only RGBA8 is currently supported as an input format. (The alpha is ignored.)
+// Besides Floyd-Steinberg, frames can be dithered with a Bayer matrix (kGifDitherOrdered), which is cheaper and
+// parallelizes trivially.
+//
+// GifWriteFrame takes RGBA8 input (the alpha is ignored). GifWriteFrameFromSource takes any 8-bit interleaved
+// layout with a row stride (RGB, BGR, BGRA, grayscale, ...) described by a GifFrameSource, so callers don't need to
+// convert their frames to RGBA first.
 //
 // If capturing a buffer with a bottom-left origin (such as OpenGL), define GIF_FLIP_VERT
 // to automatically flip the buffer data when writing the image (the buffer itself is
 // unchanged.
 //
 // USAGE:
-// Create a GifWriter struct. Pass it to GifBegin() to initialize and write the header.
+// Create a GifWriter struct. Pass it to GifBegin() to initialize (the header is written along with the first frame).
 // Pass subsequent frames to GifWriteFrame().
 // Finally, call GifEnd() to close the file handle and free memory.
+// GifBeginMemory() builds the GIF in a growable memory buffer instead of a file, and GifBeginCallback() hands the bytes
+// to a callback; either way they are collected in large blocks rather than written a byte at a time.
+// By default every frame gets a palette of its own. GifUseGlobalPalette() right after GifBegin() instead writes a single
+// palette (say, from GifMakeGlobalPalette() over all the frames) in the header and palettizes every frame against it.
+// A writer allocates everything it needs up front, so frames don't touch the heap; GifUseScratch() hands it the memory
+// for its temporaries instead.
+// GifBeginAsync() instead of GifBegin() overlaps the frames: GifWriteFrame() returns once the frame is palettized,
+// and it's LZW-encoded and written on a separate thread while the next frame is being palettized.
+// GifWriteIndexedFrame() takes a frame that is already palette indices, plus its palette, and skips the quantizing.
+// GifWriteGrayFrame() does the same for 8-bit grayscale frames, with a gray ramp palette.
+// GifUseTiledEncoding() also spreads the LZW encoding of a large frame over several threads, by writing it as a stack
+// of horizontal bands.
 //
 
 #ifndef gif_h
@@ -33,12 +50,19 @@
 #include <string.h>  // for memcpy and bzero
 #include <stdint.h>  // for integer typedefs
 #include <stdbool.h> // for bool macros
+#include <atomic>    // for the parallel Floyd-Steinberg wavefront and the GifBeginAsync encoder thread
+#include <condition_variable>
+#include <mutex>
+#include <new>
+#include <thread>
 
 // Define these macros to hook into a custom memory allocator.
 // TEMP_MALLOC and TEMP_FREE will only be called in stack fashion - frees in the reverse order of mallocs
 // and any temp memory allocated by a function will be freed before it exits.
-// MALLOC and FREE are used only by GifBegin and GifEnd respectively (to allocate a buffer the size of the image, which
-// is used to find changed pixels for delta-encoding.)
+// MALLOC and FREE are used only by GifBegin (and GifBeginAsync) and GifEnd respectively (to allocate a buffer the size
+// of the image, which is used to find changed pixels for delta-encoding.)
+// A writer started with GifBeginAsync encodes on a thread of its own, so TEMP_MALLOC/TEMP_FREE are then called from
+// two threads at once - each thread's calls are still in stack order.
 
 #ifndef GIF_TEMP_MALLOC
 #include <stdlib.h>
@@ -60,8 +84,47 @@
 #define GIF_FREE free
 #endif
 
+// Define these macros to trace the phases of GifWriteFrame (palette, threshold/dither, LZW) in a profiler.
+// GIF_TRACE_BEGIN(name, offset) is called before a phase and GIF_TRACE_END(name, offset, width, height) after it;
+// offset is how many bytes of the GIF had been written (always 0 around phases that write nothing), so the hook can
+// tell how many bytes the phase wrote. By default they compile to nothing.
+
+#ifndef GIF_TRACE_BEGIN
+#define GIF_TRACE_BEGIN(name, offset)
+#endif
+
+#ifndef GIF_TRACE_END
+#define GIF_TRACE_END(name, offset, width, height)
+#endif
+
+// Define this macro to spread work across threads. GIF_PARALLEL_FOR(numTasks, task) must call task(i) once for every i
+// in [0, numTasks), in any order and on any threads, and return when they have all finished; the tasks of one call
+// never write to the same memory. task is a callable taking an int. By default the tasks run one after another.
+
+#ifndef GIF_PARALLEL_FOR
+#define GIF_PARALLEL_FOR(numTasks, task) do { for(int gifTaskIndex=0; gifTaskIndex<(numTasks); ++gifTaskIndex) (task)(gifTaskIndex); } while(0)
+#endif
+
+// most tasks a job is split into, and the smallest frame that is palettized in parallel
+#ifndef GIF_MAX_TASKS
+#define GIF_MAX_TASKS 8
+#endif
+
+#ifndef GIF_PARALLEL_MIN_PIXELS
+#define GIF_PARALLEL_MIN_PIXELS (1 << 18)
+#endif
+
 const int kGifTransIndex = 0;
 
+// value for the bitDepth argument of GifWriteFrame: the fewest bits that hold the frame's colors exactly, or 8 if they
+// don't fit in a palette (see GifMakeExactPalette)
+const int kGifBitDepthAuto = 0;
+
+// values for the dither argument of GifWriteFrame (true and false still mean Floyd-Steinberg and none)
+const int kGifDitherNone = 0;
+const int kGifDitherFloydSteinberg = 1;
+const int kGifDitherOrdered = 2;    // Bayer matrix: no error diffusion, every pixel is independent
+
 typedef struct
 {
     int bitDepth;
@@ -70,68 +133,229 @@ typedef struct
     uint8_t g[256];
     uint8_t b[256];
 
-    // k-d tree over RGB space, organized in heap fashion
+    // the k-d tree over RGB space the palette was built from, organized in heap fashion
     // i.e. left child of node i is node i*2, right child is node i*2+1
     // nodes 256-511 are implicitly the leaves, containing a color
     uint8_t treeSplitElt[256];
     uint8_t treeSplit[256];
+
+    // optional accelerator for nearest-color lookups, see GifClosestPaletteIndex. Work split into tasks gives each
+    // task one of its own: these are the first numCaches of them (a cache set without numCaches counts as one).
+    struct GifColorCache* cache;
+    int numCaches;
 } GifPalette;
 
+// Nearest-color lookup for a palette, see GifClosestPaletteIndex.
+// Direct mapped memo of recent results, on a hash of the 24-bit color; each tag holds the color and the generation it
+// was stored in, so starting over for a new palette is just bumping the generation (tags are only cleared when it wraps).
+#ifndef GIF_COLOR_CACHE_BITS
+#define GIF_COLOR_CACHE_BITS 17
+#endif
+
+// Colors the memo misses go to a coarse grid over RGB space. Each cell lists the palette entries that can be the
+// closest one to some color inside it, filled in the first time a color lands there.
+#define GIF_COLOR_GRID_SHIFT 4
+#define GIF_COLOR_GRID_SIDE (256 >> GIF_COLOR_GRID_SHIFT)
+#define GIF_COLOR_GRID_CELLS (GIF_COLOR_GRID_SIDE*GIF_COLOR_GRID_SIDE*GIF_COLOR_GRID_SIDE)
+
+struct GifColorCache
+{
+    uint32_t tags[1 << GIF_COLOR_CACHE_BITS];   // generation << 24 | rgb
+    uint8_t indices[1 << GIF_COLOR_CACHE_BITS];
+
+    uint8_t cellGeneration[GIF_COLOR_GRID_CELLS];
+    uint8_t cellCount[GIF_COLOR_GRID_CELLS];
+    uint32_t cellStart[GIF_COLOR_GRID_CELLS];
+    uint8_t candidates[GIF_COLOR_GRID_CELLS * 255];
+    uint32_t candidatesUsed;
+
+    uint32_t generation;
+};
+
+// Describes where the pixels of a frame come from.
+// Pixel (x, y) starts at data + y*rowStride + x*pixelStride, and its red, green and blue samples are rOffset, gOffset
+// and bOffset bytes from there. A grayscale image points all three offsets at the same byte.
+typedef struct
+{
+    const uint8_t* data;
+    size_t rowStride;
+    uint32_t pixelStride;
+    uint8_t rOffset;
+    uint8_t gOffset;
+    uint8_t bOffset;
+
+    uint8_t padding[1];    // make padding explicit
+} GifFrameSource;
+
+// Describes a tightly packed RGBA8 image, the input format of GifWriteFrame.
+void GifFrameSourceRGBA( GifFrameSource* src, const uint8_t* image, uint32_t width )
+{
+    src->data = image;
+    src->rowStride = (size_t)width * 4;
+    src->pixelStride = 4;
+    src->rOffset = 0;
+    src->gOffset = 1;
+    src->bOffset = 2;
+    src->padding[0] = 0;
+}
+
 // max, min, and abs functions
 int GifIMax(int l, int r) { return l>r?l:r; }
 int GifIMin(int l, int r) { return l<r?l:r; }
 int GifIAbs(int i) { return i<0?-i:i; }
 
-// walks the k-d tree to pick the palette entry for a desired color.
-// Takes as in/out parameters the current best color and its error -
-// only changes them if it finds a better color in its subtree.
-// this is the major hotspot in the code at the moment.
-void GifGetClosestPaletteColor( GifPalette* pPal, int r, int g, int b, int* bestInd, int* bestDiff, int treeRoot )
+// forgets every cached color, call this whenever the palette changes
+void GifColorCacheReset( GifColorCache* cache )
+{
+    cache->generation = (cache->generation + 1) & 0xff;
+    if(cache->generation == 0)
+    {
+        // generation 0 is never live, so a wrapped counter must not match tags left over from 256 palettes ago
+        memset(cache->tags, 0, sizeof(cache->tags));
+        memset(cache->cellGeneration, 0, sizeof(cache->cellGeneration));
+        cache->generation = 1;
+    }
+    cache->candidatesUsed = 0;
+}
+
+// distance from one color component to the nearest and farthest points of the range [lo, hi]
+void GifRangeDistance( int c, int lo, int hi, int* nearDist, int* farDist )
+{
+    *nearDist = c < lo? lo - c : (c > hi? c - hi : 0);
+    *farDist = GifIMax(GifIAbs(c - lo), GifIAbs(c - hi));
+}
+
+// Lists the candidates for one grid cell.
+// Some entry is within 'bound' of every color in the cell, so the closest entry to any of them is at most that far
+// from the cell, and entries farther away than that can be left out.
+void GifColorCacheFillCell( GifColorCache* cache, const GifPalette* pPal, int cell, int r0, int g0, int b0 )
 {
-    // base case, reached the bottom of the tree
-    if(treeRoot > (1<<pPal->bitDepth)-1)
+    const int side = 1 << GIF_COLOR_GRID_SHIFT;
+    int numColors = 1 << pPal->bitDepth;
+    int nearDist[256];
+    int bound = 1000000;
+
+    for(int ind=0; ind<numColors; ++ind)
+    {
+        if(ind == kGifTransIndex) continue;
+
+        int rNear, rFar, gNear, gFar, bNear, bFar;
+        GifRangeDistance(pPal->r[ind], r0, r0+side-1, &rNear, &rFar);
+        GifRangeDistance(pPal->g[ind], g0, g0+side-1, &gNear, &gFar);
+        GifRangeDistance(pPal->b[ind], b0, b0+side-1, &bNear, &bFar);
+        nearDist[ind] = rNear+gNear+bNear;
+        bound = GifIMin(bound, rFar+gFar+bFar);
+    }
+
+    uint8_t* list = cache->candidates + cache->candidatesUsed;
+    int count = 0;
+    for(int ind=0; ind<numColors; ++ind)
     {
-        int ind = treeRoot-(1<<pPal->bitDepth);
-        if(ind == kGifTransIndex) return;
+        if(ind != kGifTransIndex && nearDist[ind] <= bound) list[count++] = (uint8_t)ind;
+    }
 
-        // check whether this color is better than the current winner
-        int r_err = r - ((int32_t)pPal->r[ind]);
-        int g_err = g - ((int32_t)pPal->g[ind]);
-        int b_err = b - ((int32_t)pPal->b[ind]);
-        int diff = GifIAbs(r_err)+GifIAbs(g_err)+GifIAbs(b_err);
+    cache->cellStart[cell] = cache->candidatesUsed;
+    cache->cellCount[cell] = (uint8_t)count;
+    cache->cellGeneration[cell] = (uint8_t)cache->generation;
+    cache->candidatesUsed += (uint32_t)count;
+}
 
-        if(diff < *bestDiff)
+// returns the entry closest to a color (sum of absolute differences) out of 'count' entries listed in increasing order.
+// Ties go to the lowest index.
+int GifClosestListedColor( const GifPalette* pPal, const uint8_t* list, int count, int r, int g, int b )
+{
+    int bestInd = list[0];
+    int bestDiff = 1000000;
+    for(int ii=0; ii<count; ++ii)
+    {
+        int ind = list[ii];
+        int diff = GifIAbs(r - (int)pPal->r[ind]) + GifIAbs(g - (int)pPal->g[ind]) + GifIAbs(b - (int)pPal->b[ind]);
+        if(diff < bestDiff)
         {
-            *bestInd = ind;
-            *bestDiff = diff;
+            bestInd = ind;
+            bestDiff = diff;
         }
-
-        return;
     }
+    return bestInd;
+}
+
+// picks the palette entry closest to a desired color - never the transparent one.
+// Colors already seen with this palette are a single table lookup, others are compared against the candidates of
+// their grid cell, which always include every entry that could be the closest.
+// Dithering can push a component outside 0-255. Every palette entry is within 0-255, so that only adds the same amount
+// to the distance of every entry, and the clamped color picks the same one.
+int GifClosestPaletteIndex( GifPalette* pPal, int r, int g, int b )
+{
+    GifColorCache* cache = pPal->cache;
 
-    // take the appropriate color (r, g, or b) for this node of the k-d tree
-    int comps[3]; comps[0] = r; comps[1] = g; comps[2] = b;
-    int splitComp = comps[pPal->treeSplitElt[treeRoot]];
+    r = GifIMax(0, GifIMin(r, 255));
+    g = GifIMax(0, GifIMin(g, 255));
+    b = GifIMax(0, GifIMin(b, 255));
 
-    int splitPos = pPal->treeSplit[treeRoot];
-    if(splitPos > splitComp)
+    if(!cache)
     {
-        // check the left subtree
-        GifGetClosestPaletteColor(pPal, r, g, b, bestInd, bestDiff, treeRoot*2);
-        if( *bestDiff > splitPos - splitComp )
+        uint8_t all[256];
+        int count = 0;
+        for(int ind=0; ind<(1 << pPal->bitDepth); ++ind)
         {
-            // cannot prove there's not a better value in the right subtree, check that too
-            GifGetClosestPaletteColor(pPal, r, g, b, bestInd, bestDiff, treeRoot*2+1);
+            if(ind != kGifTransIndex) all[count++] = (uint8_t)ind;
         }
+        return GifClosestListedColor(pPal, all, count, r, g, b);
     }
-    else
+
+    uint32_t rgb = ((uint32_t)r << 16) | ((uint32_t)g << 8) | (uint32_t)b;
+    uint32_t slot = (rgb * 2654435761u) >> (32 - GIF_COLOR_CACHE_BITS);
+    uint32_t tag = (cache->generation << 24) | rgb;
+    if(cache->tags[slot] == tag) return cache->indices[slot];
+
+    int cr = r >> GIF_COLOR_GRID_SHIFT, cg = g >> GIF_COLOR_GRID_SHIFT, cb = b >> GIF_COLOR_GRID_SHIFT;
+    int cell = (cr*GIF_COLOR_GRID_SIDE + cg)*GIF_COLOR_GRID_SIDE + cb;
+    if(cache->cellGeneration[cell] != cache->generation)
+    {
+        GifColorCacheFillCell(cache, pPal, cell, cr << GIF_COLOR_GRID_SHIFT, cg << GIF_COLOR_GRID_SHIFT, cb << GIF_COLOR_GRID_SHIFT);
+    }
+
+    int bestInd = GifClosestListedColor(pPal, cache->candidates + cache->cellStart[cell], cache->cellCount[cell], r, g, b);
+    cache->tags[slot] = tag;
+    cache->indices[slot] = (uint8_t)bestInd;
+    return bestInd;
+}
+
+// Scratch memory for the temporaries of a frame, owned by a GifWriter so that frames after the first don't allocate.
+// Allocations are carved off the front; freeing one gives back it and everything allocated after it, so a function
+// that frees its temporaries in reverse order leaves the arena as it found it. Functions that take a GifArena* fall back
+// to GIF_TEMP_MALLOC/GIF_TEMP_FREE when it's NULL or out of room.
+typedef struct
+{
+    uint8_t* base;
+    size_t size;
+    size_t used;
+} GifArena;
+
+#define GIF_ARENA_ALIGN 64    // a cache line, so buffers of different tasks never share one
+
+void* GifArenaAlloc( GifArena* arena, size_t size )
+{
+    if(arena)
     {
-        GifGetClosestPaletteColor(pPal, r, g, b, bestInd, bestDiff, treeRoot*2+1);
-        if( *bestDiff > splitComp - splitPos )
+        uintptr_t start = ((uintptr_t)(arena->base + arena->used) + GIF_ARENA_ALIGN - 1) & ~(uintptr_t)(GIF_ARENA_ALIGN - 1);
+        size_t offset = (size_t)(start - (uintptr_t)arena->base);
+        if(offset <= arena->size && size <= arena->size - offset)
         {
-            GifGetClosestPaletteColor(pPal, r, g, b, bestInd, bestDiff, treeRoot*2);
+            arena->used = offset + size;
+            return arena->base + offset;
         }
     }
+    return GIF_TEMP_MALLOC(size);
+}
+
+void GifArenaFree( GifArena* arena, void* ptr )
+{
+    uint8_t* bytes = (uint8_t*)ptr;
+    if(arena && bytes >= arena->base && bytes < arena->base + arena->size)
+        arena->used = (size_t)(bytes - arena->base);
+    else
+        GIF_TEMP_FREE(ptr);
 }
 
 void GifSwapPixels(uint8_t* image, int pixA, int pixB)
@@ -348,53 +572,44 @@ void GifSplitPalette(uint8_t* image, int numPixels, int treeNode, int treeLevel,
     GifSplitPalette(image+subPixelsA*4, subPixelsB, treeNode*2+1, treeLevel+1, buildForDither, pal);
 }
 
-// Finds all pixels that have changed from the previous image and
-// moves them to the fromt of th buffer.
-// This allows us to build a palette optimized for the colors of the
-// changed pixels only.
-int GifPickChangedPixels( const uint8_t* lastFrame, uint8_t* frame, int numPixels )
+// Creates a palette by placing all the image pixels in a k-d tree and then averaging the blocks at the bottom.
+// This is known as the "median split" technique
+// 'stride' is the number of pixels from one row of lastFrame to the next (lastFrame can be a rectangle of a larger frame).
+void GifMakePalette( const uint8_t* lastFrame, const GifFrameSource* nextFrame, uint32_t width, uint32_t height, uint32_t stride, int bitDepth, bool buildForDither, GifPalette* pPal,
+                     GifArena* arena )
 {
-    int numChanged = 0;
-    uint8_t* writeIter = frame;
+    pPal->bitDepth = bitDepth;
 
-    for (int ii=0; ii<numPixels; ++ii)
+    // SplitPalette is destructive (it sorts the pixels by color), so it works on a list of them: the pixels that
+    // changed from the previous image (all of them on the first frame) are gathered into it straight from the source,
+    // without converting the frame to RGBA first.
+    uint8_t* destroyableImage = (uint8_t*)GifArenaAlloc(arena, (size_t)width * height * 4);
+    uint8_t* writeIter = destroyableImage;
+    for(uint32_t yy=0; yy<height; ++yy)
     {
-        if(lastFrame[0] != frame[0] ||
-           lastFrame[1] != frame[1] ||
-           lastFrame[2] != frame[2])
+        const uint8_t* pix = nextFrame->data + yy*nextFrame->rowStride;
+        const uint8_t* last = lastFrame? lastFrame + 4*(size_t)yy*stride : NULL;
+        for(uint32_t xx=0; xx<width; ++xx, pix += nextFrame->pixelStride)
         {
-            writeIter[0] = frame[0];
-            writeIter[1] = frame[1];
-            writeIter[2] = frame[2];
-            ++numChanged;
+            uint8_t r = pix[nextFrame->rOffset], g = pix[nextFrame->gOffset], b = pix[nextFrame->bOffset];
+            if(last)
+            {
+                bool same = (last[0] == r && last[1] == g && last[2] == b);
+                last += 4;
+                if(same) continue;
+            }
+            writeIter[0] = r;
+            writeIter[1] = g;
+            writeIter[2] = b;
+            writeIter[3] = 255;
             writeIter += 4;
         }
-        lastFrame += 4;
-        frame += 4;
     }
-
-    return numChanged;
-}
-
-// Creates a palette by placing all the image pixels in a k-d tree and then averaging the blocks at the bottom.
-// This is known as the "median split" technique
-void GifMakePalette( const uint8_t* lastFrame, const uint8_t* nextFrame, uint32_t width, uint32_t height, int bitDepth, bool buildForDither, GifPalette* pPal )
-{
-    pPal->bitDepth = bitDepth;
-
-    // SplitPalette is destructive (it sorts the pixels by color) so
-    // we must create a copy of the image for it to destroy
-    size_t imageSize = (size_t)(width * height * 4 * sizeof(uint8_t));
-    uint8_t* destroyableImage = (uint8_t*)GIF_TEMP_MALLOC(imageSize);
-    memcpy(destroyableImage, nextFrame, imageSize);
-
-    int numPixels = (int)(width * height);
-    if(lastFrame)
-        numPixels = GifPickChangedPixels(lastFrame, destroyableImage, numPixels);
+    int numPixels = (int)((writeIter - destroyableImage) / 4);
 
     GifSplitPalette(destroyableImage, numPixels, 1, 0, buildForDither, pPal);
 
-    GIF_TEMP_FREE(destroyableImage);
+    GifArenaFree(arena, destroyableImage);
 
     // add the bottom node for the transparency index
     pPal->treeSplit[1 << (bitDepth-1)] = 0;
@@ -403,462 +618,2093 @@ void GifMakePalette( const uint8_t* lastFrame, const uint8_t* nextFrame, uint32_
     pPal->r[0] = pPal->g[0] = pPal->b[0] = 0;
 }
 
-// Implements Floyd-Steinberg dithering, writes palette value to alpha
-void GifDitherImage( const uint8_t* lastFrame, const uint8_t* nextFrame, uint8_t* outFrame, uint32_t width, uint32_t height, GifPalette* pPal )
+// GifMakePaletteHistogram builds the same kind of median split palette from a histogram instead of the pixels themselves.
+// Colors are binned at 6 bits per channel; a bin only has to keep how many pixels fell in it and their sum, so the
+// averages at the bottom of the tree are still exact. The tree is split on the mean color of each bin.
+#define GIF_HISTOGRAM_BITS 6
+#define GIF_HISTOGRAM_SHIFT (8 - GIF_HISTOGRAM_BITS)
+#define GIF_HISTOGRAM_BINS (1 << (3*GIF_HISTOGRAM_BITS))
+
+// below this many pixels, setting up the histogram costs more than sorting the pixels, and GifWriteFrame uses GifMakePalette
+#ifndef GIF_HISTOGRAM_MIN_PIXELS
+#define GIF_HISTOGRAM_MIN_PIXELS (1 << 16)
+#endif
+
+// One thread's counts. The sums are of each pixel's offset from the bin's lowest color (0-3), which keeps them in
+// 32 bits for any frame a GIF can hold.
+typedef struct
+{
+    uint32_t count;
+    uint32_t rOffsets;
+    uint32_t gOffsets;
+    uint32_t bOffsets;
+} GifHistogramBin;
+
+// A non-empty bin, merged from every thread's counts.
+typedef struct
 {
-    int numPixels = (int)(width * height);
+    uint64_t r;     // sums of the pixels
+    uint64_t g;
+    uint64_t b;
+    uint32_t count;
+    uint8_t mean[3];  // what the tree splits on
 
-    // quantPixels initially holds color*256 for all pixels
-    // The extra 8 bits of precision allow for sub-single-color error values
-    // to be propagated
-    int32_t *quantPixels = (int32_t *)GIF_TEMP_MALLOC(sizeof(int32_t) * (size_t)numPixels * 4);
+    uint8_t padding[1];    // make padding explicit
+} GifHistogramColor;
 
-    for( int ii=0; ii<numPixels*4; ++ii )
+uint32_t GifHistogramWeight( const GifHistogramColor* colors, int numColors )
+{
+    uint32_t weight = 0;
+    for(int ii=0; ii<numColors; ++ii)
+        weight += colors[ii].count;
+    return weight;
+}
+
+// Moves the colors whose 'com' component is below splitValue to the front, followed by colors equal to it until
+// the front holds targetWeight pixels. Returns how many colors are in front.
+int GifPartitionHistogram( GifHistogramColor* colors, int numColors, int com, int splitValue, uint32_t targetWeight )
+{
+    int storeIndex = 0;
+    uint32_t weight = 0;
+    for(int ii=0; ii<numColors; ++ii)
     {
-        uint8_t pix = nextFrame[ii];
-        int32_t pix16 = (int32_t)(pix) * 256;
-        quantPixels[ii] = pix16;
+        if(colors[ii].mean[com] < splitValue)
+        {
+            GifHistogramColor tmp = colors[ii]; colors[ii] = colors[storeIndex]; colors[storeIndex] = tmp;
+            weight += colors[storeIndex].count;
+            ++storeIndex;
+        }
     }
-
-    for( uint32_t yy=0; yy<height; ++yy )
+    for(int ii=storeIndex; ii<numColors && weight < targetWeight; ++ii)
     {
-        for( uint32_t xx=0; xx<width; ++xx )
+        if(colors[ii].mean[com] == splitValue)
         {
-            int32_t* nextPix = quantPixels + 4*(yy*width+xx);
-            const uint8_t* lastPix = lastFrame? lastFrame + 4*(yy*width+xx) : NULL;
+            GifHistogramColor tmp = colors[ii]; colors[ii] = colors[storeIndex]; colors[storeIndex] = tmp;
+            weight += colors[storeIndex].count;
+            ++storeIndex;
+        }
+    }
+    return storeIndex;
+}
+
+// A subtree GifSplitHistogram left for another thread.
+typedef struct
+{
+    GifHistogramColor* colors;
+    int numColors;
+    int treeNode;
+} GifHistogramTask;
+
+// GifSplitPalette over histogram colors. Splits are made the same way, with pixel counts standing in for the number
+// of pixels on each side. When 'tasks' is given, the subtrees at level taskLevel are queued there instead of split.
+void GifSplitHistogram( GifHistogramColor* colors, int numColors, int treeNode, int treeLevel, bool buildForDither, GifPalette* pal,
+                        int taskLevel, GifHistogramTask* tasks, int* numTasks )
+{
+    if(numColors == 0)
+        return;
+
+    if(tasks && treeLevel == taskLevel)
+    {
+        tasks[*numTasks].colors = colors;
+        tasks[*numTasks].numColors = numColors;
+        tasks[*numTasks].treeNode = treeNode;
+        ++*numTasks;
+        return;
+    }
 
-            // Compute the colors we want (rounding to nearest)
-            int32_t rr = (nextPix[0] + 127) / 256;
-            int32_t gg = (nextPix[1] + 127) / 256;
-            int32_t bb = (nextPix[2] + 127) / 256;
+    int numEntries = (1 << pal->bitDepth);
+    const int binTop = (1 << GIF_HISTOGRAM_SHIFT) - 1;
 
-            // if it happens that we want the color from last frame, then just write out
-            // a transparent pixel
-            if( lastFrame &&
-               lastPix[0] == rr &&
-               lastPix[1] == gg &&
-               lastPix[2] == bb )
+    // base case, bottom of the tree
+    if(treeNode >= numEntries)
+    {
+        int entry = treeNode - numEntries;
+
+        if(buildForDither && (entry == 1 || entry == numEntries-1))
+        {
+            // Dithering needs a color as dark as anything in the image and a color as bright - take the corners of
+            // the bins, which are at least that dark (bright)
+            bool darkest = (entry == 1);
+            int r = darkest? 255 : 0, g = r, b = r;
+            for(int ii=0; ii<numColors; ++ii)
             {
-                nextPix[0] = rr;
-                nextPix[1] = gg;
-                nextPix[2] = bb;
-                nextPix[3] = kGifTransIndex;
-                continue;
+                int lowR = colors[ii].mean[0] & ~binTop, lowG = colors[ii].mean[1] & ~binTop, lowB = colors[ii].mean[2] & ~binTop;
+                r = darkest? GifIMin(r, lowR) : GifIMax(r, lowR + binTop);
+                g = darkest? GifIMin(g, lowG) : GifIMax(g, lowG + binTop);
+                b = darkest? GifIMin(b, lowB) : GifIMax(b, lowB + binTop);
             }
 
-            int32_t bestDiff = 1000000;
-            int32_t bestInd = kGifTransIndex;
+            pal->r[entry] = (uint8_t)r;
+            pal->g[entry] = (uint8_t)g;
+            pal->b[entry] = (uint8_t)b;
 
-            // Search the palete
-            GifGetClosestPaletteColor(pPal, rr, gg, bb, &bestInd, &bestDiff, 1);
+            return;
+        }
 
-            // Write the result to the temp buffer
-            int32_t r_err = nextPix[0] - (int32_t)(pPal->r[bestInd]) * 256;
-            int32_t g_err = nextPix[1] - (int32_t)(pPal->g[bestInd]) * 256;
-            int32_t b_err = nextPix[2] - (int32_t)(pPal->b[bestInd]) * 256;
+        // otherwise, take the average of all colors in this subcube
+        uint64_t r=0, g=0, b=0, weight=0;
+        for(int ii=0; ii<numColors; ++ii)
+        {
+            r += colors[ii].r;
+            g += colors[ii].g;
+            b += colors[ii].b;
+            weight += colors[ii].count;
+        }
 
-            nextPix[0] = pPal->r[bestInd];
-            nextPix[1] = pPal->g[bestInd];
-            nextPix[2] = pPal->b[bestInd];
-            nextPix[3] = bestInd;
+        pal->r[entry] = (uint8_t)((r + weight/2) / weight);
+        pal->g[entry] = (uint8_t)((g + weight/2) / weight);
+        pal->b[entry] = (uint8_t)((b + weight/2) / weight);
 
-            // Propagate the error to the four adjacent locations
-            // that we haven't touched yet
-            int quantloc_7 = (int)(yy * width + xx + 1);
-            int quantloc_3 = (int)(yy * width + width + xx - 1);
-            int quantloc_5 = (int)(yy * width + width + xx);
-            int quantloc_1 = (int)(yy * width + width + xx + 1);
+        return;
+    }
 
-            if(quantloc_7 < numPixels)
-            {
-                int32_t* pix7 = quantPixels+4*quantloc_7;
-                pix7[0] += GifIMax( -pix7[0], r_err * 7 / 16 );
-                pix7[1] += GifIMax( -pix7[1], g_err * 7 / 16 );
-                pix7[2] += GifIMax( -pix7[2], b_err * 7 / 16 );
-            }
+    // Find the axis with the largest range
+    int minC[3] = {255, 255, 255};
+    int maxC[3] = {0, 0, 0};
+    for(int ii=0; ii<numColors; ++ii)
+    {
+        for(int cc=0; cc<3; ++cc)
+        {
+            minC[cc] = GifIMin(minC[cc], colors[ii].mean[cc]);
+            maxC[cc] = GifIMax(maxC[cc], colors[ii].mean[cc]);
+        }
+    }
 
-            if(quantloc_3 < numPixels)
-            {
-                int32_t* pix3 = quantPixels+4*quantloc_3;
-                pix3[0] += GifIMax( -pix3[0], r_err * 3 / 16 );
-                pix3[1] += GifIMax( -pix3[1], g_err * 3 / 16 );
-                pix3[2] += GifIMax( -pix3[2], b_err * 3 / 16 );
-            }
+    int rRange = maxC[0] - minC[0];
+    int gRange = maxC[1] - minC[1];
+    int bRange = maxC[2] - minC[2];
 
-            if(quantloc_5 < numPixels)
-            {
-                int32_t* pix5 = quantPixels+4*quantloc_5;
-                pix5[0] += GifIMax( -pix5[0], r_err * 5 / 16 );
-                pix5[1] += GifIMax( -pix5[1], g_err * 5 / 16 );
-                pix5[2] += GifIMax( -pix5[2], b_err * 5 / 16 );
-            }
+    int splitCom = 1;
+    if(bRange > gRange) splitCom = 2;
+    if(rRange > bRange && rRange > gRange) splitCom = 0;
+    int rangeMin = minC[splitCom];
+    int rangeMax = maxC[splitCom];
 
-            if(quantloc_1 < numPixels)
-            {
-                int32_t* pix1 = quantPixels+4*quantloc_1;
-                pix1[0] += GifIMax( -pix1[0], r_err / 16 );
-                pix1[1] += GifIMax( -pix1[1], g_err / 16 );
-                pix1[2] += GifIMax( -pix1[2], b_err / 16 );
-            }
-        }
+    // the median pixel is the one half the pixels come before
+    uint32_t weight = GifHistogramWeight(colors, numColors);
+    uint32_t weightAt[256];
+    memset(weightAt, 0, sizeof(weightAt));
+    for(int ii=0; ii<numColors; ++ii)
+        weightAt[colors[ii].mean[splitCom]] += colors[ii].count;
+
+    uint32_t halfWeight = weight / 2;
+    uint32_t weightBelow = 0;
+    int splitValue = rangeMin;
+    while(weightBelow + weightAt[splitValue] <= halfWeight)
+        weightBelow += weightAt[splitValue++];
+
+    int subColorsA = GifPartitionHistogram(colors, numColors, splitCom, splitValue, halfWeight);
+
+    // if the split is very unbalanced, split at the mean instead of the median to preserve rare colors
+    int splitUnbalance = GifIAbs( (splitValue - rangeMin) - (rangeMax - splitValue) );
+    if( splitUnbalance > (1536 >> treeLevel) )
+    {
+        splitValue = rangeMin + (rangeMax-rangeMin) / 2;
+        weightBelow = 0;
+        for(int vv=rangeMin; vv<splitValue; ++vv)
+            weightBelow += weightAt[vv];
+        subColorsA = GifPartitionHistogram(colors, numColors, splitCom, splitValue, weightBelow + weightAt[splitValue]/2);
     }
 
-    // Copy the palettized result to the output buffer
-    for( int ii=0; ii<numPixels*4; ++ii )
+    // add the bottom node for the transparency index
+    if( treeNode == numEntries/2 )
     {
-        outFrame[ii] = (uint8_t)quantPixels[ii];
+        subColorsA = 0;
+        splitValue = 0;
     }
 
-    GIF_TEMP_FREE(quantPixels);
+    pal->treeSplitElt[treeNode] = (uint8_t)splitCom;
+    pal->treeSplit[treeNode] = (uint8_t)splitValue;
+
+    GifSplitHistogram(colors,            subColorsA,           treeNode*2,   treeLevel+1, buildForDither, pal, taskLevel, tasks, numTasks);
+    GifSplitHistogram(colors+subColorsA, numColors-subColorsA, treeNode*2+1, treeLevel+1, buildForDither, pal, taskLevel, tasks, numTasks);
 }
 
-// Picks palette colors for the image using simple thresholding, no dithering
-void GifThresholdImage( const uint8_t* lastFrame, const uint8_t* nextFrame, uint8_t* outFrame, uint32_t width, uint32_t height, GifPalette* pPal )
+// Same as GifMakePalette, built from a histogram of the frame: the pixels are counted into per-thread histograms straight
+// from the source (no copy of the frame, no sorting of pixels), then the median split runs on the few thousand distinct
+// colors, with the subtrees below the top levels split in parallel. The palette differs from GifMakePalette's only by
+// where exactly the splits fall, since colors within a bin (4 levels per channel) always end up in the same subtree.
+// Counts the pixels of rows firstRow, firstRow+rowStep, ... below lastRow into 'bins'. If lastFrame is given (with
+// 'stride' pixels per row), only the pixels that changed from it are counted.
+void GifCountHistogramRows( const uint8_t* lastFrame, const GifFrameSource* nextFrame, uint32_t width, uint32_t stride,
+                            uint32_t firstRow, uint32_t lastRow, uint32_t rowStep, GifHistogramBin* bins )
 {
-    uint32_t numPixels = width*height;
-    for( uint32_t ii=0; ii<numPixels; ++ii )
+    for( uint32_t yy=firstRow; yy<lastRow; yy += rowStep )
     {
-        // if a previous color is available, and it matches the current color,
-        // set the pixel to transparent
-        if(lastFrame &&
-           lastFrame[0] == nextFrame[0] &&
-           lastFrame[1] == nextFrame[1] &&
-           lastFrame[2] == nextFrame[2])
+        const uint8_t* pix = nextFrame->data + yy*nextFrame->rowStride;
+        const uint8_t* last = lastFrame? lastFrame + 4*(size_t)yy*stride : NULL;
+        for( uint32_t xx=0; xx<width; ++xx, pix += nextFrame->pixelStride )
         {
-            outFrame[0] = lastFrame[0];
-            outFrame[1] = lastFrame[1];
-            outFrame[2] = lastFrame[2];
-            outFrame[3] = kGifTransIndex;
-        }
-        else
-        {
-            // palettize the pixel
-            int32_t bestDiff = 1000000;
-            int32_t bestInd = 1;
-            GifGetClosestPaletteColor(pPal, nextFrame[0], nextFrame[1], nextFrame[2], &bestInd, &bestDiff, 1);
+            uint32_t r = pix[nextFrame->rOffset], g = pix[nextFrame->gOffset], b = pix[nextFrame->bOffset];
 
-            // Write the resulting color to the output buffer
-            outFrame[0] = pPal->r[bestInd];
-            outFrame[1] = pPal->g[bestInd];
-            outFrame[2] = pPal->b[bestInd];
-            outFrame[3] = (uint8_t)bestInd;
-        }
+            // only the pixels that changed from the previous image go in the palette
+            if(last)
+            {
+                bool same = (last[0] == r && last[1] == g && last[2] == b);
+                last += 4;
+                if(same) continue;
+            }
 
-        if(lastFrame) lastFrame += 4;
-        outFrame += 4;
-        nextFrame += 4;
+            const uint32_t mask = (1 << GIF_HISTOGRAM_SHIFT) - 1;
+            GifHistogramBin* bin = bins + (((r >> GIF_HISTOGRAM_SHIFT) << (2*GIF_HISTOGRAM_BITS)) |
+                                           ((g >> GIF_HISTOGRAM_SHIFT) << GIF_HISTOGRAM_BITS) | (b >> GIF_HISTOGRAM_SHIFT));
+            bin->count++;
+            bin->rOffsets += r & mask;
+            bin->gOffsets += g & mask;
+            bin->bOffsets += b & mask;
+        }
     }
 }
 
-// Simple structure to write out the LZW-compressed portion of the image
-// one bit at a time
-typedef struct
+// Builds the palette from numBands separately counted histograms, laid out one after another. The bins are left zeroed,
+// ready for the next frame's counts.
+void GifPaletteFromHistogram( GifHistogramBin* bins, int numBands, int bitDepth, bool buildForDither, GifPalette* pPal, GifArena* arena )
 {
-    uint32_t chunkIndex;
-    uint8_t chunk[256];   // bytes are written in here until we have 256 of them, then written to the file
-
-    uint8_t bitIndex;  // how many bits in the partial byte written so far
-    uint8_t byte;      // current partial byte
+    pPal->bitDepth = bitDepth;
 
-    uint8_t padding[2];    // make padding explicit
-} GifBitStatus;
+    // Merge the bands, a range of bins per task. Each range's colors are written at the start of the range, then moved
+    // down next to the previous range's.
+    GifHistogramColor* colors = (GifHistogramColor*)GifArenaAlloc(arena, sizeof(GifHistogramColor) * GIF_HISTOGRAM_BINS);
+    int rangeColors[GIF_MAX_TASKS];
+    const int binsPerRange = GIF_HISTOGRAM_BINS / GIF_MAX_TASKS;
 
-// insert a single bit
-void GifWriteBit( GifBitStatus* stat, uint32_t bit )
-{
-    bit = bit & 1;
-    bit = bit << stat->bitIndex;
-    stat->byte |= bit;
+    auto mergeRange = [&](int range)
+    {
+        int numColors = 0;
+        for(int bb=range*binsPerRange; bb<(range+1)*binsPerRange; ++bb)
+        {
+            uint64_t count = 0, rOffsets = 0, gOffsets = 0, bOffsets = 0;
+            for(int band=0; band<numBands; ++band)
+            {
+                GifHistogramBin* bin = bins + (size_t)band * GIF_HISTOGRAM_BINS + bb;
+                if(bin->count == 0) continue;
+                count += bin->count;
+                rOffsets += bin->rOffsets;
+                gOffsets += bin->gOffsets;
+                bOffsets += bin->bOffsets;
+                memset(bin, 0, sizeof(GifHistogramBin));
+            }
+            if(count == 0) continue;
+
+            GifHistogramColor* color = colors + range*binsPerRange + numColors++;
+            color->r = (uint64_t)((bb >> (2*GIF_HISTOGRAM_BITS)) << GIF_HISTOGRAM_SHIFT) * count + rOffsets;
+            color->g = (uint64_t)(((bb >> GIF_HISTOGRAM_BITS) & ((1 << GIF_HISTOGRAM_BITS) - 1)) << GIF_HISTOGRAM_SHIFT) * count + gOffsets;
+            color->b = (uint64_t)((bb & ((1 << GIF_HISTOGRAM_BITS) - 1)) << GIF_HISTOGRAM_SHIFT) * count + bOffsets;
+            color->count = (uint32_t)count;
+            color->mean[0] = (uint8_t)((color->r + count/2) / count);
+            color->mean[1] = (uint8_t)((color->g + count/2) / count);
+            color->mean[2] = (uint8_t)((color->b + count/2) / count);
+            color->padding[0] = 0;
+        }
+        rangeColors[range] = numColors;
+    };
+    GIF_PARALLEL_FOR(GIF_MAX_TASKS, mergeRange);
 
-    ++stat->bitIndex;
-    if( stat->bitIndex > 7 )
+    int numColors = 0;
+    for(int range=0; range<GIF_MAX_TASKS; ++range)
     {
-        // move the newly-finished byte to the chunk buffer
-        stat->chunk[stat->chunkIndex++] = stat->byte;
-        // and start a new byte
-        stat->bitIndex = 0;
-        stat->byte = 0;
+        memmove(colors + numColors, colors + range*binsPerRange, sizeof(GifHistogramColor) * (size_t)rangeColors[range]);
+        numColors += rangeColors[range];
     }
-}
-
-// write all bytes so far to the file
-void GifWriteChunk( FILE* f, GifBitStatus* stat )
-{
-    fputc((int)stat->chunkIndex, f);
-    fwrite(stat->chunk, 1, stat->chunkIndex, f);
 
-    stat->bitIndex = 0;
-    stat->byte = 0;
-    stat->chunkIndex = 0;
-}
+    // split the top of the tree here, and the subtrees below it in parallel
+    GifHistogramTask tasks[GIF_MAX_TASKS];
+    int numTasks = 0;
+    int taskLevel = 0;
+    while((2 << taskLevel) <= GIF_MAX_TASKS && taskLevel < bitDepth)
+        ++taskLevel;
+    GifSplitHistogram(colors, numColors, 1, 0, buildForDither, pPal, taskLevel, tasks, &numTasks);
 
-void GifWriteCode( FILE* f, GifBitStatus* stat, uint32_t code, uint32_t length )
-{
-    for( uint32_t ii=0; ii<length; ++ii )
+    auto splitTask = [&](int task)
     {
-        GifWriteBit(stat, code);
-        code = code >> 1;
+        GifSplitHistogram(tasks[task].colors, tasks[task].numColors, tasks[task].treeNode, taskLevel, buildForDither, pPal, taskLevel, NULL, NULL);
+    };
+    GIF_PARALLEL_FOR(numTasks, splitTask);
 
-        if( stat->chunkIndex == 255 )
-        {
-            GifWriteChunk(f, stat);
-        }
-    }
+    GifArenaFree(arena, colors);
+
+    // add the bottom node for the transparency index
+    pPal->treeSplit[1 << (bitDepth-1)] = 0;
+    pPal->treeSplitElt[1 << (bitDepth-1)] = 0;
+
+    pPal->r[0] = pPal->g[0] = pPal->b[0] = 0;
 }
 
-// The LZW dictionary is a 256-ary tree constructed as the file is encoded,
-// this is one node
-typedef struct
+// how many histograms GifMakePaletteHistogram counts a width x height frame into: one per million pixels or so
+int GifHistogramBands( uint32_t width, uint32_t height )
 {
-    uint16_t m_next[256];
-} GifLzwNode;
+    return GifIMax(1, GifIMin(GIF_MAX_TASKS, (int)(((uint64_t)width * height) >> 20)));
+}
 
-// write a 256-color (8-bit) image palette to the file
-void GifWritePalette( const GifPalette* pPal, FILE* f )
+// 'bins' holds GifHistogramBands(width, height) histograms, all zero (as GifPaletteFromHistogram leaves them), so that
+// a writer keeps one set for all its frames instead of clearing megabytes of bins for each.
+void GifMakePaletteHistogram( const uint8_t* lastFrame, const GifFrameSource* nextFrame, uint32_t width, uint32_t height, uint32_t stride, int bitDepth, bool buildForDither, GifPalette* pPal,
+                              GifHistogramBin* bins, GifArena* arena )
 {
-    fputc(0, f);  // first color: transparency
-    fputc(0, f);
-    fputc(0, f);
+    // a thread per band of rows
+    int numBands = GifHistogramBands(width, height);
+    uint32_t rowsPerBand = (height + (uint32_t)numBands - 1) / (uint32_t)numBands;
 
-    for(int ii=1; ii<(1 << pPal->bitDepth); ++ii)
+    auto countBand = [&](int band)
     {
-        uint32_t r = pPal->r[ii];
-        uint32_t g = pPal->g[ii];
-        uint32_t b = pPal->b[ii];
+        GifHistogramBin* bandBins = bins + (size_t)band * GIF_HISTOGRAM_BINS;
+        uint32_t lastRow = GifIMin((int)height, (int)(rowsPerBand * (uint32_t)(band+1)));
+        GifCountHistogramRows(lastFrame, nextFrame, width, stride, rowsPerBand * (uint32_t)band, lastRow, 1, bandBins);
+    };
+    GIF_PARALLEL_FOR(numBands, countBand);
 
-        fputc((int)r, f);
-        fputc((int)g, f);
-        fputc((int)b, f);
-    }
+    GifPaletteFromHistogram(bins, numBands, bitDepth, buildForDither, pPal, arena);
 }
 
-// write the image header, LZW-compress and write out the image
-void GifWriteLzwImage(FILE* f, uint8_t* image, uint32_t left, uint32_t top,  uint32_t width, uint32_t height, uint32_t delay, GifPalette* pPal)
-{
-    // graphics control extension
-    fputc(0x21, f);
-    fputc(0xf9, f);
-    fputc(0x04, f);
-    fputc(0x05, f); // leave prev frame in place, this frame has transparency
-    fputc(delay & 0xff, f);
-    fputc((delay >> 8) & 0xff, f);
-    fputc(kGifTransIndex, f); // transparent color index
-    fputc(0, f);
+// about how many pixels GifMakeGlobalPalette looks at, however many frames it's given
+#ifndef GIF_GLOBAL_PALETTE_SAMPLES
+#define GIF_GLOBAL_PALETTE_SAMPLES (1 << 22)
+#endif
 
-    fputc(0x2c, f); // image descriptor block
+// Builds one palette for a whole animation, from the union of its frames (all width x height). Large animations are
+// sampled: every frame contributes every n-th row, starting at a different row in each frame, so that about
+// GIF_GLOBAL_PALETTE_SAMPLES pixels are counted in all.
+void GifMakeGlobalPalette( const GifFrameSource* frames, int numFrames, uint32_t width, uint32_t height, int bitDepth, bool buildForDither, GifPalette* pPal )
+{
+    memset(pPal, 0, sizeof(GifPalette));
+    uint64_t numPixels = (uint64_t)numFrames * width * height;
+    uint32_t rowStep = (uint32_t)GifIMax(1, (int)((numPixels + GIF_GLOBAL_PALETTE_SAMPLES - 1) / GIF_GLOBAL_PALETTE_SAMPLES));
 
-    fputc(left & 0xff, f);           // corner of image in canvas space
-    fputc((left >> 8) & 0xff, f);
-    fputc(top & 0xff, f);
-    fputc((top >> 8) & 0xff, f);
+    // a band of frames per task
+    int numBands = GifIMax(1, GifIMin(GIF_MAX_TASKS, numFrames));
+    GifHistogramBin* bins = (GifHistogramBin*)GIF_TEMP_MALLOC(sizeof(GifHistogramBin) * GIF_HISTOGRAM_BINS * (size_t)numBands);
 
-    fputc(width & 0xff, f);          // width and height of image
-    fputc((width >> 8) & 0xff, f);
-    fputc(height & 0xff, f);
-    fputc((height >> 8) & 0xff, f);
+    auto countBand = [&](int band)
+    {
+        GifHistogramBin* bandBins = bins + (size_t)band * GIF_HISTOGRAM_BINS;
+        memset(bandBins, 0, sizeof(GifHistogramBin) * GIF_HISTOGRAM_BINS);
 
-    //fputc(0, f); // no local color table, no transparency
-    //fputc(0x80, f); // no local color table, but transparency
+        for( int frame=band; frame<numFrames; frame += numBands )
+            GifCountHistogramRows(NULL, frames + frame, width, width, (uint32_t)frame % rowStep, height, rowStep, bandBins);
+    };
+    GIF_PARALLEL_FOR(numBands, countBand);
 
-    fputc(0x80 + pPal->bitDepth-1, f); // local color table present, 2 ^ bitDepth entries
-    GifWritePalette(pPal, f);
+    GifPaletteFromHistogram(bins, numBands, bitDepth, buildForDither, pPal, NULL);
+    GIF_TEMP_FREE(bins);
+}
 
-    const int minCodeSize = pPal->bitDepth;
-    const uint32_t clearCode = 1 << pPal->bitDepth;
+// A GifColorCache can't be shared between threads, so work split into tasks gives each task its own: the palette's
+// (a writer keeps one per task, see GifBeginSink), then new ones for any tasks beyond those. Returns the memory of the
+// new ones to GifArenaFree (NULL if there are none; if the palette has no cache, neither do the tasks).
+GifColorCache* GifTaskColorCaches( const GifPalette* pPal, int numTasks, GifColorCache** caches, GifArena* arena )
+{
+    GifColorCache* extra = NULL;
+    int numOwn = pPal->cache? GifIMin(numTasks, GifIMax(1, pPal->numCaches)) : numTasks;
+    if(numTasks > numOwn)
+        extra = (GifColorCache*)GifArenaAlloc(arena, sizeof(GifColorCache) * (size_t)(numTasks-numOwn));
 
-    fputc(minCodeSize, f); // min code size 8 bits
+    for(int task=0; task<numTasks; ++task)
+    {
+        if(task < numOwn)
+        {
+            caches[task] = pPal->cache? pPal->cache + task : NULL;
+            continue;
+        }
 
-    GifLzwNode* codetree = (GifLzwNode*)GIF_TEMP_MALLOC(sizeof(GifLzwNode)*4096);
+        caches[task] = extra + (task-numOwn);
+        memset(caches[task]->tags, 0, sizeof(caches[task]->tags));
+        memset(caches[task]->cellGeneration, 0, sizeof(caches[task]->cellGeneration));
+        caches[task]->generation = 0;
+        GifColorCacheReset(caches[task]);
+    }
+    return extra;
+}
 
-    memset(codetree, 0, sizeof(GifLzwNode)*4096);
-    int32_t curCode = -1;
-    uint32_t codeSize = (uint32_t)minCodeSize + 1;
-    uint32_t maxCode = clearCode+1;
+// how many tasks to split a frame into when palettizing it
+int GifPaletteTasks( uint32_t width, uint32_t height )
+{
+    if((uint64_t)width * height < GIF_PARALLEL_MIN_PIXELS) return 1;
+    return GifIMin(GIF_MAX_TASKS, (int)height);
+}
 
-    GifBitStatus stat;
-    stat.byte = 0;
-    stat.bitIndex = 0;
-    stat.chunkIndex = 0;
+// The distinct colors of part of a frame, up to the 255 a palette holds besides the transparent index, in an open
+// addressing hash table small enough to stay in the L1 cache. A slot holds 0x1000000 | 0xRRGGBB, or 0 if it's empty.
+#define GIF_COLOR_SET_BITS 9
 
-    GifWriteCode(f, &stat, clearCode, codeSize);  // start with a fresh LZW dictionary
+typedef struct
+{
+    uint32_t slots[1 << GIF_COLOR_SET_BITS];
+    int count;
+} GifColorSet;
 
-    for(uint32_t yy=0; yy<height; ++yy)
+// Adds a color (0xRRGGBB) to a set. Returns false, leaving the set as it was, if the color is new and the set is full.
+bool GifColorSetAdd( GifColorSet* set, uint32_t color )
+{
+    const uint32_t key = color | 0x1000000;
+    uint32_t slot = (key * 2654435761u) >> (32 - GIF_COLOR_SET_BITS);
+    while(set->slots[slot] != key)
     {
-        for(uint32_t xx=0; xx<width; ++xx)
+        if(set->slots[slot] == 0)
         {
-    #ifdef GIF_FLIP_VERT
-            // bottom-left origin image (such as an OpenGL capture)
-            uint8_t nextValue = image[((height-1-yy)*width+xx)*4+3];
-    #else
-            // top-left origin
-            uint8_t nextValue = image[(yy*width+xx)*4+3];
-    #endif
+            if(set->count == 255) return false;
+            set->slots[slot] = key;
+            ++set->count;
+            return true;
+        }
+        slot = (slot + 1) & ((1 << GIF_COLOR_SET_BITS) - 1);
+    }
+    return true;
+}
 
-            // "worst possible mode" - no compression, every single code is followed immediately by a clear
-            //WriteCode( f, stat, nextValue, codeSize );
-            //WriteCode( f, stat, 256, codeSize );
+// Builds an exact palette for the pixels of a frame (only those that changed from lastFrame, if given) if they have at
+// most 255 colors between them: each color gets an entry of its own after the transparent index, and bitDepth is the
+// fewest bits that hold them all. Returns false, as soon as a 256th color turns up, if they don't fit.
+// Such a frame needs no median split and no dithering, and a smaller palette starts its LZW codes shorter. A frame
+// with many colors is given up on after a few hundred pixels, so trying costs little.
+bool GifMakeExactPalette( const uint8_t* lastFrame, const GifFrameSource* nextFrame, uint32_t width, uint32_t height, uint32_t stride, GifPalette* pPal,
+                          GifArena* arena )
+{
+    // each task collects the colors of a band of rows, then the sets are merged
+    int numTasks = GifPaletteTasks(width, height);
+    uint32_t rowsPerTask = (height + (uint32_t)numTasks - 1) / (uint32_t)numTasks;
+    GifColorSet* sets = (GifColorSet*)GifArenaAlloc(arena, sizeof(GifColorSet) * (size_t)numTasks);
+    std::atomic<bool> tooMany(false);
 
-            if( curCode < 0 )
-            {
-                // first value in a new run
-                curCode = nextValue;
-            }
-            else if( codetree[curCode].m_next[nextValue] )
-            {
-                // current run already in the dictionary
-                curCode = codetree[curCode].m_next[nextValue];
-            }
-            else
-            {
-                // finish the current run, write a code
-                GifWriteCode(f, &stat, (uint32_t)curCode, codeSize);
+    auto collectRows = [&](int task)
+    {
+        GifColorSet* set = sets + task;
+        memset(set, 0, sizeof(GifColorSet));
 
-                // insert the new run into the dictionary
-                codetree[curCode].m_next[nextValue] = (uint16_t)++maxCode;
+        // frames with few colors are mostly runs of one color, which only need looking up once
+        uint32_t runColor = 0xffffffff;
+        uint32_t lastRow = (uint32_t)GifIMin((int)height, (int)(rowsPerTask * (uint32_t)(task+1)));
+        for( uint32_t yy=rowsPerTask * (uint32_t)task; yy<lastRow && !tooMany.load(std::memory_order_relaxed); ++yy )
+        {
+            const uint8_t* pix = nextFrame->data + yy*nextFrame->rowStride;
+            const uint8_t* last = lastFrame? lastFrame + 4*(size_t)yy*stride : NULL;
+            for( uint32_t xx=0; xx<width; ++xx, pix += nextFrame->pixelStride )
+            {
+                uint32_t r = pix[nextFrame->rOffset], g = pix[nextFrame->gOffset], b = pix[nextFrame->bOffset];
 
-                if( maxCode >= (1ul << codeSize) )
+                // unchanged pixels are written transparent, they need no color
+                if(last)
                 {
-                    // dictionary entry count has broken a size barrier,
-                    // we need more bits for codes
-                    codeSize++;
+                    bool same = (last[0] == r && last[1] == g && last[2] == b);
+                    last += 4;
+                    if(same) continue;
                 }
-                if( maxCode == 4095 )
-                {
-                    // the dictionary is full, clear it out and begin anew
-                    GifWriteCode(f, &stat, clearCode, codeSize); // clear tree
 
-                    memset(codetree, 0, sizeof(GifLzwNode)*4096);
-                    codeSize = (uint32_t)(minCodeSize + 1);
-                    maxCode = clearCode+1;
+                uint32_t color = (r << 16) | (g << 8) | b;
+                if(color == runColor) continue;
+                runColor = color;
+                if(!GifColorSetAdd(set, color))
+                {
+                    tooMany = true;
+                    return;
                 }
-
-                curCode = nextValue;
             }
         }
-    }
-
-    // compression footer
-    GifWriteCode(f, &stat, (uint32_t)curCode, codeSize);
-    GifWriteCode(f, &stat, clearCode, codeSize);
-    GifWriteCode(f, &stat, clearCode + 1, (uint32_t)minCodeSize + 1);
+    };
+    GIF_PARALLEL_FOR(numTasks, collectRows);
 
-    // write out the last partial chunk
-    while( stat.bitIndex ) GifWriteBit(&stat, 0);
-    if( stat.chunkIndex ) GifWriteChunk(f, &stat);
+    bool fits = !tooMany;
+    for( int task=1; task<numTasks && fits; ++task )
+    {
+        for( int slot=0; slot<(1 << GIF_COLOR_SET_BITS) && fits; ++slot )
+        {
+            if(sets[task].slots[slot]) fits = GifColorSetAdd(sets, sets[task].slots[slot] & 0xffffff);
+        }
+    }
+
+    if(fits)
+    {
+        memset(pPal, 0, sizeof(GifPalette));
+        pPal->bitDepth = 1;
+        while((1 << pPal->bitDepth) < sets[0].count + 1)
+            ++pPal->bitDepth;
+
+        // entry 0 (kGifTransIndex) stays black
+        int ind = 1;
+        for( int slot=0; slot<(1 << GIF_COLOR_SET_BITS); ++slot )
+        {
+            uint32_t key = sets[0].slots[slot];
+            if(!key) continue;
+            pPal->r[ind] = (uint8_t)(key >> 16);
+            pPal->g[ind] = (uint8_t)(key >> 8);
+            pPal->b[ind] = (uint8_t)key;
+            ++ind;
+        }
+    }
+
+    GifArenaFree(arena, sets);
+    return fits;
+}
+
+// Adds a share of a pixel's quantization error to a neighbor, without letting it go negative.
+void GifDiffuseError( int32_t* pix, int32_t r_err, int32_t g_err, int32_t b_err, int share )
+{
+    pix[0] += GifIMax( -pix[0], r_err * share / 16 );
+    pix[1] += GifIMax( -pix[1], g_err * share / 16 );
+    pix[2] += GifIMax( -pix[2], b_err * share / 16 );
+}
+
+// Loads a row of the source into a dithering buffer, as color*256.
+// The extra 8 bits of precision allow for sub-single-color error values to be propagated.
+void GifLoadDitherRow( const GifFrameSource* nextFrame, uint32_t width, uint32_t yy, int32_t* row )
+{
+    const uint8_t* pix = nextFrame->data + yy*nextFrame->rowStride;
+    for( uint32_t xx=0; xx<width; ++xx )
+    {
+        row[0] = (int32_t)pix[nextFrame->rOffset] * 256;
+        row[1] = (int32_t)pix[nextFrame->gOffset] * 256;
+        row[2] = (int32_t)pix[nextFrame->bOffset] * 256;
+        row += 3;
+        pix += nextFrame->pixelStride;
+    }
+}
+
+// One row of Floyd-Steinberg dithering.
+// 'row' holds this row's colors with the error diffused into them so far, 'below' the next row's (the caller has
+// already loaded it from the source).
+// A pixel's error goes to its right neighbor and to three pixels in the row below, so pixel xx of this row is final
+// once the row above has finished pixel xx+1. The row above must also be done with pixel xx+2, which adds to the same
+// neighbor (xx+1) as this pixel does: the clamp in GifDiffuseError makes the order of additions matter. 'above' counts
+// the pixels the row above has finished (NULL for the first row), 'done' is where this row publishes its own count.
+void GifDitherRow( const uint8_t* lastFrame, int32_t* row, int32_t* below, uint8_t* outFrame, uint32_t width, uint32_t stride, uint32_t yy, GifPalette* pPal,
+                   const std::atomic<uint32_t>* above, std::atomic<uint32_t>* done )
+{
+    uint32_t aboveDone = above? above->load(std::memory_order_acquire) : width;
+    const uint8_t* lastPix = lastFrame? lastFrame + 4*(size_t)yy*stride : NULL;
+    uint8_t* outPix = outFrame + 4*(size_t)yy*stride;
+
+    for( uint32_t xx=0; xx<width; ++xx, outPix += 4 )
+    {
+        uint32_t needed = GifIMin((int)width, (int)xx+3);
+        while(aboveDone < needed)
+        {
+            std::this_thread::yield();
+            aboveDone = above->load(std::memory_order_acquire);
+        }
+
+        int32_t* nextPix = row + 3*xx;
+
+        // Compute the colors we want (rounding to nearest)
+        int32_t rr = (nextPix[0] + 127) / 256;
+        int32_t gg = (nextPix[1] + 127) / 256;
+        int32_t bb = (nextPix[2] + 127) / 256;
+
+        // if it happens that we want the color from last frame, then just write out
+        // a transparent pixel
+        if( lastFrame &&
+           lastPix[4*xx] == rr &&
+           lastPix[4*xx+1] == gg &&
+           lastPix[4*xx+2] == bb )
+        {
+            outPix[0] = (uint8_t)rr;
+            outPix[1] = (uint8_t)gg;
+            outPix[2] = (uint8_t)bb;
+            outPix[3] = kGifTransIndex;
+        }
+        else
+        {
+            // Search the palete
+            int32_t bestInd = GifClosestPaletteIndex(pPal, rr, gg, bb);
+
+            int32_t r_err = nextPix[0] - (int32_t)(pPal->r[bestInd]) * 256;
+            int32_t g_err = nextPix[1] - (int32_t)(pPal->g[bestInd]) * 256;
+            int32_t b_err = nextPix[2] - (int32_t)(pPal->b[bestInd]) * 256;
+
+            // Write the result to the output buffer
+            outPix[0] = pPal->r[bestInd];
+            outPix[1] = pPal->g[bestInd];
+            outPix[2] = pPal->b[bestInd];
+            outPix[3] = (uint8_t)bestInd;
+
+            // Propagate the error to the four adjacent locations
+            // that we haven't touched yet (and that are inside the image)
+            if(xx+1 < width)
+                GifDiffuseError(nextPix + 3, r_err, g_err, b_err, 7);
+            if(below)
+            {
+                int32_t* belowPix = below + 3*xx;
+                if(xx > 0)
+                    GifDiffuseError(belowPix - 3, r_err, g_err, b_err, 3);
+                GifDiffuseError(belowPix, r_err, g_err, b_err, 5);
+                if(xx+1 < width)
+                    GifDiffuseError(belowPix + 3, r_err, g_err, b_err, 1);
+            }
+        }
+
+        // publish progress in batches, the rows below only need to trail by a few pixels
+        if(((xx+1) & 63) == 0)
+            done->store(xx+1, std::memory_order_release);
+    }
+    done->store(width, std::memory_order_release);
+}
+
+// Implements Floyd-Steinberg dithering, writes palette value to alpha.
+// Error only ever moves one row down, so rather than a copy of the whole frame, the colors being dithered live in a
+// ring of row buffers, one per row that can be in progress at once plus the row below the last of them.
+// Large frames are dithered as a wavefront: tasks take rows in order, each trailing the row above by a few pixels
+// (see GifDitherRow). The result is the same however many tasks run, or whether they run at the same time at all.
+// lastFrame and outFrame have 'stride' pixels per row, so they can be a rectangle of a larger frame.
+void GifDitherImage( const uint8_t* lastFrame, const GifFrameSource* nextFrame, uint8_t* outFrame, uint32_t width, uint32_t height, uint32_t stride, GifPalette* pPal,
+                     GifArena* arena )
+{
+    int numTasks = GifPaletteTasks(width, height);
+    uint32_t numRows = (uint32_t)numTasks + 1;
+    int32_t* rows = (int32_t*)GifArenaAlloc(arena, sizeof(int32_t) * 3 * (size_t)width * numRows);
+    GifLoadDitherRow(nextFrame, width, 0, rows);
+
+    GifColorCache* caches[GIF_MAX_TASKS];
+    GifColorCache* extraCaches = GifTaskColorCaches(pPal, numTasks, caches, arena);
+    std::atomic<uint32_t>* rowsDone = (std::atomic<uint32_t>*)GifArenaAlloc(arena, sizeof(std::atomic<uint32_t>) * height);
+    for( uint32_t yy=0; yy<height; ++yy )
+        new (rowsDone + yy) std::atomic<uint32_t>(0);
+    std::atomic<uint32_t> nextRow(0);
+
+    // A task only takes a row after finishing its last one, so the rows being worked on are consecutive, there are
+    // at most numTasks of them, and rows finish in order - the tasks never wait on a row that hasn't started.
+    // So when row yy starts, row yy+1-numRows is finished, and its buffer can be reloaded with row yy+1.
+    auto ditherRows = [&](int task)
+    {
+        GifPalette taskPal = *pPal;
+        taskPal.cache = caches[task];
+        for(;;)
+        {
+            uint32_t yy = nextRow.fetch_add(1);
+            if(yy >= height) break;
+
+            int32_t* row = rows + 3*(size_t)width*(yy % numRows);
+            int32_t* below = NULL;
+            if(yy+1 < height)
+            {
+                // (finished, but the acquire makes its last reads of the buffer happen before the reload)
+                if(yy+1 >= numRows)
+                    while(rowsDone[yy+1-numRows].load(std::memory_order_acquire) < width)
+                        std::this_thread::yield();
+
+                below = rows + 3*(size_t)width*((yy+1) % numRows);
+                GifLoadDitherRow(nextFrame, width, yy+1, below);
+            }
+            GifDitherRow(lastFrame, row, below, outFrame, width, stride, yy, &taskPal, yy? rowsDone + yy-1 : NULL, rowsDone + yy);
+        }
+    };
+    GIF_PARALLEL_FOR(numTasks, ditherRows);
+
+    GifArenaFree(arena, rowsDone);
+    if(extraCaches) GifArenaFree(arena, extraCaches);
+    GifArenaFree(arena, rows);
+}
+
+// 8x8 Bayer matrix, the thresholds for ordered dithering
+const uint8_t kGifBayer8[8][8] =
+{
+    {  0, 32,  8, 40,  2, 34, 10, 42 },
+    { 48, 16, 56, 24, 50, 18, 58, 26 },
+    { 12, 44,  4, 36, 14, 46,  6, 38 },
+    { 60, 28, 52, 20, 62, 30, 54, 22 },
+    {  3, 35, 11, 43,  1, 33,  9, 41 },
+    { 51, 19, 59, 27, 49, 17, 57, 25 },
+    { 15, 47,  7, 39, 13, 45,  5, 37 },
+    { 63, 31, 55, 23, 61, 29, 53, 21 },
+};
+
+// Implements ordered dithering, writes palette value to alpha.
+// Each pixel is nudged by its entry in the Bayer matrix before picking the closest palette color, so neighboring
+// pixels of a flat area land on different colors. Nothing carries over from pixel to pixel, so rows are split
+// between tasks freely, and (like thresholding) a pixel that didn't change from the last frame stays transparent.
+// lastFrame and outFrame have 'stride' pixels per row; when the image is a rectangle of a larger frame, 'left' and 'top'
+// are its corner, so the pattern lines up with the rest of the frame.
+void GifOrderedDitherImage( const uint8_t* lastFrame, const GifFrameSource* nextFrame, uint8_t* outFrame, uint32_t width, uint32_t height, uint32_t stride,
+                            uint32_t left, uint32_t top, GifPalette* pPal, GifArena* arena )
+{
+    int numTasks = GifPaletteTasks(width, height);
+    uint32_t rowsPerTask = (height + (uint32_t)numTasks - 1) / (uint32_t)numTasks;
+
+    // about the spacing of the palette colors along each axis: 256 / cube root of the palette size
+    int spread = 256 >> ((pPal->bitDepth + 2) / 3);
+
+    GifColorCache* caches[GIF_MAX_TASKS];
+    GifColorCache* extraCaches = GifTaskColorCaches(pPal, numTasks, caches, arena);
+
+    auto ditherRows = [&](int task)
+    {
+        GifPalette taskPal = *pPal;
+        taskPal.cache = caches[task];
+
+        uint32_t lastRow = GifIMin((int)height, (int)(rowsPerTask * (uint32_t)(task+1)));
+        for( uint32_t yy=rowsPerTask * (uint32_t)task; yy<lastRow; ++yy )
+        {
+            // the row's thresholds, centered on 0 and scaled to the spread
+            int bias[8];
+            for( int ii=0; ii<8; ++ii )
+                bias[ii] = ((2 * kGifBayer8[(top + yy) & 7][(left + ii) & 7] - 63) * spread) / 128;
+
+            const uint8_t* pix = nextFrame->data + yy*nextFrame->rowStride;
+            const uint8_t* last = lastFrame? lastFrame + 4*(size_t)yy*stride : NULL;
+            uint8_t* out = outFrame + 4*(size_t)yy*stride;
+            for( uint32_t xx=0; xx<width; ++xx, pix += nextFrame->pixelStride, out += 4 )
+            {
+                int r = pix[nextFrame->rOffset];
+                int g = pix[nextFrame->gOffset];
+                int b = pix[nextFrame->bOffset];
+
+                if(last)
+                {
+                    const uint8_t* lastPix = last + 4*xx;
+                    if(lastPix[0] == r && lastPix[1] == g && lastPix[2] == b)
+                    {
+                        out[0] = lastPix[0];
+                        out[1] = lastPix[1];
+                        out[2] = lastPix[2];
+                        out[3] = kGifTransIndex;
+                        continue;
+                    }
+                }
+
+                int nudge = bias[xx & 7];
+                int32_t bestInd = GifClosestPaletteIndex(&taskPal, r + nudge, g + nudge, b + nudge);
+
+                out[0] = pPal->r[bestInd];
+                out[1] = pPal->g[bestInd];
+                out[2] = pPal->b[bestInd];
+                out[3] = (uint8_t)bestInd;
+            }
+        }
+    };
+    GIF_PARALLEL_FOR(numTasks, ditherRows);
+
+    if(extraCaches) GifArenaFree(arena, extraCaches);
+}
+
+// Picks palette colors for the image using simple thresholding, no dithering
+// lastFrame and outFrame have 'stride' pixels per row, so they can be a rectangle of a larger frame.
+// Like ordered dithering, every pixel stands on its own, so the rows are split between tasks.
+void GifThresholdImage( const uint8_t* lastFrame, const GifFrameSource* nextFrame, uint8_t* outFrame, uint32_t width, uint32_t height, uint32_t stride, GifPalette* pPal,
+                        GifArena* arena )
+{
+    int numTasks = GifPaletteTasks(width, height);
+    uint32_t rowsPerTask = (height + (uint32_t)numTasks - 1) / (uint32_t)numTasks;
+
+    GifColorCache* caches[GIF_MAX_TASKS];
+    GifColorCache* extraCaches = GifTaskColorCaches(pPal, numTasks, caches, arena);
+
+    auto thresholdRows = [&](int task)
+    {
+        GifPalette taskPal = *pPal;
+        taskPal.cache = caches[task];
+
+        uint32_t lastRow = GifIMin((int)height, (int)(rowsPerTask * (uint32_t)(task+1)));
+        for( uint32_t yy=rowsPerTask * (uint32_t)task; yy<lastRow; ++yy )
+        {
+            const uint8_t* nextPix = nextFrame->data + yy*nextFrame->rowStride;
+            const uint8_t* lastPix = lastFrame? lastFrame + 4*(size_t)yy*stride : NULL;
+            uint8_t* outPix = outFrame + 4*(size_t)yy*stride;
+            for( uint32_t xx=0; xx<width; ++xx )
+            {
+                uint8_t r = nextPix[nextFrame->rOffset];
+                uint8_t g = nextPix[nextFrame->gOffset];
+                uint8_t b = nextPix[nextFrame->bOffset];
+
+                // if a previous color is available, and it matches the current color,
+                // set the pixel to transparent
+                if(lastPix &&
+                   lastPix[0] == r &&
+                   lastPix[1] == g &&
+                   lastPix[2] == b)
+                {
+                    outPix[0] = lastPix[0];
+                    outPix[1] = lastPix[1];
+                    outPix[2] = lastPix[2];
+                    outPix[3] = kGifTransIndex;
+                }
+                else
+                {
+                    // palettize the pixel
+                    int32_t bestInd = GifClosestPaletteIndex(&taskPal, r, g, b);
+
+                    // Write the resulting color to the output buffer
+                    outPix[0] = pPal->r[bestInd];
+                    outPix[1] = pPal->g[bestInd];
+                    outPix[2] = pPal->b[bestInd];
+                    outPix[3] = (uint8_t)bestInd;
+                }
+
+                if(lastPix) lastPix += 4;
+                outPix += 4;
+                nextPix += nextFrame->pixelStride;
+            }
+        }
+    };
+    GIF_PARALLEL_FOR(numTasks, thresholdRows);
+
+    if(extraCaches) GifArenaFree(arena, extraCaches);
+}
+
+// Whether a pixel of the source differs from the same pixel of the last frame, the test that decides whether the
+// palettizers make a pixel transparent.
+bool GifPixelChanged( const uint8_t* lastPix, const GifFrameSource* src, const uint8_t* pix )
+{
+    return lastPix[0] != pix[src->rOffset] || lastPix[1] != pix[src->gOffset] || lastPix[2] != pix[src->bOffset];
+}
+
+// Finds the smallest rectangle holding every changed pixel; right and bottom are one past its last column and row.
+// Returns false if no pixel changed. rowTest(y) gives the test of row y, which tells whether pixel x of it changed.
+// Rows between the first and last changed rows only need checking outside the sides found so far, so a frame that
+// changed all over is settled after a few rows, and one that barely changed costs about one comparison per pixel.
+template<typename RowTest>
+bool GifFindChangedRect( uint32_t width, uint32_t height, RowTest rowTest, uint32_t* left, uint32_t* top, uint32_t* right, uint32_t* bottom )
+{
+    uint32_t x0 = 0, x1 = 0, y0 = 0, y1 = 0;
+
+    // first changed row, and its first changed pixel
+    for( ; y0<height; ++y0 )
+    {
+        auto changed = rowTest(y0);
+        x0 = 0;
+        while(x0 < width && !changed(x0))
+            ++x0;
+        if(x0 < width)
+            break;
+    }
+    if(y0 == height)
+        return false;
+
+    // Then from the bottom up: the right side scan covers whole rows until the last changed row turns up, after that
+    // both scans only cover the columns outside the rectangle so far. Row y0 is reached last and has x0 changed, so
+    // x1 ends up past x0.
+    for( uint32_t yy=height; yy-- > y0; )
+    {
+        auto changed = rowTest(yy);
+        bool rowChanged = false;
+        for( uint32_t xx=width; xx-- > x1; )
+        {
+            if(changed(xx))
+            {
+                x1 = xx + 1;
+                rowChanged = true;
+                break;
+            }
+        }
+        if(y1 == 0)
+        {
+            if(!rowChanged) continue;
+            y1 = yy + 1;
+        }
+        for( uint32_t xx=0; xx<x0; ++xx )
+        {
+            if(changed(xx))
+            {
+                x0 = xx;
+                break;
+            }
+        }
+    }
+
+    *left = x0;
+    *top = y0;
+    *right = x1;
+    *bottom = y1;
+    return true;
+}
+
+// The rectangle of nextFrame that differs from lastFrame.
+bool GifChangedRect( const uint8_t* lastFrame, const GifFrameSource* nextFrame, uint32_t width, uint32_t height,
+                     uint32_t* left, uint32_t* top, uint32_t* right, uint32_t* bottom )
+{
+    const uint32_t pixelStride = nextFrame->pixelStride;
+    auto rowTest = [=](uint32_t yy)
+    {
+        const uint8_t* last = lastFrame + 4*(size_t)yy*width;
+        const uint8_t* pix = nextFrame->data + yy*nextFrame->rowStride;
+        return [=](uint32_t xx) { return GifPixelChanged(last + 4*xx, nextFrame, pix + xx*pixelStride); };
+    };
+    return GifFindChangedRect(width, height, rowTest, left, top, right, bottom);
+}
+
+// Marks the palette indices an index image uses in used[256], and returns the highest of them.
+int GifMarkUsedIndices( const uint8_t* indices, uint32_t indexStride, uint32_t width, uint32_t height, bool* used )
+{
+    for( uint32_t yy=0; yy<height; ++yy )
+    {
+        const uint8_t* row = indices + (size_t)yy*indexStride;
+        for( uint32_t xx=0; xx<width; ++xx )
+            used[row[xx]] = true;
+    }
+
+    int highest = 255;
+    while(highest > 0 && !used[highest])
+        --highest;
+    return highest;
+}
 
-    fputc(0, f); // image block terminator
+// The palettizer of frames that are palette indices already: each pixel's color is looked up instead of searched
+// for. A pixel whose color didn't change from the last frame becomes transIndex, unless that's -1.
+// lastFrame and outFrame have 'stride' pixels per row, the index image indexStride bytes per row.
+void GifMapIndexedImage( const uint8_t* lastFrame, const uint8_t* indices, uint32_t indexStride, uint8_t* outFrame, uint32_t width, uint32_t height, uint32_t stride,
+                         const GifPalette* pPal, int transIndex )
+{
+    int numTasks = GifPaletteTasks(width, height);
+    uint32_t rowsPerTask = (height + (uint32_t)numTasks - 1) / (uint32_t)numTasks;
+    if(transIndex < 0) lastFrame = NULL;
+
+    auto mapRows = [&](int task)
+    {
+        uint32_t lastRow = GifIMin((int)height, (int)(rowsPerTask * (uint32_t)(task+1)));
+        for( uint32_t yy=rowsPerTask * (uint32_t)task; yy<lastRow; ++yy )
+        {
+            const uint8_t* ind = indices + (size_t)yy*indexStride;
+            const uint8_t* last = lastFrame? lastFrame + 4*(size_t)yy*stride : NULL;
+            uint8_t* out = outFrame + 4*(size_t)yy*stride;
+            for( uint32_t xx=0; xx<width; ++xx, out += 4 )
+            {
+                uint8_t r = pPal->r[ind[xx]];
+                uint8_t g = pPal->g[ind[xx]];
+                uint8_t b = pPal->b[ind[xx]];
 
-    GIF_TEMP_FREE(codetree);
+                out[3] = ind[xx];
+                if(last)
+                {
+                    const uint8_t* lastPix = last + 4*xx;
+                    if(lastPix[0] == r && lastPix[1] == g && lastPix[2] == b)
+                        out[3] = (uint8_t)transIndex;
+                }
+                out[0] = r;
+                out[1] = g;
+                out[2] = b;
+            }
+        }
+    };
+    GIF_PARALLEL_FOR(numTasks, mapRows);
 }
 
+// Where the bytes of a GIF go. Everything is written into a user-space buffer first: a file sink fwrites it and a
+// callback sink hands it to the callback whenever it fills up (and at GifEnd), so a file takes a handful of large
+// writes instead of a call per byte. A memory sink's buffer is the output itself; it grows as needed and GifEnd hands
+// it over to the caller.
+#ifndef GIF_SINK_BUFFER_SIZE
+#define GIF_SINK_BUFFER_SIZE (256 * 1024)
+#endif
+
+// Receives the next 'size' bytes of a GIF started by GifBeginCallback. Returning false stops the writer: later bytes
+// are dropped and GifEnd returns false.
+typedef bool (*GifWriteCallback)( void* context, const uint8_t* data, size_t size );
+
+enum
+{
+    kGifSinkFile,
+    kGifSinkMemory,
+    kGifSinkCallback
+};
+
 typedef struct
 {
-    FILE* f;
+    uint8_t* buffer;
+    size_t used;
+    size_t capacity;
+    uint64_t flushed;            // bytes handed to the file or callback before buffer[0]
+
+    FILE* f;                     // kGifSinkFile
+    GifWriteCallback callback;   // kGifSinkCallback
+    void* context;
+    uint8_t** memoryData;        // kGifSinkMemory: where GifEnd stores the output and its size
+    size_t* memorySize;
+
+    int kind;
+    bool failed;                 // a write failed, nothing more is written
+
+    uint8_t padding[3];    // make padding explicit
+} GifSink;
+
+GifSink* GifSinkCreate( int kind )
+{
+    GifSink* sink = (GifSink*)GIF_MALLOC(sizeof(GifSink));
+    memset(sink, 0, sizeof(GifSink));
+    sink->kind = kind;
+    sink->capacity = GIF_SINK_BUFFER_SIZE;
+    sink->buffer = (uint8_t*)GIF_MALLOC(sink->capacity);
+    return sink;
+}
+
+// hand the buffered bytes to the file or callback
+void GifSinkFlush( GifSink* sink )
+{
+    if( sink->kind == kGifSinkMemory || !sink->used )
+        return;
+
+    if( !sink->failed )
+    {
+        if( sink->kind == kGifSinkFile )
+            sink->failed = fwrite(sink->buffer, 1, sink->used, sink->f) != sink->used;
+        else
+            sink->failed = !sink->callback(sink->context, sink->buffer, sink->used);
+    }
+    sink->flushed += sink->used;
+    sink->used = 0;
+}
+
+void GifSinkWrite( GifSink* sink, const uint8_t* data, size_t size )
+{
+    if( size > sink->capacity - sink->used )
+    {
+        if( sink->kind == kGifSinkMemory )
+        {
+            // grow geometrically, so the copies add up to less than the output
+            size_t capacity = sink->capacity;
+            while( size > capacity - sink->used )
+                capacity *= 2;
+            uint8_t* buffer = (uint8_t*)GIF_MALLOC(capacity);
+            memcpy(buffer, sink->buffer, sink->used);
+            GIF_FREE(sink->buffer);
+            sink->buffer = buffer;
+            sink->capacity = capacity;
+        }
+        else
+        {
+            // top the buffer up and flush it, until the rest fits
+            while( size > sink->capacity - sink->used )
+            {
+                size_t part = sink->capacity - sink->used;
+                memcpy(sink->buffer + sink->used, data, part);
+                sink->used += part;
+                data += part;
+                size -= part;
+                GifSinkFlush(sink);
+            }
+        }
+    }
+
+    memcpy(sink->buffer + sink->used, data, size);
+    sink->used += size;
+}
+
+// the fputc of a sink
+void GifSinkPut( GifSink* sink, int value )
+{
+    if( sink->used < sink->capacity )
+        sink->buffer[sink->used++] = (uint8_t)value;
+    else
+    {
+        uint8_t byte = (uint8_t)value;
+        GifSinkWrite(sink, &byte, 1);
+    }
+}
+
+// the fputs of a sink
+void GifSinkPuts( GifSink* sink, const char* str )
+{
+    GifSinkWrite(sink, (const uint8_t*)str, strlen(str));
+}
+
+// how many bytes have been written so far
+uint64_t GifSinkTell( const GifSink* sink )
+{
+    return sink->flushed + sink->used;
+}
+
+// Flushes and closes a sink, handing a memory sink's output to its caller. Returns false if any write failed.
+bool GifSinkClose( GifSink* sink )
+{
+    GifSinkFlush(sink);
+
+    bool ok = !sink->failed;
+    if( sink->kind == kGifSinkFile )
+    {
+        ok = (fclose(sink->f) == 0) && ok;
+    }
+    if( sink->kind == kGifSinkMemory )
+    {
+        *sink->memoryData = sink->buffer;
+        *sink->memorySize = sink->used;
+    }
+    else
+    {
+        GIF_FREE(sink->buffer);
+    }
+    GIF_FREE(sink);
+
+    return ok;
+}
+
+// Writes out the LZW-compressed portion of the image.
+// Codes are packed LSB-first into a 64-bit accumulator and peeled off a byte at a time into 255-byte data
+// sub-blocks, which go to the sink (with their length bytes) as they fill up.
+typedef struct
+{
+    uint64_t bits;        // pending bits, oldest in the lowest position
+    uint32_t bitCount;    // how many bits of 'bits' are pending
+
+    uint32_t chunkIndex;
+    uint8_t chunk[256];   // length byte, then the bytes: written in here until we have 255 of them
+} GifBitStatus;
+
+// write the current sub-block (length byte, then the bytes)
+void GifWriteChunk( GifSink* sink, GifBitStatus* stat )
+{
+    stat->chunk[0] = (uint8_t)stat->chunkIndex;
+    GifSinkWrite(sink, stat->chunk, stat->chunkIndex + 1);
+
+    stat->chunkIndex = 0;
+}
+
+// move every complete byte from the accumulator to the current sub-block
+void GifDrainBits( GifSink* sink, GifBitStatus* stat )
+{
+    while( stat->bitCount >= 8 )
+    {
+        stat->chunk[++stat->chunkIndex] = (uint8_t)stat->bits;
+        stat->bits >>= 8;
+        stat->bitCount -= 8;
+
+        if( stat->chunkIndex == 255 )
+        {
+            GifWriteChunk(sink, stat);
+        }
+    }
+}
+
+void GifWriteCode( GifSink* sink, GifBitStatus* stat, uint32_t code, uint32_t length )
+{
+    stat->bits |= (uint64_t)(code & ((1u << length) - 1)) << stat->bitCount;
+    stat->bitCount += length;
+
+    // codes are at most 12 bits, so there's always room for another one below 52 bits
+    if( stat->bitCount >= 52 )
+        GifDrainBits(sink, stat);
+}
+
+// The LZW dictionary maps (prefix code, next index) to a code. It's an open-addressing hash table rather than a
+// 4096x256 tree, so it stays small enough to live in cache. Each slot's tag holds the 20-bit key (prefix code << 8 |
+// next index) under a 12-bit generation stamp, and a slot only counts if its stamp matches the dictionary's, so
+// clearing the dictionary is just bumping the generation (and a lookup is a single compare).
+#define GIF_LZW_HASH_BITS 13   // 8192 slots for at most 4096 codes
+#define GIF_LZW_KEY_BITS 20
+
+typedef struct
+{
+    uint32_t tags[1 << GIF_LZW_HASH_BITS];
+    uint16_t codes[1 << GIF_LZW_HASH_BITS];
+    uint32_t generation;
+} GifLzwDict;
+
+void GifLzwDictClear( GifLzwDict* dict )
+{
+    ++dict->generation;
+    if( dict->generation == (1u << (32 - GIF_LZW_KEY_BITS)) )
+    {
+        // the stamps wrapped around, stale entries could look live again
+        memset(dict->tags, 0, sizeof(dict->tags));
+        dict->generation = 1;
+    }
+}
+
+// write a 256-color (8-bit) image palette, black in the transparent slot (transIndex, -1 for none)
+void GifWritePalette( const GifPalette* pPal, int transIndex, GifSink* sink )
+{
+    for(int ii=0; ii<(1 << pPal->bitDepth); ++ii)
+    {
+        if(ii == transIndex)
+        {
+            GifSinkPut(sink, 0);  // transparency
+            GifSinkPut(sink, 0);
+            GifSinkPut(sink, 0);
+            continue;
+        }
+
+        uint32_t r = pPal->r[ii];
+        uint32_t g = pPal->g[ii];
+        uint32_t b = pPal->b[ii];
+
+        GifSinkPut(sink, (int)r);
+        GifSinkPut(sink, (int)g);
+        GifSinkPut(sink, (int)b);
+    }
+}
+
+// The LZW minimum code size for the indices of a 2^bitDepth color table. GIF has no 1-bit codes: a two color image
+// (a 1-bit local palette, or a 1-bit global one from GifUseGlobalPalette) is coded like a four color one.
+int GifLzwMinCodeSize( int bitDepth )
+{
+    return GifIMax(2, bitDepth);
+}
+
+// write the image header, LZW-compress and write out the image
+// The image is placed at left, top in the canvas; its rows are 'stride' pixels apart. Pixels of index transIndex are
+// transparent (kGifTransIndex for frames palettized here, -1 for none). The palette is written as the image's local
+// color table, unless it's the global one (localPalette false).
+void GifWriteLzwImage(GifSink* sink, uint8_t* image, uint32_t left, uint32_t top,  uint32_t width, uint32_t height, uint32_t stride, uint32_t delay,
+                      int transIndex, GifPalette* pPal, bool localPalette, GifArena* arena)
+{
+    // graphics control extension
+    GifSinkPut(sink, 0x21);
+    GifSinkPut(sink, 0xf9);
+    GifSinkPut(sink, 0x04);
+    GifSinkPut(sink, (transIndex >= 0)? 0x05 : 0x04); // leave prev frame in place, whether this frame has transparency
+    GifSinkPut(sink, delay & 0xff);
+    GifSinkPut(sink, (delay >> 8) & 0xff);
+    GifSinkPut(sink, (transIndex >= 0)? transIndex : 0); // transparent color index
+    GifSinkPut(sink, 0);
+
+    GifSinkPut(sink, 0x2c); // image descriptor block
+
+    GifSinkPut(sink, left & 0xff);           // corner of image in canvas space
+    GifSinkPut(sink, (left >> 8) & 0xff);
+    GifSinkPut(sink, top & 0xff);
+    GifSinkPut(sink, (top >> 8) & 0xff);
+
+    GifSinkPut(sink, width & 0xff);          // width and height of image
+    GifSinkPut(sink, (width >> 8) & 0xff);
+    GifSinkPut(sink, height & 0xff);
+    GifSinkPut(sink, (height >> 8) & 0xff);
+
+    if(localPalette)
+    {
+        GifSinkPut(sink, 0x80 + pPal->bitDepth-1); // local color table present, 2 ^ bitDepth entries
+        GifWritePalette(pPal, transIndex, sink);
+    }
+    else
+    {
+        GifSinkPut(sink, 0); // no local color table, the global one applies
+    }
+
+    const int minCodeSize = GifLzwMinCodeSize(pPal->bitDepth);
+    const uint32_t clearCode = 1 << minCodeSize;
+
+    GifSinkPut(sink, minCodeSize); // min code size 8 bits
+
+    GifLzwDict* dict = (GifLzwDict*)GifArenaAlloc(arena, sizeof(GifLzwDict));
+    memset(dict, 0, sizeof(GifLzwDict));
+    dict->generation = 1;
+    const uint32_t hashMask = (1u << GIF_LZW_HASH_BITS) - 1;
+
+    int32_t curCode = -1;
+    uint32_t codeSize = (uint32_t)minCodeSize + 1;
+    uint32_t maxCode = clearCode+1;
+
+    GifBitStatus* stat = (GifBitStatus*)GifArenaAlloc(arena, sizeof(GifBitStatus));
+    stat->bits = 0;
+    stat->bitCount = 0;
+    stat->chunkIndex = 0;
+
+    GifWriteCode(sink, stat, clearCode, codeSize);  // start with a fresh LZW dictionary
+
+    for(uint32_t yy=0; yy<height; ++yy)
+    {
+    #ifdef GIF_FLIP_VERT
+        // bottom-left origin image (such as an OpenGL capture)
+        const uint8_t* row = image + (size_t)(height-1-yy)*stride*4;
+    #else
+        // top-left origin
+        const uint8_t* row = image + (size_t)yy*stride*4;
+    #endif
+
+        for(uint32_t xx=0; xx<width; ++xx)
+        {
+            uint8_t nextValue = row[xx*4+3];
+
+            if( curCode < 0 )
+            {
+                // first value in a new run
+                curCode = nextValue;
+                continue;
+            }
+
+            // look the run up in the dictionary
+            uint32_t key = ((uint32_t)curCode << 8) | nextValue;
+            uint32_t tag = (dict->generation << GIF_LZW_KEY_BITS) | key;
+            uint32_t slot = (key * 2654435761u) >> (32 - GIF_LZW_HASH_BITS);
+            while( dict->tags[slot] != tag && (dict->tags[slot] >> GIF_LZW_KEY_BITS) == dict->generation )
+            {
+                slot = (slot + 1) & hashMask;
+            }
+
+            if( dict->tags[slot] == tag )
+            {
+                // current run already in the dictionary
+                curCode = dict->codes[slot];
+            }
+            else
+            {
+                // finish the current run, write a code
+                GifWriteCode(sink, stat, (uint32_t)curCode, codeSize);
+
+                // insert the new run into the dictionary (the probe stopped at a free slot)
+                dict->tags[slot] = tag;
+                dict->codes[slot] = (uint16_t)++maxCode;
+
+                if( maxCode >= (1ul << codeSize) )
+                {
+                    // dictionary entry count has broken a size barrier,
+                    // we need more bits for codes
+                    codeSize++;
+                }
+                if( maxCode == 4095 )
+                {
+                    // the dictionary is full, clear it out and begin anew
+                    GifWriteCode(sink, stat, clearCode, codeSize); // clear tree
+
+                    GifLzwDictClear(dict);
+                    codeSize = (uint32_t)(minCodeSize + 1);
+                    maxCode = clearCode+1;
+                }
+
+                curCode = nextValue;
+            }
+        }
+    }
+
+    // compression footer
+    GifWriteCode(sink, stat, (uint32_t)curCode, codeSize);
+    GifWriteCode(sink, stat, clearCode, codeSize);
+    GifWriteCode(sink, stat, clearCode + 1, (uint32_t)minCodeSize + 1);
+
+    // write out the last partial byte and chunk
+    GifDrainBits(sink, stat);
+    if( stat->bitCount )
+    {
+        stat->bitCount = 8;
+        GifDrainBits(sink, stat);
+    }
+    if( stat->chunkIndex ) GifWriteChunk(sink, stat);
+
+    GifSinkPut(sink, 0); // image block terminator
+
+    GifArenaFree(arena, stat);
+    GifArenaFree(arena, dict);
+}
+
+// GIF89a lets a frame be made of several images, each with a descriptor of its own, and only the last one needs to
+// carry the frame's delay. A large frame is cut into horizontal bands which are LZW encoded in parallel, each into a
+// memory sink of its own, and then written out one after another, so the encoding of a frame isn't stuck on one core.
+// Note: browsers treat a delay of 0 as about 10 (hundredths of a second), so they pause after every band.
+typedef struct
+{
+    int numBands;                       // most bands a frame is cut into, and how many sinks there are
+    GifSink* sinks[GIF_MAX_TASKS];      // memory sinks the bands are encoded into, reused from frame to frame
+} GifTiles;
+
+// how many bands to cut a frame (or the changed rectangle of one) of width x height into, with at most maxBands
+int GifEncodeBands( uint32_t width, uint32_t height, int maxBands )
+{
+    uint64_t numPixels = (uint64_t)width * height;
+    int numBands = GifIMin(GIF_MAX_TASKS, GifIMin(maxBands, (int)(numPixels / GIF_PARALLEL_MIN_PIXELS)));
+    return GifIMax(1, GifIMin(numBands, (int)height));
+}
+
+// the scratch memory one GifWriteLzwImage takes
+size_t GifLzwScratchSize()
+{
+    return sizeof(GifLzwDict) + sizeof(GifBitStatus) + 2 * GIF_ARENA_ALIGN;
+}
+
+// Writes the image like GifWriteLzwImage, as bands encoded in parallel when 'tiles' is set and the image is large
+// enough to be worth splitting.
+void GifWriteLzwImageTiled(GifSink* sink, GifTiles* tiles, uint8_t* image, uint32_t left, uint32_t top,  uint32_t width, uint32_t height, uint32_t stride,
+                           uint32_t delay, int transIndex, GifPalette* pPal, bool localPalette, GifArena* arena)
+{
+    int numBands = tiles? GifEncodeBands(width, height, tiles->numBands) : 1;
+    if(numBands == 1)
+    {
+        GifWriteLzwImage(sink, image, left, top, width, height, stride, delay, transIndex, pPal, localPalette, arena);
+        return;
+    }
+
+    // every band gets its own piece of the arena, the tasks can't share one
+    uint8_t* bandScratch = (uint8_t*)GifArenaAlloc(arena, GifLzwScratchSize() * (size_t)numBands);
+    GifArena bandArenas[GIF_MAX_TASKS];
+    for(int band=0; band<numBands; ++band)
+    {
+        bandArenas[band].base = bandScratch + GifLzwScratchSize() * (size_t)band;
+        bandArenas[band].size = GifLzwScratchSize();
+        bandArenas[band].used = 0;
+
+        tiles->sinks[band]->used = 0;
+        tiles->sinks[band]->flushed = 0;
+    }
+
+    auto encodeBand = [&](int band)
+    {
+        uint32_t firstRow = (uint32_t)((uint64_t)height * (uint32_t)band / (uint32_t)numBands);
+        uint32_t lastRow = (uint32_t)((uint64_t)height * (uint32_t)(band+1) / (uint32_t)numBands);
+    #ifdef GIF_FLIP_VERT
+        // the rows are written bottom up, so the first rows of the image are the bottom band
+        uint32_t bandTop = top + height - lastRow;
+    #else
+        uint32_t bandTop = top + firstRow;
+    #endif
+        // the bands are written in order, and only the last one holds the frame on screen
+        uint32_t bandDelay = (band == numBands-1)? delay : 0;
+
+        GifWriteLzwImage(tiles->sinks[band], image + 4*(size_t)firstRow*stride, left, bandTop, width, lastRow - firstRow, stride, bandDelay,
+                         transIndex, pPal, localPalette, &bandArenas[band]);
+    };
+    GIF_PARALLEL_FOR(numBands, encodeBand);
+
+    for(int band=0; band<numBands; ++band)
+        GifSinkWrite(sink, tiles->sinks[band]->buffer, tiles->sinks[band]->used);
+
+    GifArenaFree(arena, bandScratch);
+}
+
+// A palettized frame waiting to be written by a GifBeginAsync writer.
+typedef struct
+{
+    uint8_t* image;     // the changed rectangle, palette index in the alpha channel, as GifWriteLzwImage takes it
+    GifPalette pal;
+    uint32_t left;      // corner of the rectangle in the canvas
+    uint32_t top;
+    uint32_t width;
+    uint32_t height;
+    uint32_t delay;
+    int transIndex;
+    bool localPalette;
+
+    uint8_t padding[3];    // make padding explicit
+} GifQueuedFrame;
+
+// The frames of a GifBeginAsync writer, handed from GifWriteFrame to the encoder thread. The frame images form a ring:
+// frame n is copied into frames[n % numFrames] once palettized, so at most numFrames frames wait to be written.
+struct GifFrameQueue
+{
+    std::mutex lock;
+    std::condition_variable changed;
+    std::thread encoder;
+    GifQueuedFrame* frames;
+    uint32_t numFrames;
+    uint64_t queued;      // frames handed to the encoder so far
+    uint64_t written;     // frames the encoder has written so far
+    bool closing;         // GifEnd is waiting for the encoder to finish
+};
+
+// Encoder thread of a GifBeginAsync writer: writes the queued frames in order until the writer is closed.
+void GifEncodeQueuedFrames( GifSink* sink, GifFrameQueue* queue, GifTiles* tiles, GifArena arena )
+{
+    std::unique_lock<std::mutex> guard(queue->lock);
+    for(;;)
+    {
+        queue->changed.wait(guard, [queue] { return queue->written < queue->queued || queue->closing; });
+        if(queue->written == queue->queued)
+            return;
+
+        GifQueuedFrame* frame = &queue->frames[queue->written % queue->numFrames];
+        guard.unlock();
+
+        GIF_TRACE_BEGIN("GifWriteLzwImage", GifSinkTell(sink));
+        GifWriteLzwImageTiled(sink, tiles, frame->image, frame->left, frame->top, frame->width, frame->height, frame->width, frame->delay,
+                              frame->transIndex, &frame->pal, frame->localPalette, &arena);
+        GIF_TRACE_END("GifWriteLzwImage", GifSinkTell(sink), frame->width, frame->height);
+
+        guard.lock();
+        ++queue->written;
+        queue->changed.notify_all();
+    }
+}
+
+typedef struct
+{
+    GifSink* sink;           // NULL unless a GIF is in progress
     uint8_t* oldImage;
+    GifColorCache* colorCache;   // one per task a frame is palettized in (GifPaletteTasks)
+    int numColorCaches;
+    GifFrameQueue* queue;    // NULL unless started by GifBeginAsync
+    GifPalette* globalPalette;   // NULL unless set by GifUseGlobalPalette
+    GifTiles* tiles;             // NULL unless set by GifUseTiledEncoding
+
+    // scratch memory of the palettizing and of the LZW encoding (which can be on different threads), carved out of
+    // one block: the writer's own (ownedScratch), or the caller's
+    GifArena frameArena;
+    GifArena encodeArena;
+    uint8_t* ownedScratch;
+
+    // GifMakePaletteHistogram's bins, at the end of the scratch block and zero between frames (NULL if the frames are
+    // too small to use them)
+    GifHistogramBin* histogram;
+
+    // the header waits for the first frame (or GifEnd), until then the global palette can still be set
+    uint32_t width;
+    uint32_t height;
+    uint32_t delay;
+    int dither;              // the dither mode the scratch memory is sized for (see GifBegin)
     bool firstFrame;
 
-    uint8_t padding[7];    // make padding explicit
+    uint8_t padding[3];    // make padding explicit
 } GifWriter;
 
+// the bins GifMakePaletteHistogram counts frames of width x height into, none if every frame is below GIF_HISTOGRAM_MIN_PIXELS
+size_t GifHistogramScratchSize( uint32_t width, uint32_t height )
+{
+    if((uint64_t)width * height < GIF_HISTOGRAM_MIN_PIXELS) return 0;
+    return sizeof(GifHistogramBin) * GIF_HISTOGRAM_BINS * (size_t)GifHistogramBands(width, height) + GIF_ARENA_ALIGN;
+}
+
+// How much scratch memory the palettizing of a frame of width x height with the given dither mode needs at most (the
+// changed rectangle of a frame is never bigger than the frame, and the phases of a frame run one after another).
+size_t GifFrameScratchSize( uint32_t width, uint32_t height, int dither )
+{
+    uint64_t numPixels = (uint64_t)width * height;
+
+    // palette: GifMakePalette's list of the pixels, or GifMakePaletteHistogram's merged colors (its bins are kept
+    // apart, see GifHistogramScratchSize), or GifMakeExactPalette's color sets
+    size_t numTasks = (size_t)GifPaletteTasks(width, height);
+    size_t copySize = 4 * (size_t)(numPixels < GIF_HISTOGRAM_MIN_PIXELS? numPixels : GIF_HISTOGRAM_MIN_PIXELS);
+    size_t histogramSize = numPixels < GIF_HISTOGRAM_MIN_PIXELS? 0 : sizeof(GifHistogramColor) * GIF_HISTOGRAM_BINS;
+    size_t paletteSize = copySize > histogramSize? copySize : histogramSize;
+    size_t colorSetSize = sizeof(GifColorSet) * numTasks;
+    paletteSize = paletteSize > colorSetSize? paletteSize : colorSetSize;
+
+    // palettizing: GifDitherImage's row ring and progress counters, only Floyd-Steinberg needs any (the tasks' color
+    // caches belong to the writer)
+    size_t ditherSize = 0;
+    if(dither == kGifDitherFloydSteinberg)
+        ditherSize = sizeof(int32_t) * 3 * (size_t)width * (numTasks + 1) + sizeof(std::atomic<uint32_t>) * height;
+
+    return (paletteSize > ditherSize? paletteSize : ditherSize) + 4 * GIF_ARENA_ALIGN;
+}
+
+// the LZW encoding's, enough for every band of a tiled writer
+size_t GifEncodeScratchSize( uint32_t width, uint32_t height )
+{
+    return GifLzwScratchSize() * (size_t)GifEncodeBands(width, height, GIF_MAX_TASKS) + GIF_ARENA_ALIGN;
+}
+
+// How big a block GifUseScratch needs for frames of width x height, for a writer begun with the given dither mode (the
+// default is enough for any).
+size_t GifScratchSize( uint32_t width, uint32_t height, int dither = kGifDitherFloydSteinberg )
+{
+    return GifFrameScratchSize(width, height, dither) + GifEncodeScratchSize(width, height) + GifHistogramScratchSize(width, height);
+}
+
+// splits a scratch block between the writer's arenas
+void GifSetScratch( GifWriter* writer, uint8_t* scratch )
+{
+    writer->frameArena.base = scratch;
+    writer->frameArena.size = GifFrameScratchSize(writer->width, writer->height, writer->dither);
+    writer->frameArena.used = 0;
+    writer->encodeArena.base = scratch + writer->frameArena.size;
+    writer->encodeArena.size = GifEncodeScratchSize(writer->width, writer->height);
+    writer->encodeArena.used = 0;
+
+    // the bins are cleared once here, and left cleared by every frame after
+    size_t histogramSize = GifHistogramScratchSize(writer->width, writer->height);
+    writer->histogram = NULL;
+    if(histogramSize)
+    {
+        uintptr_t start = (uintptr_t)(writer->encodeArena.base + writer->encodeArena.size);
+        start = (start + GIF_ARENA_ALIGN - 1) & ~(uintptr_t)(GIF_ARENA_ALIGN - 1);
+        writer->histogram = (GifHistogramBin*)start;
+        memset(writer->histogram, 0, histogramSize - GIF_ARENA_ALIGN);
+    }
+}
+
+// Sets up a writer whose sink has been created.
+void GifBeginSink( GifWriter* writer, GifSink* sink, uint32_t width, uint32_t height, uint32_t delay, int dither )
+{
+    writer->sink = sink;
+    writer->firstFrame = true;
+    writer->queue = NULL;
+    writer->globalPalette = NULL;
+    writer->tiles = NULL;
+    writer->width = width;
+    writer->height = height;
+    writer->delay = delay;
+    writer->dither = dither;
+
+    // allocate
+    writer->oldImage = (uint8_t*)GIF_MALLOC(width*height*4);
+    writer->numColorCaches = GifPaletteTasks(width, height);
+    writer->colorCache = (GifColorCache*)GIF_MALLOC(sizeof(GifColorCache) * (size_t)writer->numColorCaches);
+    memset(writer->colorCache, 0, sizeof(GifColorCache) * (size_t)writer->numColorCaches);
+    writer->ownedScratch = (uint8_t*)GIF_MALLOC(GifScratchSize(width, height, dither));
+    GifSetScratch(writer, writer->ownedScratch);
+}
+
+// Writes the header, with the global palette if there is one.
+void GifWriteHeader( const GifWriter* writer )
+{
+    GifSink* sink = writer->sink;
+    uint32_t width = writer->width;
+    uint32_t height = writer->height;
+
+    GifSinkPuts(sink, "GIF89a");
+
+    // screen descriptor
+    GifSinkPut(sink, width & 0xff);
+    GifSinkPut(sink, (width >> 8) & 0xff);
+    GifSinkPut(sink, height & 0xff);
+    GifSinkPut(sink, (height >> 8) & 0xff);
+
+    if( writer->globalPalette )
+    {
+        GifSinkPut(sink, 0xf0 + writer->globalPalette->bitDepth-1);  // unsorted global color table of 2 ^ bitDepth entries
+        GifSinkPut(sink, 0);     // background color
+        GifSinkPut(sink, 0);     // pixels are square
+
+        GifWritePalette(writer->globalPalette, kGifTransIndex, sink);
+    }
+    else
+    {
+        GifSinkPut(sink, 0xf0);  // there is an unsorted global color table of 2 entries
+        GifSinkPut(sink, 0);     // background color
+        GifSinkPut(sink, 0);     // pixels are square (we need to specify this because it's 1989)
+
+        // now the "global" palette (really just a dummy palette)
+        // color 0: black
+        GifSinkPut(sink, 0);
+        GifSinkPut(sink, 0);
+        GifSinkPut(sink, 0);
+        // color 1: also black
+        GifSinkPut(sink, 0);
+        GifSinkPut(sink, 0);
+        GifSinkPut(sink, 0);
+    }
+
+    if( writer->delay != 0 )
+    {
+        // animation header
+        GifSinkPut(sink, 0x21); // extension
+        GifSinkPut(sink, 0xff); // application specific
+        GifSinkPut(sink, 11); // length 11
+        GifSinkPuts(sink, "NETSCAPE2.0"); // yes, really
+        GifSinkPut(sink, 3); // 3 bytes of NETSCAPE2.0 data
+
+        GifSinkPut(sink, 1); // this is the Netscape 2.0 sub-block ID and it must be 1, otherwise some viewers error
+        GifSinkPut(sink, 0); // loop infinitely (byte 0)
+        GifSinkPut(sink, 0); // loop infinitely (byte 1)
+
+        GifSinkPut(sink, 0); // block terminator
+    }
+}
+
 // Creates a gif file.
 // The input GIFWriter is assumed to be uninitialized.
 // The delay value is the time between frames in hundredths of a second - note that not all viewers pay much attention to this value.
-bool GifBegin( GifWriter* writer, const char* filename, uint32_t width, uint32_t height, uint32_t delay, int32_t bitDepth = 8, bool dither = false )
+// The writer's scratch memory is sized for frames dithered the way 'dither' says; frames that dither differently still
+// work, but Floyd-Steinberg frames of a writer begun without it allocate their temporaries every frame.
+bool GifBegin( GifWriter* writer, const char* filename, uint32_t width, uint32_t height, uint32_t delay, int32_t bitDepth = 8, int dither = kGifDitherNone )
 {
-    (void)bitDepth; (void)dither; // Mute "Unused argument" warnings
+    (void)bitDepth; // Mute "Unused argument" warnings
+    FILE* f;
 #if defined(_MSC_VER) && (_MSC_VER >= 1400)
-	writer->f = 0;
-    fopen_s(&writer->f, filename, "wb");
+	f = 0;
+    fopen_s(&f, filename, "wb");
 #else
-    writer->f = fopen(filename, "wb");
+    f = fopen(filename, "wb");
 #endif
-    if(!writer->f) return false;
+    if(!f)
+    {
+        writer->sink = NULL;
+        return false;
+    }
 
-    writer->firstFrame = true;
+    GifSink* sink = GifSinkCreate(kGifSinkFile);
+    sink->f = f;
+    GifBeginSink(writer, sink, width, height, delay, dither);
+    return true;
+}
 
-    // allocate
-    writer->oldImage = (uint8_t*)GIF_MALLOC(width*height*4);
+// Creates a gif in memory, like GifBegin. GifEnd stores the address and size of the finished GIF in *data and *size;
+// the caller frees it with GIF_FREE.
+bool GifBeginMemory( GifWriter* writer, uint8_t** data, size_t* size, uint32_t width, uint32_t height, uint32_t delay, int32_t bitDepth = 8, int dither = kGifDitherNone )
+{
+    (void)bitDepth; // Mute "Unused argument" warnings
+    *data = NULL;
+    *size = 0;
+
+    GifSink* sink = GifSinkCreate(kGifSinkMemory);
+    sink->memoryData = data;
+    sink->memorySize = size;
+    GifBeginSink(writer, sink, width, height, delay, dither);
+    return true;
+}
+
+// Creates a gif like GifBegin, handing the bytes to 'callback' in large blocks, in order.
+bool GifBeginCallback( GifWriter* writer, GifWriteCallback callback, void* context, uint32_t width, uint32_t height, uint32_t delay, int32_t bitDepth = 8, int dither = kGifDitherNone )
+{
+    (void)bitDepth; // Mute "Unused argument" warnings
+    GifSink* sink = GifSinkCreate(kGifSinkCallback);
+    sink->callback = callback;
+    sink->context = context;
+    GifBeginSink(writer, sink, width, height, delay, dither);
+    return true;
+}
 
-    fputs("GIF89a", writer->f);
+// Moves the LZW encoding and writing of a writer just created (by GifBegin, GifBeginMemory or GifBeginCallback, before
+// any frame) onto a thread of its own.
+// Each GifWriteFrame then only builds the palette and palettizes the frame (which the next frame needs for its delta)
+// before returning; the LZW encoding and writes of the frame overlap with the caller's next frames. Up to
+// maxFramesInFlight palettized frames (at least 1) wait to be written, each taking an image sized buffer; when they
+// are all waiting, GifWriteFrame blocks until the oldest is written. GifEnd writes out whatever is left.
+bool GifStartAsync( GifWriter* writer, uint32_t width, uint32_t height, int maxFramesInFlight )
+{
+    if(!writer->sink || writer->queue || !writer->firstFrame) return false;
+
+    GifFrameQueue* queue = new (GIF_MALLOC(sizeof(GifFrameQueue))) GifFrameQueue();
+    queue->numFrames = (uint32_t)GifIMax(1, maxFramesInFlight);
+    queue->frames = (GifQueuedFrame*)GIF_MALLOC(sizeof(GifQueuedFrame) * queue->numFrames);
+    memset(queue->frames, 0, sizeof(GifQueuedFrame) * queue->numFrames);
+    for(uint32_t ii=0; ii<queue->numFrames; ++ii)
+        queue->frames[ii].image = (uint8_t*)GIF_MALLOC(width*height*4);
+    queue->queued = 0;
+    queue->written = 0;
+    queue->closing = false;
+    queue->encoder = std::thread(GifEncodeQueuedFrames, writer->sink, queue, writer->tiles, writer->encodeArena);
+
+    writer->queue = queue;
+    return true;
+}
 
-    // screen descriptor
-    fputc(width & 0xff, writer->f);
-    fputc((width >> 8) & 0xff, writer->f);
-    fputc(height & 0xff, writer->f);
-    fputc((height >> 8) & 0xff, writer->f);
-
-    fputc(0xf0, writer->f);  // there is an unsorted global color table of 2 entries
-    fputc(0, writer->f);     // background color
-    fputc(0, writer->f);     // pixels are square (we need to specify this because it's 1989)
-
-    // now the "global" palette (really just a dummy palette)
-    // color 0: black
-    fputc(0, writer->f);
-    fputc(0, writer->f);
-    fputc(0, writer->f);
-    // color 1: also black
-    fputc(0, writer->f);
-    fputc(0, writer->f);
-    fputc(0, writer->f);
-
-    if( delay != 0 )
+// Creates a gif file like GifBegin, written by a thread of its own (see GifStartAsync).
+bool GifBeginAsync( GifWriter* writer, const char* filename, uint32_t width, uint32_t height, uint32_t delay, int maxFramesInFlight,
+                    int32_t bitDepth = 8, int dither = kGifDitherNone )
+{
+    if(!GifBegin(writer, filename, width, height, delay, bitDepth, dither)) return false;
+
+    return GifStartAsync(writer, width, height, maxFramesInFlight);
+}
+
+// Makes a writer just created (before any frame, and before GifStartAsync) use the caller's memory for its scratch
+// space, instead of a block of its own: 'size' must be at least GifScratchSize(width, height, dither), with the dither
+// mode it was begun with. The memory must stay valid until GifEnd, and can be reused for another writer afterwards (but
+// not shared by two at once).
+bool GifUseScratch( GifWriter* writer, void* scratch, size_t size )
+{
+    if(!writer->sink || !writer->firstFrame || writer->queue || size < GifScratchSize(writer->width, writer->height, writer->dither)) return false;
+
+    if(writer->ownedScratch)
     {
-        // animation header
-        fputc(0x21, writer->f); // extension
-        fputc(0xff, writer->f); // application specific
-        fputc(11, writer->f); // length 11
-        fputs("NETSCAPE2.0", writer->f); // yes, really
-        fputc(3, writer->f); // 3 bytes of NETSCAPE2.0 data
+        GIF_FREE(writer->ownedScratch);
+        writer->ownedScratch = NULL;
+    }
+    GifSetScratch(writer, (uint8_t*)scratch);
+    return true;
+}
+
+// Makes a writer just created (before any frame, and before GifStartAsync) cut large frames into up to maxBands
+// horizontal bands (at most GIF_MAX_TASKS), which are LZW encoded in parallel and written as separate images (see
+// GifTiles). The bands before the last have no delay, which browsers stretch, so it suits still images best.
+bool GifUseTiledEncoding( GifWriter* writer, int maxBands )
+{
+    if(!writer->sink || !writer->firstFrame || writer->queue || writer->tiles || maxBands < 2) return false;
+
+    GifTiles* tiles = (GifTiles*)GIF_MALLOC(sizeof(GifTiles));
+    tiles->numBands = GifIMin(maxBands, GIF_MAX_TASKS);
+    for(int band=0; band<tiles->numBands; ++band)
+        tiles->sinks[band] = GifSinkCreate(kGifSinkMemory);
+
+    writer->tiles = tiles;
+    return true;
+}
+
+// Gives every frame of a writer just created (before any frame) the same palette. 'pal' (from GifMakeGlobalPalette, or
+// filled in by the caller: only bitDepth and the colors are used, and entry kGifTransIndex is reserved for
+// transparency) is written once, as the global color table, and the frames are palettized against it instead of
+// building and writing palettes of their own. The bitDepth arguments of GifWriteFrame are ignored from then on.
+// Any bitDepth from 1 to 8 makes a valid color table; the frames' LZW codes never start below 2 bits (see
+// GifLzwMinCodeSize).
+bool GifUseGlobalPalette( GifWriter* writer, const GifPalette* pal )
+{
+    if(!writer->sink || !writer->firstFrame || pal->bitDepth < 1 || pal->bitDepth > 8) return false;
+
+    if(!writer->globalPalette)
+        writer->globalPalette = (GifPalette*)GIF_MALLOC(sizeof(GifPalette));
+    *writer->globalPalette = *pal;
+    writer->globalPalette->cache = NULL;
+
+    // the color caches carry over from frame to frame, now that the palette does
+    for(int task=0; task<writer->numColorCaches; ++task)
+        GifColorCacheReset(writer->colorCache + task);
+    return true;
+}
+
+// Writes the rectangle of the canvas at left, top that a frame was just palettized into (pixel index in the alpha
+// channel), or queues it for the encoder thread of an async writer.
+bool GifWriteCanvasRect( GifWriter* writer, uint32_t left, uint32_t top, uint32_t rectWidth, uint32_t rectHeight, uint32_t delay, GifPalette* pal,
+                         int transIndex, bool localPalette )
+{
+    uint8_t* canvas = writer->oldImage + 4*((size_t)top*writer->width + left);
 
-        fputc(1, writer->f); // this is the Netscape 2.0 sub-block ID and it must be 1, otherwise some viewers error
-        fputc(0, writer->f); // loop infinitely (byte 0)
-        fputc(0, writer->f); // loop infinitely (byte 1)
+#ifdef GIF_FLIP_VERT
+    // the rows are written bottom up, so the rectangle is that far from the bottom of the canvas instead
+    top = writer->height - (top + rectHeight);
+#endif
 
-        fputc(0, writer->f); // block terminator
+    // an async writer copies the rectangle into the next buffer of its ring (once the frame that used it has been
+    // written) for the encoder thread; the next frame overwrites the canvas
+    GifFrameQueue* queue = writer->queue;
+    if(queue)
+    {
+        GifQueuedFrame* queuedFrame;
+        {
+            std::unique_lock<std::mutex> guard(queue->lock);
+            queue->changed.wait(guard, [queue] { return queue->queued - queue->written < queue->numFrames; });
+            queuedFrame = &queue->frames[queue->queued % queue->numFrames];
+        }
+
+        for(uint32_t yy=0; yy<rectHeight; ++yy)
+            memcpy(queuedFrame->image + 4*(size_t)yy*rectWidth, canvas + 4*(size_t)yy*writer->width, 4*(size_t)rectWidth);
+        queuedFrame->pal = *pal;
+        queuedFrame->pal.cache = NULL;
+        queuedFrame->left = left;
+        queuedFrame->top = top;
+        queuedFrame->width = rectWidth;
+        queuedFrame->height = rectHeight;
+        queuedFrame->delay = delay;
+        queuedFrame->transIndex = transIndex;
+        queuedFrame->localPalette = localPalette;
+
+        std::lock_guard<std::mutex> guard(queue->lock);
+        ++queue->queued;
+        queue->changed.notify_all();
+        return true;
     }
 
+    GIF_TRACE_BEGIN("GifWriteLzwImage", GifSinkTell(writer->sink));
+    GifWriteLzwImageTiled(writer->sink, writer->tiles, canvas, left, top, rectWidth, rectHeight, writer->width, delay, transIndex, pal, localPalette,
+                          &writer->encodeArena);
+    GIF_TRACE_END("GifWriteLzwImage", GifSinkTell(writer->sink), rectWidth, rectHeight);
+
     return true;
 }
 
-// Writes out a new frame to a GIF in progress.
+// Writes out a new frame to a GIF in progress, reading the pixels through a GifFrameSource.
 // The GIFWriter should have been created by GIFBegin.
 // AFAIK, it is legal to use different bit depths for different frames of an image -
 // this may be handy to save bits in animations that don't change much.
-bool GifWriteFrame( GifWriter* writer, const uint8_t* image, uint32_t width, uint32_t height, uint32_t delay, int bitDepth = 8, bool dither = false )
+// kGifBitDepthAuto picks it for each frame: a frame whose changed pixels have at most 255 colors gets an exact palette
+// of just enough bits (and isn't dithered, there's no error to spread), any other frame an 8-bit palette.
+bool GifWriteFrameFromSource( GifWriter* writer, const GifFrameSource* image, uint32_t width, uint32_t height, uint32_t delay, int bitDepth = 8, int dither = kGifDitherNone )
 {
-    if(!writer->f) return false;
+    if(!writer->sink) return false;
 
-    const uint8_t* oldImage = writer->firstFrame? NULL : writer->oldImage;
+    const bool firstFrame = writer->firstFrame;
+    if(firstFrame)
+        GifWriteHeader(writer);
     writer->firstFrame = false;
 
+    // After the first frame only the rectangle around the pixels that changed is palettized and written, the rest of
+    // the canvas stays as it was. A frame identical to the last one is written as a single transparent pixel, which
+    // still holds the animation for its delay.
+    uint32_t left = 0, top = 0, right = width, bottom = height;
+    if(!firstFrame)
+    {
+        GIF_TRACE_BEGIN("GifChangedRect", 0);
+        if(!GifChangedRect(writer->oldImage, image, width, height, &left, &top, &right, &bottom))
+            right = bottom = 1;
+        GIF_TRACE_END("GifChangedRect", 0, width, height);
+    }
+    uint32_t rectWidth = right - left;
+    uint32_t rectHeight = bottom - top;
+
+    GifFrameSource rect = *image;
+    rect.data += top*image->rowStride + left*image->pixelStride;
+
+    // The rectangle is palettized in place in oldImage, which holds the canvas as the last frame left it (each pixel
+    // is compared with the last frame just before it's overwritten).
+    uint8_t* canvas = writer->oldImage + 4*((size_t)top*width + left);
+    const uint8_t* lastFrame = firstFrame? NULL : canvas;
+
     GifPalette pal;
-    GifMakePalette((dither? NULL : oldImage), image, width, height, bitDepth, dither, &pal);
+    if(writer->globalPalette)
+    {
+        pal = *writer->globalPalette;
+        pal.cache = writer->colorCache;
+        pal.numCaches = writer->numColorCaches;
+    }
+    else
+    {
+        memset(&pal, 0, sizeof(pal)); // palette slots the image doesn't need would otherwise be written out as stack garbage
+        GIF_TRACE_BEGIN("GifMakePalette", 0);
+        if(bitDepth == kGifBitDepthAuto && GifMakeExactPalette(lastFrame, &rect, rectWidth, rectHeight, width, &pal, &writer->frameArena))
+        {
+            dither = kGifDitherNone;
+        }
+        else
+        {
+            if(bitDepth == kGifBitDepthAuto)
+                bitDepth = 8;
+
+            // Floyd-Steinberg spreads error into unchanged pixels, so it needs a palette for the whole rectangle. Ordered
+            // dithering keeps unchanged pixels transparent like thresholding does.
+            const uint8_t* paletteBase = (dither == kGifDitherFloydSteinberg)? NULL : lastFrame;
+            bool buildForDither = (dither != kGifDitherNone);
+            if((uint64_t)rectWidth * rectHeight < GIF_HISTOGRAM_MIN_PIXELS)
+                GifMakePalette(paletteBase, &rect, rectWidth, rectHeight, width, bitDepth, buildForDither, &pal, &writer->frameArena);
+            else
+                GifMakePaletteHistogram(paletteBase, &rect, rectWidth, rectHeight, width, bitDepth, buildForDither, &pal, writer->histogram, &writer->frameArena);
+        }
+        GIF_TRACE_END("GifMakePalette", 0, rectWidth, rectHeight);
 
-    if(dither)
-        GifDitherImage(oldImage, image, writer->oldImage, width, height, &pal);
+        pal.cache = writer->colorCache;
+        pal.numCaches = writer->numColorCaches;
+        for(int task=0; task<pal.numCaches; ++task)
+            GifColorCacheReset(pal.cache + task);
+    }
+
+    if(dither == kGifDitherFloydSteinberg)
+    {
+        GIF_TRACE_BEGIN("GifDitherImage", 0);
+        GifDitherImage(lastFrame, &rect, canvas, rectWidth, rectHeight, width, &pal, &writer->frameArena);
+        GIF_TRACE_END("GifDitherImage", 0, rectWidth, rectHeight);
+    }
+    else if(dither == kGifDitherOrdered)
+    {
+        GIF_TRACE_BEGIN("GifOrderedDitherImage", 0);
+        GifOrderedDitherImage(lastFrame, &rect, canvas, rectWidth, rectHeight, width, left, top, &pal, &writer->frameArena);
+        GIF_TRACE_END("GifOrderedDitherImage", 0, rectWidth, rectHeight);
+    }
     else
-        GifThresholdImage(oldImage, image, writer->oldImage, width, height, &pal);
+    {
+        GIF_TRACE_BEGIN("GifThresholdImage", 0);
+        GifThresholdImage(lastFrame, &rect, canvas, rectWidth, rectHeight, width, &pal, &writer->frameArena);
+        GIF_TRACE_END("GifThresholdImage", 0, rectWidth, rectHeight);
+    }
 
-    GifWriteLzwImage(writer->f, writer->oldImage, 0, 0, width, height, delay, &pal);
+    return GifWriteCanvasRect(writer, left, top, rectWidth, rectHeight, delay, &pal, kGifTransIndex, !writer->globalPalette);
+}
 
-    return true;
+// Writes out a new frame given as palette indices (one byte per pixel, rows indexStride bytes apart) into 'pal', which
+// is written as the frame's own color table: only bitDepth and the colors are used, every index below 2 ^ bitDepth is
+// a color, and the indices must stay below it. The colors come out exact, and there is no palette to build or color
+// to search for, so the frame costs little more than its LZW encoding. The color table is cut down to the fewest bits
+// that hold the indices the frame uses. Frames that are an 8-bit image run through a colormap, for instance, are the
+// image as indices into the colormap.
+// Indexed frames and frames of other kinds can follow each other in the same GIF.
+bool GifWriteIndexedFrame( GifWriter* writer, const uint8_t* indices, uint32_t indexStride, const GifPalette* pal, uint32_t width, uint32_t height, uint32_t delay )
+{
+    if(!writer->sink || pal->bitDepth < 1 || pal->bitDepth > 8) return false;
+
+    const bool firstFrame = writer->firstFrame;
+    if(firstFrame)
+        GifWriteHeader(writer);
+    writer->firstFrame = false;
+
+    // only the rectangle that changed is written, as in GifWriteFrameFromSource
+    uint32_t left = 0, top = 0, right = width, bottom = height;
+    if(!firstFrame)
+    {
+        GIF_TRACE_BEGIN("GifChangedRect", 0);
+        const uint8_t* oldImage = writer->oldImage;
+        auto rowTest = [=](uint32_t yy)
+        {
+            const uint8_t* last = oldImage + 4*(size_t)yy*width;
+            const uint8_t* ind = indices + (size_t)yy*indexStride;
+            return [=](uint32_t xx)
+            {
+                const uint8_t* lastPix = last + 4*xx;
+                return lastPix[0] != pal->r[ind[xx]] || lastPix[1] != pal->g[ind[xx]] || lastPix[2] != pal->b[ind[xx]];
+            };
+        };
+        if(!GifFindChangedRect(width, height, rowTest, &left, &top, &right, &bottom))
+            right = bottom = 1;
+        GIF_TRACE_END("GifChangedRect", 0, width, height);
+    }
+    uint32_t rectWidth = right - left;
+    uint32_t rectHeight = bottom - top;
+
+    const uint8_t* rect = indices + (size_t)top*indexStride + left;
+    uint8_t* canvas = writer->oldImage + 4*((size_t)top*width + left);
+
+    // Unchanged pixels are made transparent if the rectangle leaves a palette slot free for it: an indexed frame can use
+    // every slot of its palette, so its transparent index has to be one it leaves free. Only as much of the palette as
+    // the rectangle's indices (and that slot) need is written.
+    bool used[256] = {};
+    int highestIndex = GifMarkUsedIndices(rect, indexStride, rectWidth, rectHeight, used);
+    int transIndex = -1;
+    for( int ind=0; ind<(1 << pal->bitDepth) && !firstFrame; ++ind )
+    {
+        if(used[ind]) continue;
+        transIndex = ind;
+        break;
+    }
+
+    GifPalette framePal = *pal;
+    framePal.cache = NULL;
+    framePal.bitDepth = 1;
+    while((1 << framePal.bitDepth) <= GifIMax(highestIndex, transIndex))
+        ++framePal.bitDepth;
+
+    GIF_TRACE_BEGIN("GifMapIndexedImage", 0);
+    GifMapIndexedImage(firstFrame? NULL : canvas, rect, indexStride, canvas, rectWidth, rectHeight, width, &framePal, transIndex);
+    GIF_TRACE_END("GifMapIndexedImage", 0, rectWidth, rectHeight);
+
+    return GifWriteCanvasRect(writer, left, top, rectWidth, rectHeight, delay, &framePal, transIndex, true);
+}
+
+// Fills in the palette of 8-bit grayscale frames: entry i is gray level i, so a grayscale image is its own index plane.
+void GifMakeGrayPalette( GifPalette* pPal )
+{
+    memset(pPal, 0, sizeof(GifPalette));
+    pPal->bitDepth = 8;
+    for(int ii=0; ii<256; ++ii)
+        pPal->r[ii] = pPal->g[ii] = pPal->b[ii] = (uint8_t)ii;
 }
 
-// Writes the EOF code, closes the file handle, and frees temp memory used by a GIF.
+// Writes out a new 8-bit grayscale frame (rows rowStride bytes apart), read in place and written exactly: with the
+// gray ramp as its palette it's an indexed frame, so there is nothing to quantize.
+bool GifWriteGrayFrame( GifWriter* writer, const uint8_t* image, uint32_t rowStride, uint32_t width, uint32_t height, uint32_t delay )
+{
+    GifPalette pal;
+    GifMakeGrayPalette(&pal);
+    return GifWriteIndexedFrame(writer, image, rowStride, &pal, width, height, delay);
+}
+
+// Writes out a new RGBA8 frame to a GIF in progress.
+bool GifWriteFrame( GifWriter* writer, const uint8_t* image, uint32_t width, uint32_t height, uint32_t delay, int bitDepth = 8, int dither = kGifDitherNone )
+{
+    GifFrameSource src;
+    GifFrameSourceRGBA(&src, image, width);
+    return GifWriteFrameFromSource(writer, &src, width, height, delay, bitDepth, dither);
+}
+
+// Writes the EOF code, closes the file handle (or hands over the memory of a GifBeginMemory gif), and frees temp
+// memory used by a GIF. Returns false if any of the GIF couldn't be written.
 // Many if not most viewers will still display a GIF properly if the EOF code is missing,
 // but it's still a good idea to write it out.
 bool GifEnd( GifWriter* writer )
 {
-    if(!writer->f) return false;
+    if(!writer->sink) return false;
 
-    fputc(0x3b, writer->f); // end of file
-    fclose(writer->f);
-    GIF_FREE(writer->oldImage);
+    GifFrameQueue* queue = writer->queue;
+    if(queue)
+    {
+        // let the encoder write the frames still queued, and wait for it
+        {
+            std::lock_guard<std::mutex> guard(queue->lock);
+            queue->closing = true;
+            queue->changed.notify_all();
+        }
+        queue->encoder.join();
+
+        for(uint32_t ii=queue->numFrames; ii-- > 0; )
+            GIF_FREE(queue->frames[ii].image);
+        GIF_FREE(queue->frames);
+        queue->~GifFrameQueue();
+        GIF_FREE(queue);
+        writer->queue = NULL;
+    }
 
-    writer->f = NULL;
+    if(writer->firstFrame)
+        GifWriteHeader(writer); // no frames at all
+    GifSinkPut(writer->sink, 0x3b); // end of file
+    bool ok = GifSinkClose(writer->sink);
+    GIF_FREE(writer->colorCache);
+    if(writer->oldImage) GIF_FREE(writer->oldImage);
+    if(writer->globalPalette) GIF_FREE(writer->globalPalette);
+    if(writer->ownedScratch) GIF_FREE(writer->ownedScratch);
+    if(writer->tiles)
+    {
+        for(int band=writer->tiles->numBands; band-- > 0; )
+        {
+            GIF_FREE(writer->tiles->sinks[band]->buffer);
+            GIF_FREE(writer->tiles->sinks[band]);
+        }
+        GIF_FREE(writer->tiles);
+    }
+
+    writer->sink = NULL;
     writer->oldImage = NULL;
+    writer->colorCache = NULL;
+    writer->globalPalette = NULL;
+    writer->ownedScratch = NULL;
+    writer->tiles = NULL;
 
-    return true;
+    return ok;
 }
 
 #endif
@@ -0,0 +1,94 @@
+/*++
+* Arminder Singh
+* CPE462 Image Processing Final Project
+* I pledge my Honor that I have abided by the Stevens Honor System.
+* - Arminder Singh
+--*/
+
+//
+// gif_output.h
+//
+// Animated GIF output straight from OpenCV Mats.
+//
+// gif.h reads every frame in place through a GifFrameSource (pointer, row stride, pixel stride and the offsets of the
+// red, green and blue samples), so BGR, BGRA and grayscale Mats are handed over as they are instead of being
+// converted to full RGBA copies first. This is the only file that includes gif.h (its functions aren't inline).
+// Frames are pipelined: each frame is LZW encoded and written on a separate thread while the next one is palettized.
+// After the first frame, only the rectangle around the pixels that changed is palettized and written, so mostly static
+// animations encode quickly and stay small.
+// The output is collected in large buffers, so a file is written in a few big writes; encode_gif keeps it in memory.
+// Optionally, large frames are cut into bands that are LZW encoded on all cores at once (see gif_output_options).
+// Frames that are an 8-bit image and a colormap go through write_indexed_gif, which keeps their colors exact and skips
+// the palette building and color matching altogether; grayscale frames get the same treatment with a gray ramp.
+//
+
+#ifndef gif_output_h
+#define gif_output_h
+
+#include <opencv2/opencv.hpp>
+#include "lut.h"
+
+//
+// Frame delay in hundredths of a second.
+//
+#define GIF_OUTPUT_DEFAULT_DELAY 100
+
+//
+// How colors outside the 256 color palette are approximated. Floyd-Steinberg looks best but carries error from pixel
+// to pixel; ordered dithering treats every pixel on its own, so it parallelizes perfectly and keeps unchanged pixels
+// transparent between frames.
+//
+typedef enum {
+	GIF_DITHER_NONE = 0,
+	GIF_DITHER_FLOYD_STEINBERG,
+	GIF_DITHER_ORDERED
+} gif_dither_mode;
+
+//
+// Where the colors of each frame come from. A local palette is built and written for every frame. A global palette is
+// built once from all the frames and written once, in the header, and each frame is only mapped onto it; that's
+// cheaper and smaller when the frames share their colors (like the color wheel's).
+//
+typedef enum {
+	GIF_PALETTE_LOCAL = 0,
+	GIF_PALETTE_GLOBAL
+} gif_palette_mode;
+
+//
+// How a GIF is written.
+//
+typedef struct {
+	unsigned int delay; // frame delay, GIF_OUTPUT_DEFAULT_DELAY by default.
+	gif_dither_mode dither; // no dithering by default.
+	gif_palette_mode palette; // a palette per frame by default.
+	bool tiled; // off by default. Writes each large frame as a stack of bands encoded in parallel; the bands before the last have no delay, which browsers stretch, so it's best for stills.
+} gif_output_options;
+
+//
+// Fills in the defaults above.
+//
+void gif_output_default_options(gif_output_options* options);
+
+//
+// Writes 'frames' (all the same size; CV_8UC1, CV_8UC3 BGR or CV_8UC4 BGRA) as an animated GIF at 'path'. If every
+// frame is CV_8UC1 they're written as exact gray levels, and options->dither and options->palette don't apply. With
+// local palettes, a frame whose changed pixels have at most 255 colors is written exactly (undithered), with a palette
+// of only as many bits as those colors need.
+// Returns 0 on success, -1 on bad frames or if the file couldn't be written.
+//
+int write_gif(const cv::String& path, const cv::Mat* frames, int num_frames, const gif_output_options* options);
+
+//
+// Like write_gif, but the GIF goes to 'buf' (like cv::imencode) instead of a file, e.g. to serve it without touching
+// the disk. Returns 0, or -1 (with 'buf' empty) on bad frames.
+//
+int encode_gif(const cv::Mat* frames, int num_frames, const gif_output_options* options, std::vector<uchar>& buf);
+
+//
+// Writes 'indices' (all the same size, CV_8UC1) as an animated GIF at 'path', with frame i colored by palettes[i]:
+// each pixel gets exactly the palette color its value picks, the way color_lut_apply colors it. options->dither and
+// options->palette don't apply. Returns 0 on success, -1 on bad frames or if the file couldn't be written.
+//
+int write_indexed_gif(const cv::String& path, const cv::Mat* indices, const color_lut* palettes, int num_frames, const gif_output_options* options);
+
+#endif
@@ -0,0 +1,66 @@
+/*++
+* Arminder Singh
+* CPE462 Image Processing Final Project
+* I pledge my Honor that I have abided by the Stevens Honor System.
+* - Arminder Singh
+--*/
+
+//
+// lut.h
+//
+// A tiny LUT "compiler" for 8-bit point operations.
+//
+// Any chain of per-pixel 8-bit -> 8-bit operations (histogram equalization, gamma, thresholds, ...) collapses into a
+// single 256-entry table, and a final colormap turns that into one 256-entry -> BGR table. The whole chain is then
+// applied to a channel with one gather pass, instead of one full pass per operation (e.g. cv::equalizeHist followed
+// by cv::applyColorMap). Adding more point operations later only changes the table, not the number of passes.
+//
+
+#ifndef lut_h
+#define lut_h
+
+#include <opencv2/opencv.hpp>
+
+//
+// 8-bit -> 8-bit table.
+//
+typedef struct {
+	uchar map[256];
+} point_lut;
+
+//
+// 8-bit -> BGR table, stored planar so each output channel can be gathered separately.
+//
+typedef struct {
+	uchar b[256];
+	uchar g[256];
+	uchar r[256];
+} color_lut;
+
+//
+// Resets a point table to the identity mapping.
+//
+void point_lut_identity(point_lut* lut);
+
+//
+// Appends an operation: afterwards lut maps v to next[old lut(v)].
+//
+void point_lut_chain(point_lut* lut, const uchar next[256]);
+
+//
+// The table OpenCV uses for one of its built-in colormaps (e.g. COLORMAP_HSV), for 8-bit single channel input.
+// Computed once per colormap per process.
+//
+const color_lut* colormap_lut(int colormap);
+
+//
+// Folds a point table into a colormap: out(v) = colormap(pre(v)). 'pre' may be NULL (identity).
+//
+void color_lut_compile(const point_lut* pre, const color_lut* colormap, color_lut* out);
+
+//
+// Applies a compiled table to an 8UC1 image, producing an 8UC3 BGR image in one pass.
+//
+void color_lut_apply(const cv::Mat& src, const color_lut* lut, cv::Mat& dst);
+
+#endif
@@ -0,0 +1,40 @@
+/*++
+* Arminder Singh
+* CPE462 Image Processing Final Project
+* I pledge my Honor that I have abided by the Stevens Honor System.
+* - Arminder Singh
+--*/
+
+//
+// rotation.h
+//
+// Rotation engine for the color wheel.
+//
+// Right angles (90/180/270) are pure memory permutations, so they are done exactly with cache-blocked
+// transpose/flip kernels and the output dimensions are swapped as needed; no interpolation, no cropping.
+// Every other angle uses a tiled, multi-threaded, fixed-point bilinear warp (same conventions as
+// cv::getRotationMatrix2D + cv::warpAffine: counter-clockwise, constant black border).
+//
+
+#ifndef rotation_h
+#define rotation_h
+
+#include <opencv2/opencv.hpp>
+
+typedef enum {
+	ROTATION_CANVAS_CROP = 0,   // arbitrary angles keep the input size, corners that leave the frame are cut off
+	ROTATION_CANVAS_EXPAND,     // arbitrary angles grow the canvas so the whole rotated image fits
+} rotation_canvas;
+
+//
+// Normalizes any (possibly negative) angle in degrees to [0, 360).
+//
+int normalize_rotation_angle(int angle_degrees);
+
+//
+// Rotates an 8-bit image with 1 to 4 channels by 'angle_degrees' counter-clockwise into 'dst'.
+// dst must not share memory with src. An effective angle of 0 just copies.
+//
+void rotate_image(const cv::Mat& src, cv::Mat& dst, int angle_degrees, rotation_canvas canvas);
+
+#endif
@@ -0,0 +1,50 @@
+/*++
+* Arminder Singh
+* CPE462 Image Processing Final Project
+* I pledge my Honor that I have abided by the Stevens Honor System.
+* - Arminder Singh
+--*/
+
+//
+// strip_stream.h
+//
+// Strip-streaming color wheel for inputs too big to decode in one go (e.g. 40k x 40k slide scans).
+//
+// The input is decoded a strip of scanlines at a time with libjpeg, each strip is pushed through channel extraction,
+// the compiled colormap LUTs and the channel mix, and the seven outputs are written by seven incremental libjpeg
+// encoders. Memory is a handful of strips, independent of the image height.
+//
+// Histogram equalization needs the whole-image histogram before the first strip can be mapped, so it is gathered by
+// a separate pre-pass that decodes at 1/4 scale (cheap, and the histogram shape is what matters). The equalization is
+// therefore very slightly different from the in-memory path.
+//
+// Rotation needs random access to the whole image and is not supported in this mode.
+//
+// Needs libjpeg (or libjpeg-turbo) headers and library, which the project doesn't set up: to build the mode in, add
+// their include and library paths (and jpeg.lib or turbojpeg.lib to the linker inputs) and define HAVE_LIBJPEG.
+// Without it the mode isn't built at all, and the program doesn't offer it. tests/test_strip_stream.cpp has a g++ line
+// that builds it in (with -DHAVE_LIBJPEG -ljpeg) and checks it against the whole-image transform.
+//
+
+#ifndef strip_stream_h
+#define strip_stream_h
+
+#include <opencv2/opencv.hpp>
+#include "color_wheel_pipeline.h"
+
+#ifdef HAVE_LIBJPEG
+
+//
+// Default strip height, two 4:2:0 MCU rows.
+//
+#define STRIP_STREAM_DEFAULT_ROWS 32
+
+//
+// Runs the color wheel on 'input', writing out_prefix + color_wheel_output_names[i].
+// Returns 0 on success, -1 on failure (unsupported options, unreadable input, or an output that couldn't be written).
+//
+int color_wheel_stream(const cv::String& input, const cv::String& out_prefix, const color_wheel_options* options, int strip_rows);
+
+#endif
+
+#endif
@@ -0,0 +1,103 @@
+/*++
+* Arminder Singh
+* CPE462 Image Processing Final Project
+* I pledge my Honor that I have abided by the Stevens Honor System.
+* - Arminder Singh
+--*/
+
+//
+// trace.h
+//
+// Opt-in tracing in the Chrome trace-event JSON format (load the file in chrome://tracing or ui.perfetto.dev).
+//
+// Spans are recorded as begin/end event pairs tagged with a small per-thread ID, and the end event can carry up to
+// TRACE_MAX_ARGS integer arguments (dimensions, byte counts, ...). Events are collected in memory and appended to the
+// file a few thousand at a time, so a long-lived process traces in bounded memory; trace_close() writes the rest and
+// finishes the file.
+//
+// Tracing is off unless trace_open() was called; a disabled span costs one relaxed atomic load, so the spans stay in
+// release builds.
+//
+// Span names and argument keys must be string literals (or otherwise outlive the trace), only the pointers are kept.
+// They are escaped when written, so any text will do.
+//
+
+#ifndef trace_h
+#define trace_h
+
+#include <stdio.h>
+#include <atomic>
+
+#define TRACE_MAX_ARGS 3
+
+extern std::atomic<bool> trace_active;
+
+static inline bool trace_enabled() {
+	return trace_active.load(std::memory_order_relaxed);
+}
+
+//
+// Starts collecting events into 'path', which stays open until trace_close(). Returns 0, or -1 if 'path' can't be
+// created (checked up front so a bad path doesn't lose a whole run's trace).
+//
+int trace_open(const char* path);
+
+//
+// Writes the collected events and stops tracing. Does nothing if tracing isn't on.
+//
+void trace_close();
+
+void trace_begin(const char* name);
+void trace_end(const char* name, int num_args, const char* const* keys, const long long* values);
+
+//
+// Scoped span: begins on construction, ends (with whatever arguments were attached) on destruction.
+//
+class trace_span {
+public:
+	explicit trace_span(const char* name) : name(name), active(trace_enabled()), num_args(0) {
+		if (active) {
+			trace_begin(name);
+		}
+	}
+	~trace_span() {
+		if (active) {
+			trace_end(name, num_args, keys, values);
+		}
+	}
+
+	trace_span(const trace_span&) = delete;
+	trace_span& operator=(const trace_span&) = delete;
+
+	void arg(const char* key, long long value) {
+		if (active && (num_args < TRACE_MAX_ARGS)) {
+			keys[num_args] = key;
+			values[num_args] = value;
+			num_args++;
+		}
+	}
+
+private:
+	const char* name;
+	bool active;
+	int num_args;
+	const char* keys[TRACE_MAX_ARGS];
+	long long values[TRACE_MAX_ARGS];
+};
+
+//
+// Hooks for gif.h: it calls GIF_TRACE_BEGIN/GIF_TRACE_END around the phases of every frame. Including this header
+// before gif.h routes them here; the byte count is the difference of the output offsets at the end and the start.
+//
+void trace_gif_begin(const char* name, unsigned long long offset);
+void trace_gif_end(const char* name, unsigned long long offset, unsigned int width, unsigned int height);
+
+#ifndef GIF_TRACE_BEGIN
+#define GIF_TRACE_BEGIN(name, offset) do { if (trace_enabled()) trace_gif_begin(name, offset); } while (0)
+#endif
+
+#ifndef GIF_TRACE_END
+#define GIF_TRACE_END(name, offset, width, height) do { if (trace_enabled()) trace_gif_end(name, offset, width, height); } while (0)
+#endif
+
+#endif
@@ -0,0 +1,92 @@
+/*++
+* Arminder Singh
+* CPE462 Image Processing Final Project
+* I pledge my Honor that I have abided by the Stevens Honor System.
+* - Arminder Singh
+--*/
+
+//
+// work_pool.h
+//
+// A small work-stealing thread pool used by the batch color wheel mode.
+//
+// Every worker owns a deque of tasks. A worker pushes and pops its own tasks at the back (LIFO, keeps the
+// data it just touched in cache) and, once its deque is empty, steals from the front of the other workers'
+// deques. Tasks submitted from outside the pool are spread round-robin over the workers.
+//
+// run_and_wait() lets a task fork sub-tasks (e.g. the three channels of one huge image) and help execute
+// queued work until they are done, so idle workers can steal pieces of a big job instead of waiting on it.
+//
+
+#ifndef work_pool_h
+#define work_pool_h
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class work_pool {
+public:
+	//
+	// num_workers == 0 means one worker per hardware thread.
+	//
+	explicit work_pool(unsigned int num_workers = 0);
+	~work_pool();
+
+	work_pool(const work_pool&) = delete;
+	work_pool& operator=(const work_pool&) = delete;
+
+	unsigned int size() const { return (unsigned int)queues.size(); } // queues is complete before the first worker starts
+
+	//
+	// Queues a task. Safe to call from any thread, including from inside a task.
+	//
+	void submit(std::function<void()> task);
+
+	//
+	// Runs all of 'tasks' and returns once they have finished. The calling thread executes work itself
+	// while it waits (its own tasks first, then anything it can steal), so this is safe to call from a task.
+	// If any of them threw, the first exception is rethrown once all of them have finished.
+	//
+	void run_and_wait(std::vector<std::function<void()>>& tasks);
+
+	//
+	// Blocks until every submitted task has finished. Must not be called from inside a task. If a submitted task
+	// threw since the last wait, the first such exception is rethrown here (a throwing task doesn't take its worker
+	// down).
+	//
+	void wait_idle();
+
+private:
+	typedef struct {
+		std::mutex lock;
+		std::deque<std::function<void()>> tasks;
+	} worker_queue;
+
+	bool pop_local(unsigned int index, std::function<void()>& task);
+	bool steal(unsigned int thief, std::function<void()>& task);
+	bool try_run_one(unsigned int index);
+	void push(unsigned int index, std::function<void()> task);
+	void worker_main(unsigned int index);
+	void task_finished();
+
+	std::vector<std::unique_ptr<worker_queue>> queues;
+	std::vector<std::thread> workers;
+
+	std::mutex idle_lock;                   // guards 'stopping' and the increments of 'queued'
+	std::condition_variable work_available;
+	std::condition_variable all_done;
+	std::atomic<size_t> queued;             // tasks sitting in a deque
+	std::atomic<size_t> pending;            // tasks submitted and not yet finished
+	std::atomic<unsigned int> next_queue;   // round-robin cursor for external submissions
+	std::exception_ptr first_error;         // first exception thrown by a submitted task since the last wait_idle, guarded by idle_lock
+	bool stopping;
+};
+
+#endif
@@ -0,0 +1,332 @@
+/*++
+* Arminder Singh
+* CPE462 Image Processing Final Project
+* I pledge my Honor that I have abided by the Stevens Honor System.
+* - Arminder Singh
+--*/
+
+#include <math.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <vector>
+#include <opencv2/opencv.hpp>
+#include "benchmark.h"
+#include "channel_view.h"
+#include "color_wheel_pipeline.h"
+#include "lut.h"
+#include "rotation.h"
+
+//
+// Inputs with more pixels than this get one warm-up run and a third of the repetitions (at least 3).
+//
+#define BENCHMARK_LARGE_PIXELS (4096LL * 4096LL)
+#define BENCHMARK_SMALLEST_SIDE 256
+
+typedef enum {
+	STAGE_DECODE = 0,
+	STAGE_WARP,
+	STAGE_SPLIT,
+	STAGE_EQUALIZE,
+	STAGE_COLORMAP,
+	STAGE_MERGE,
+	STAGE_ENCODE_FIRST, // one encode stage per output, in color_wheel_output order
+	STAGE_TOTAL = STAGE_ENCODE_FIRST + COLOR_WHEEL_OUT_MAX,
+	STAGE_MAX
+} benchmark_stage;
+
+static const char* const stage_names[STAGE_ENCODE_FIRST] = {
+	"decode",
+	"warp",
+	"split",
+	"equalize",
+	"colormap",
+	"merge",
+};
+
+typedef struct {
+	const char* name;
+	std::vector<uchar> encoded;
+	int width;
+	int height;
+} benchmark_input;
+
+//
+// Milliseconds since 'start' (a cv::getTickCount value).
+//
+static double elapsed_ms(int64 start) {
+	return (double)(cv::getTickCount() - start) * 1000.0 / cv::getTickFrequency();
+}
+
+//
+// Value at 'fraction' of the sorted samples, nearest rank (so p50 of an even count is the lower middle sample).
+//
+static double percentile(std::vector<double> samples, double fraction) {
+	size_t rank;
+
+	std::sort(samples.begin(), samples.end());
+	rank = (size_t)ceil(fraction * (double)samples.size());
+	if (rank > 0) {
+		rank--;
+	}
+	return samples[std::min(rank, samples.size() - 1)];
+}
+
+//
+// Gradients in every channel with some noise on top, deterministic for a given size.
+//
+static void make_synthetic_image(int side, cv::Mat& image) {
+	cv::RNG rng((uint64)side);
+
+	image.create(side, side, CV_8UC3);
+	for (int y = 0; y < side; y++) {
+		uchar* px = image.ptr<uchar>(y);
+		for (int x = 0; x < side; x++, px += 3) {
+			int noise = rng.uniform(-12, 13);
+			px[0] = cv::saturate_cast<uchar>((x * 255) / side + noise);
+			px[1] = cv::saturate_cast<uchar>((y * 255) / side - noise);
+			px[2] = cv::saturate_cast<uchar>(((x + y) * 127) / side + noise);
+		}
+	}
+}
+
+static bool read_file(const char* path, std::vector<uchar>& bytes) {
+	FILE* f = fopen(path, "rb");
+	long size;
+
+	if (f == NULL) {
+		return false;
+	}
+	fseek(f, 0, SEEK_END);
+	size = ftell(f);
+	fseek(f, 0, SEEK_SET);
+	if (size <= 0) {
+		fclose(f);
+		return false;
+	}
+	bytes.resize((size_t)size);
+	if (fread(bytes.data(), 1, bytes.size(), f) != bytes.size()) {
+		fclose(f);
+		return false;
+	}
+	fclose(f);
+	return true;
+}
+
+//
+// One pass of the color wheel with every stage timed, in the same order the real transform runs them. Each output is
+// encoded as soon as it exists and then dropped, which keeps the large synthetic inputs within memory.
+//
+static void run_once(const benchmark_input* input, int rotation_angle, bool do_histogram_equalization, double times[STAGE_MAX]) {
+	cv::Mat image, rotated, plane, colored;
+	std::vector<uchar> encoded;
+	uchar equalize_luts[3][256];
+	const uchar* mix_luts[3] = { equalize_luts[0], equalize_luts[1], equalize_luts[2] };
+	int64 start, total_start = cv::getTickCount();
+
+	memset(times, 0, sizeof(double) * STAGE_MAX);
+
+	start = cv::getTickCount();
+	cv::imdecode(input->encoded, cv::IMREAD_COLOR, &image);
+	times[STAGE_DECODE] = elapsed_ms(start);
+
+	if (rotation_angle != 0) {
+		start = cv::getTickCount();
+		rotate_image(image, rotated, rotation_angle, ROTATION_CANVAS_CROP);
+		image = rotated;
+		rotated.release();
+		times[STAGE_WARP] = elapsed_ms(start);
+	}
+
+	for (int i = 0; i < 3; i++) {
+		channel_view view = make_channel_view(image, i);
+		int channel_hist[256];
+		point_lut channel_ops;
+		color_lut channel_colormap;
+
+		start = cv::getTickCount();
+		channel_view_extract(view, plane, (do_histogram_equalization == true) ? channel_hist : NULL);
+		times[STAGE_SPLIT] += elapsed_ms(start);
+
+		start = cv::getTickCount();
+		cv::imencode(".jpg", plane, encoded);
+		times[STAGE_ENCODE_FIRST + COLOR_WHEEL_OUT_CH_1 + i] = elapsed_ms(start);
+
+		point_lut_identity(&channel_ops);
+		if (do_histogram_equalization == true) {
+			start = cv::getTickCount();
+			build_equalize_lut(channel_hist, view.rows * view.cols, equalize_luts[i]);
+			point_lut_chain(&channel_ops, equalize_luts[i]);
+			times[STAGE_EQUALIZE] += elapsed_ms(start);
+		}
+
+		start = cv::getTickCount();
+		color_lut_compile(&channel_ops, colormap_lut(cv::COLORMAP_HSV), &channel_colormap);
+		color_lut_apply(plane, &channel_colormap, colored);
+		times[STAGE_COLORMAP] += elapsed_ms(start);
+
+		start = cv::getTickCount();
+		cv::imencode(".jpg", colored, encoded);
+		times[STAGE_ENCODE_FIRST + COLOR_WHEEL_OUT_1 + i] = elapsed_ms(start);
+	}
+	plane.release();
+	colored.release();
+
+	start = cv::getTickCount();
+	permute_channels_inplace(image, color_wheel_mix_order(0), (do_histogram_equalization == true) ? mix_luts : NULL);
+	times[STAGE_MERGE] = elapsed_ms(start);
+
+	start = cv::getTickCount();
+	cv::imencode(".jpg", image, encoded);
+	times[STAGE_ENCODE_FIRST + COLOR_WHEEL_OUT_MIXED] = elapsed_ms(start);
+
+	times[STAGE_TOTAL] = elapsed_ms(total_start);
+}
+
+static const char* stage_name(int stage, char* buffer, size_t buffer_size) {
+	if (stage < STAGE_ENCODE_FIRST) {
+		return stage_names[stage];
+	}
+	if (stage == STAGE_TOTAL) {
+		return "total";
+	}
+
+	//
+	// "encode_out_ch_1" etc., from the output file name without its extension.
+	//
+	const char* output = color_wheel_output_names[stage - STAGE_ENCODE_FIRST];
+	const char* dot = strrchr(output, '.');
+	snprintf(buffer, buffer_size, "encode_%.*s", (int)((dot != NULL) ? dot - output : (ptrdiff_t)strlen(output)), output);
+	return buffer;
+}
+
+//
+// Input names are paths, which on Windows are full of backslashes.
+//
+static void write_json_string(FILE* json, const char* s) {
+	for (; *s != '\0'; s++) {
+		if ((*s == '"') || (*s == '\\')) {
+			fputc('\\', json);
+		}
+		fputc(*s, json);
+	}
+}
+
+static void run_case(FILE* json, bool first, const benchmark_input* input, int rotation_angle, bool do_histogram_equalization, int repetitions) {
+	std::vector<double> samples[STAGE_MAX];
+	double times[STAGE_MAX];
+	bool large = ((long long)input->width * input->height > BENCHMARK_LARGE_PIXELS);
+	int warmup = large ? 1 : BENCHMARK_DEFAULT_WARMUP;
+
+	if (large) {
+		repetitions = std::max(3, repetitions / 3);
+	}
+	printf("Info: benchmarking %s (%dx%d), rotation %d, equalization %s, %d repetitions\n", input->name, input->width, input->height,
+		rotation_angle, do_histogram_equalization ? "on" : "off", repetitions);
+
+	for (int i = 0; i < warmup; i++) {
+		run_once(input, rotation_angle, do_histogram_equalization, times);
+	}
+	for (int i = 0; i < repetitions; i++) {
+		run_once(input, rotation_angle, do_histogram_equalization, times);
+		for (int s = 0; s < STAGE_MAX; s++) {
+			samples[s].push_back(times[s]);
+		}
+	}
+
+	fprintf(json, "%s\n    {\n", first ? "" : ",");
+	fprintf(json, "      \"input\": \"");
+	write_json_string(json, input->name);
+	fprintf(json, "\",\n");
+	fprintf(json, "      \"width\": %d,\n      \"height\": %d,\n", input->width, input->height);
+	fprintf(json, "      \"rotation\": %d,\n      \"equalize\": %s,\n", rotation_angle, do_histogram_equalization ? "true" : "false");
+	fprintf(json, "      \"warmup\": %d,\n      \"repetitions\": %d,\n", warmup, repetitions);
+	fprintf(json, "      \"stages\": {");
+	for (int s = 0; s < STAGE_MAX; s++) {
+		char name[64];
+		fprintf(json, "%s\n        \"%s\": { \"median_ms\": %.3f, \"p95_ms\": %.3f }", (s == 0) ? "" : ",",
+			stage_name(s, name, sizeof(name)), percentile(samples[s], 0.5), percentile(samples[s], 0.95));
+	}
+	fprintf(json, "\n      }\n    }");
+	fflush(json);
+}
+
+int color_wheel_benchmark(const cv::String& test_image, const cv::String& json_path, int repetitions, int max_side) {
+	std::vector<benchmark_input> inputs;
+	std::vector<cv::String> synthetic_names;
+	static const int rotations[2] = { 0, BENCHMARK_ROTATION_ANGLE };
+	FILE* json;
+	bool first = true;
+
+	if (repetitions <= 0) {
+		repetitions = BENCHMARK_DEFAULT_REPETITIONS;
+	}
+	if (max_side <= 0) {
+		max_side = BENCHMARK_DEFAULT_MAX_SIDE;
+	}
+
+	//
+	// The test image is decoded from its original bytes; the synthetic ones are JPEG encoded once up front.
+	//
+	{
+		benchmark_input input;
+		cv::Mat image;
+
+		if (!read_file(test_image.c_str(), input.encoded)) {
+			printf("Error: can't read the benchmark image %s!\n", test_image.c_str());
+			return -1;
+		}
+		cv::imdecode(input.encoded, cv::IMREAD_COLOR, &image);
+		if (image.empty()) {
+			printf("Error: OpenCV can't parse the benchmark image %s!\n", test_image.c_str());
+			return -1;
+		}
+		input.name = test_image.c_str();
+		input.width = image.cols;
+		input.height = image.rows;
+		inputs.push_back(input);
+	}
+	for (int side = BENCHMARK_SMALLEST_SIDE; side <= max_side; side *= 2) {
+		char name[64];
+		snprintf(name, sizeof(name), "synthetic_%dx%d", side, side);
+		synthetic_names.push_back(name);
+	}
+	for (int side = BENCHMARK_SMALLEST_SIDE, i = 0; side <= max_side; side *= 2, i++) {
+		benchmark_input input;
+		cv::Mat image;
+
+		make_synthetic_image(side, image);
+		cv::imencode(".jpg", image, input.encoded);
+		input.name = synthetic_names[i].c_str();
+		input.width = side;
+		input.height = side;
+		inputs.push_back(input);
+	}
+
+	json = fopen(json_path.c_str(), "w");
+	if (json == NULL) {
+		printf("Error: couldn't write %s!\n", json_path.c_str());
+		return -1;
+	}
+
+	fprintf(json, "{\n  \"benchmark\": \"color_wheel\",\n  \"threads\": %d,\n  \"results\": [", cv::getNumThreads());
+	for (size_t i = 0; i < inputs.size(); i++) {
+		for (int r = 0; r < 2; r++) {
+			for (int eq = 0; eq < 2; eq++) {
+				run_case(json, first, &inputs[i], rotations[r], (eq != 0), repetitions);
+				first = false;
+			}
+		}
+		//
+		// Done with this input, don't keep large encoded images around for the rest of the sweep.
+		//
+		std::vector<uchar>().swap(inputs[i].encoded);
+	}
+	fprintf(json, "\n  ]\n}\n");
+
+	fclose(json);
+	printf("Info: benchmark results written to %s\n", json_path.c_str());
+	return 0;
+}
@@ -0,0 +1,136 @@
+/*++
+* Arminder Singh
+* CPE462 Image Processing Final Project
+* I pledge my Honor that I have abided by the Stevens Honor System.
+* - Arminder Singh
+--*/
+
+#include <string.h>
+#include <opencv2/opencv.hpp>
+#include <opencv2/core/hal/intrin.hpp>
+#include "channel_view.h"
+
+channel_view make_channel_view(cv::Mat& image, int channel) {
+	channel_view view;
+
+	CV_Assert(image.depth() == CV_8U && channel >= 0 && channel < image.channels());
+
+	view.data = image.data + channel;
+	view.rows = image.rows;
+	view.cols = image.cols;
+	view.row_step = image.step[0];
+	view.pixel_step = image.channels();
+	return view;
+}
+
+void channel_view_extract(const channel_view& view, cv::Mat& plane, int* hist) {
+	//
+	// Only reallocate when the caller's plane doesn't already fit, so one plane can be reused for all channels.
+	//
+	plane.create(view.rows, view.cols, CV_8UC1);
+	if (hist != NULL) {
+		memset(hist, 0, 256 * sizeof(int));
+	}
+
+	for (int y = 0; y < view.rows; y++) {
+		const uchar* src = view.data + y * view.row_step;
+		uchar* dst = plane.ptr<uchar>(y);
+		if (hist != NULL) {
+			for (int x = 0; x < view.cols; x++) {
+				uchar v = src[x * view.pixel_step];
+				dst[x] = v;
+				hist[v]++;
+			}
+		}
+		else {
+			for (int x = 0; x < view.cols; x++) {
+				dst[x] = src[x * view.pixel_step];
+			}
+		}
+	}
+}
+
+void build_equalize_lut(const int hist[256], int total, uchar lut[256]) {
+	int i = 0;
+	int sum = 0;
+	float scale;
+
+	memset(lut, 0, 256);
+	if (total <= 0) {
+		return;
+	}
+	while (hist[i] == 0) {
+		i++;
+	}
+	if (hist[i] == total) {
+		//
+		// Single-valued channel, cv::equalizeHist leaves every pixel at that value.
+		//
+		memset(lut, i, 256);
+		return;
+	}
+
+	//
+	// Mirrors the cumulative-histogram mapping in cv::equalizeHist so the output is bit-identical.
+	//
+	scale = (256 - 1.f) / (total - hist[i]);
+	lut[i++] = 0;
+	for (; i < 256; i++) {
+		sum += hist[i];
+		lut[i] = cv::saturate_cast<uchar>(sum * scale);
+	}
+}
+
+void permute_channels_inplace(cv::Mat& image, const int order[3], const uchar* const* luts) {
+	CV_Assert(image.type() == CV_8UC3);
+	CV_Assert(order[0] >= 0 && order[0] < 3 && order[1] >= 0 && order[1] < 3 && order[2] >= 0 && order[2] < 3);
+
+	for (int y = 0; y < image.rows; y++) {
+		uchar* row = image.ptr<uchar>(y);
+		int x = 0;
+
+		if (luts != NULL) {
+			//
+			// Equalization folded into the shuffle, one table lookup per sample.
+			//
+			const uchar* lut_0 = luts[order[0]];
+			const uchar* lut_1 = luts[order[1]];
+			const uchar* lut_2 = luts[order[2]];
+			for (; x < image.cols; x++) {
+				uchar* px = row + x * 3;
+				uchar c0 = lut_0[px[order[0]]];
+				uchar c1 = lut_1[px[order[1]]];
+				uchar c2 = lut_2[px[order[2]]];
+				px[0] = c0;
+				px[1] = c1;
+				px[2] = c2;
+			}
+			continue;
+		}
+
+#if CV_SIMD
+		//
+		// Deinterleave a vector's worth of pixels, then store the planes back interleaved in the new order.
+		// Each block is fully loaded before it is stored, so working in place is safe.
+		//
+		const int lanes = cv::v_uint8::nlanes;
+		for (; x <= image.cols - lanes; x += lanes) {
+			cv::v_uint8 planes[3];
+			cv::v_load_deinterleave(row + x * 3, planes[0], planes[1], planes[2]);
+			cv::v_store_interleave(row + x * 3, planes[order[0]], planes[order[1]], planes[order[2]]);
+		}
+#endif
+		for (; x < image.cols; x++) {
+			uchar* px = row + x * 3;
+			uchar c0 = px[order[0]];
+			uchar c1 = px[order[1]];
+			uchar c2 = px[order[2]];
+			px[0] = c0;
+			px[1] = c1;
+			px[2] = c2;
+		}
+	}
+#if CV_SIMD
+	cv::vx_cleanup();
+#endif
+}
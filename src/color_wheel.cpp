@@ -0,0 +1,124 @@
+/*++
+* Arminder Singh
+* CPE462 Image Processing Final Project
+* I pledge my Honor that I have abided by the Stevens Honor System.
+* - Arminder Singh
+--*/
+
+#include <stdio.h>
+#include <atomic>
+#include <opencv2/opencv.hpp>
+#include "color_wheel.h"
+#include "color_wheel_pipeline.h"
+
+void color_wheel_default_options(color_wheel_options* options) {
+	options->rotation_angle = 0;
+	options->do_histogram_equalization = false;
+	options->canvas = ROTATION_CANVAS_CROP;
+	options->mix_seed = 0;
+}
+
+//
+// The transform consumes its input and turns it into the mixed output, so the working image simply lives in the
+// mixed slot of 'out'; the other outputs use the remaining slots as storage.
+//
+static int run_transform(const color_wheel_options* options, color_wheel_images* out) {
+	try {
+		color_wheel_transform(out->images[COLOR_WHEEL_OUT_MIXED], options, out->images, [](color_wheel_output, const cv::Mat&) {});
+	}
+	catch (const cv::Exception& ex) {
+		printf("Error: OpenCV failed on the color wheel: %s\n", ex.what());
+		return -1;
+	}
+	return 0;
+}
+
+int color_wheel_process(const cv::Mat& input, const color_wheel_options* options, color_wheel_images* out) {
+	cv::Mat& working = out->images[COLOR_WHEEL_OUT_MIXED];
+
+	if (input.empty() || (input.depth() != CV_8U)) {
+		printf("Error: the color wheel needs a non-empty 8-bit image!\n");
+		return -1;
+	}
+	try {
+		switch (input.channels()) {
+			case 1:
+				cv::cvtColor(input, working, cv::COLOR_GRAY2BGR);
+				break;
+			case 3:
+				input.copyTo(working);
+				break;
+			case 4:
+				cv::cvtColor(input, working, cv::COLOR_BGRA2BGR);
+				break;
+			default:
+				printf("Error: the color wheel needs a 1, 3 or 4 channel image!\n");
+				return -1;
+		}
+	}
+	catch (const cv::Exception& ex) {
+		printf("Error: OpenCV failed on the color wheel input: %s\n", ex.what());
+		return -1;
+	}
+	return run_transform(options, out);
+}
+
+int color_wheel_process_in_place(const color_wheel_options* options, color_wheel_images* out) {
+	if (out->images[COLOR_WHEEL_OUT_MIXED].empty() || (out->images[COLOR_WHEEL_OUT_MIXED].type() != CV_8UC3)) {
+		printf("Error: the color wheel needs a non-empty BGR8 image!\n");
+		return -1;
+	}
+	return run_transform(options, out);
+}
+
+int color_wheel_process_buffer(const uchar* data, size_t size, const color_wheel_options* options, color_wheel_images* out) {
+	cv::Mat& working = out->images[COLOR_WHEEL_OUT_MIXED];
+
+	if ((data == NULL) || (size == 0)) {
+		printf("Error: empty color wheel input buffer!\n");
+		return -1;
+	}
+	try {
+		//
+		// Wrap the caller's bytes without copying them.
+		//
+		cv::Mat encoded(1, (int)size, CV_8UC1, (void*)data);
+		cv::imdecode(encoded, cv::IMREAD_COLOR, &working);
+	}
+	catch (const cv::Exception& ex) {
+		printf("Error: OpenCV failed decoding the color wheel input: %s\n", ex.what());
+		return -1;
+	}
+	if (working.empty()) {
+		printf("Error: OpenCV can't parse the input buffer!\n");
+		return -1;
+	}
+	return run_transform(options, out);
+}
+
+int color_wheel_encode(const color_wheel_images* images, const char* ext, const std::vector<int>& params, color_wheel_encoded* out) {
+	std::atomic<int> failures(0);
+
+	cv::parallel_for_(cv::Range(0, COLOR_WHEEL_OUT_MAX), [&](const cv::Range& range) {
+		for (int i = range.start; i < range.end; i++) {
+			try {
+				if (!cv::imencode(ext, images->images[i], out->buffers[i], params)) {
+					printf("Error: couldn't encode %s!\n", color_wheel_output_names[i]);
+					failures++;
+				}
+			}
+			catch (const cv::Exception& ex) {
+				printf("Error: OpenCV failed encoding %s: %s\n", color_wheel_output_names[i], ex.what());
+				failures++;
+			}
+		}
+	});
+	return (failures == 0) ? 0 : -1;
+}
+
+int color_wheel_process_encoded(const uchar* data, size_t size, const color_wheel_options* options, const char* ext, color_wheel_images* scratch, color_wheel_encoded* out) {
+	if (color_wheel_process_buffer(data, size, options, scratch) != 0) {
+		return -1;
+	}
+	return color_wheel_encode(scratch, ext, std::vector<int>(), out);
+}
@@ -0,0 +1,294 @@
+/*++
+* Arminder Singh
+* CPE462 Image Processing Final Project
+* I pledge my Honor that I have abided by the Stevens Honor System.
+* - Arminder Singh
+--*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <opencv2/opencv.hpp>
+#include "channel_view.h"
+#include "color_wheel_pipeline.h"
+#include "lut.h"
+#include "rotation.h"
+#include "trace.h"
+
+using namespace cv;
+
+const char* const color_wheel_output_names[COLOR_WHEEL_OUT_MAX] = {
+	"out_ch_1.jpg",
+	"out_ch_2.jpg",
+	"out_ch_3.jpg",
+	"out_1.jpg",
+	"out_2.jpg",
+	"out_3.jpg",
+	"out_mixed.jpg",
+};
+
+//
+// How many jobs each queue may hold. Decoded images are big, so only a couple are allowed to wait for a transformer;
+// encode jobs are allowed two images' worth of outputs per transformer so the encoder pool never starves.
+//
+#define INPUT_QUEUE_DEPTH   64
+#define DECODED_QUEUE_DEPTH 2
+#define ENCODE_QUEUE_DEPTH  (2 * COLOR_WHEEL_OUT_MAX)
+
+const int* color_wheel_mix_order(unsigned int mix_seed) {
+	static const int channel_orders[3][3] = {
+		{ 0, 2, 1 },
+		{ 1, 2, 0 },
+		{ 2, 0, 1 },
+	};
+	//
+	// A local generator instead of rand(), so callers never share (or race on) hidden global state.
+	//
+	cv::RNG rng(mix_seed);
+
+	return channel_orders[rng.uniform(0, 3)];
+}
+
+void color_wheel_transform(cv::Mat& image, const color_wheel_options* options, cv::Mat* storage, const std::function<void(color_wheel_output, const cv::Mat&)>& emit) {
+	Mat image_out_temp;
+	uchar equalize_luts[3][256];
+	bool do_histogram_equalization = options->do_histogram_equalization;
+	int rotation_angle = normalize_rotation_angle(options->rotation_angle);
+
+	//
+	// The test vector is a BGR8 image, no alpha channel, note that the results of the following might change dependent on source image's color space.
+	//
+	
+	//
+	// Orient the image as needed. (To keep the code simple, this must always remain the first transform)
+	//
+	//
+	// if we have an effective angle of 0 (that is, after doing mod 360 on the angle), we know we aren't rotating, so this code should be skipped for speed reasons in that case.
+	// Right angles are exact permutations that swap the output dimensions; anything else is a bilinear warp,
+	// optionally onto an expanded canvas.
+	//
+	if (rotation_angle != 0) {
+		trace_span span("rotate_image");
+		span.arg("width", image.cols);
+		span.arg("height", image.rows);
+		span.arg("angle", rotation_angle);
+		rotate_image(image, image_out_temp, rotation_angle, options->canvas);
+
+		//
+		// Drop the unrotated input as soon as we're done with it so only one interleaved copy is alive from here on.
+		//
+		image = image_out_temp;
+		image_out_temp.release();
+	}
+
+	//
+	// Walk the channels through strided views of the interleaved image instead of cv::split-ing three planar copies.
+	// Every output gets its own Mat, since the encoders may still be reading it while the next one is built.
+	// (Either a fresh one, or the caller's warm storage for that output.)
+	// The equalization LUTs are kept around so they can be folded into the channel mix at the end.
+	//
+	for (int i = 0; i < 3; i++) {
+		channel_view view = make_channel_view(image, i);
+		Mat local_plane, local_hsv;
+		Mat& channel_plane = (storage != NULL) ? storage[COLOR_WHEEL_OUT_CH_1 + i] : local_plane; // (TODO: could we determine color space of the image in a future iteration to make these R, G, B?)
+		Mat& hsv_channel_out = (storage != NULL) ? storage[COLOR_WHEEL_OUT_1 + i] : local_hsv;
+		int channel_hist[256];
+		point_lut channel_ops;
+		color_lut channel_colormap;
+
+		//
+		// extract the image channel, and hand it to the encoders.
+		//
+		{
+			trace_span span("channel_extract");
+			span.arg("width", view.cols);
+			span.arg("height", view.rows);
+			span.arg("channel", i);
+			channel_view_extract(view, channel_plane, (do_histogram_equalization == true) ? channel_hist : NULL);
+		}
+		emit((color_wheel_output)(COLOR_WHEEL_OUT_CH_1 + i), channel_plane);
+
+		//
+		// Do histogram equalization on the channel, if the user requested it, then apply the colormap.
+		// Both are point operations, so they are compiled into one 256-entry -> BGR table and applied in a single
+		// pass that reads the (unmodified) plane, which the encoders may still be reading.
+		//
+		{
+			trace_span span("equalize_colormap");
+			span.arg("width", view.cols);
+			span.arg("height", view.rows);
+			span.arg("channel", i);
+			point_lut_identity(&channel_ops);
+			if (do_histogram_equalization == true) {
+				build_equalize_lut(channel_hist, view.rows * view.cols, equalize_luts[i]);
+				point_lut_chain(&channel_ops, equalize_luts[i]);
+			}
+			color_lut_compile(&channel_ops, colormap_lut(COLORMAP_HSV), &channel_colormap);
+			color_lut_apply(channel_plane, &channel_colormap, hsv_channel_out);
+		}
+		emit((color_wheel_output)(COLOR_WHEEL_OUT_1 + i), hsv_channel_out);
+	}
+
+	//
+	// Mix the channels from earlier into a new BGR8 image.
+	// The working image is no longer needed, so the channels are shuffled (and equalized, if requested) in place.
+	//
+
+	const uchar* mix_luts[3] = { equalize_luts[0], equalize_luts[1], equalize_luts[2] };
+
+	{
+		trace_span span("channel_mix");
+		span.arg("width", image.cols);
+		span.arg("height", image.rows);
+		permute_channels_inplace(image, color_wheel_mix_order(options->mix_seed), (do_histogram_equalization == true) ? mix_luts : NULL);
+	}
+	emit(COLOR_WHEEL_OUT_MIXED, image);
+}
+
+color_wheel_pipeline::color_wheel_pipeline(const color_wheel_options* options, unsigned int transform_workers, unsigned int encode_workers) :
+	options(*options),
+	input_queue(INPUT_QUEUE_DEPTH),
+	decoded_queue(DECODED_QUEUE_DEPTH),
+	encode_queue(ENCODE_QUEUE_DEPTH * (transform_workers > 0 ? transform_workers : 1)),
+	encoders(encode_workers),
+	failures(0),
+	images_added(0),
+	finished(false) {
+	if (transform_workers == 0) {
+		transform_workers = 1;
+	}
+
+	decoder = std::thread(&color_wheel_pipeline::decode_main, this);
+	for (unsigned int i = 0; i < transform_workers; i++) {
+		transformers.emplace_back(&color_wheel_pipeline::transform_main, this);
+	}
+}
+
+color_wheel_pipeline::~color_wheel_pipeline() {
+	finish();
+}
+
+void color_wheel_pipeline::add(const cv::String& input, const cv::String& out_prefix) {
+	input_job job;
+
+	job.input = input;
+	job.out_prefix = out_prefix;
+	job.mix_seed = options.mix_seed + images_added++;
+	input_queue.push(std::move(job));
+}
+
+//
+// Decode stage: one thread, imread straight into the bounded decoded queue.
+//
+void color_wheel_pipeline::decode_main() {
+	input_job job;
+
+	while (input_queue.pop(job)) {
+		decoded_job decoded;
+
+		//
+		// imread throws on some broken files instead of returning an empty Mat; either way the image fails, and the
+		// decoder goes on with the next one.
+		//
+		try {
+			trace_span span("imread");
+			decoded.image = imread(job.input, cv::IMREAD_COLOR);
+			span.arg("width", decoded.image.cols);
+			span.arg("height", decoded.image.rows);
+		}
+		catch (const cv::Exception& ex) {
+			printf("Error: OpenCV failed reading %s: %s\n", job.input.c_str(), ex.what());
+			failures++;
+			continue;
+		}
+		if (decoded.image.empty()) {
+			printf("Error: OpenCV can't parse the input file %s!\n", job.input.c_str());
+			failures++;
+			continue;
+		}
+		decoded.input = job.input;
+		decoded.out_prefix = job.out_prefix;
+		decoded.mix_seed = job.mix_seed;
+		decoded_queue.push(std::move(decoded));
+	}
+	decoded_queue.close();
+}
+
+//
+// Transform stage: each output is queued for encoding the moment it exists, and one encoder task is submitted
+// per queued output. The encode queue is bounded, so a transformer that gets ahead of the encoders waits here.
+//
+void color_wheel_pipeline::transform_main() {
+	decoded_job job;
+	color_wheel_options image_options = options;
+
+	while (decoded_queue.pop(job)) {
+		image_options.mix_seed = job.mix_seed;
+		try {
+			color_wheel_transform(job.image, &image_options, NULL, [&](color_wheel_output output, const cv::Mat& result) {
+				encode_job encode;
+				encode.path = job.out_prefix + color_wheel_output_names[output];
+				encode.image = result;
+				encode_queue.push(std::move(encode));
+				encoders.submit([this] { encode_one(); });
+			});
+		}
+		catch (const cv::Exception& ex) {
+			printf("Error: OpenCV failed on %s: %s\n", job.input.c_str(), ex.what());
+			failures++;
+		}
+		job.image.release();
+	}
+}
+
+//
+// Encode stage: runs on the encoder pool, writes one queued output.
+//
+void color_wheel_pipeline::encode_one() {
+	encode_job job;
+
+	if (!encode_queue.try_pop(job)) {
+		return;
+	}
+	try {
+		trace_span span("imwrite");
+		span.arg("width", job.image.cols);
+		span.arg("height", job.image.rows);
+		span.arg("channels", job.image.channels());
+		if (!cv::imwrite(job.path, job.image)) {
+			printf("Error: couldn't write %s!\n", job.path.c_str());
+			failures++;
+		}
+	}
+	catch (const cv::Exception& ex) {
+		printf("Error: OpenCV failed writing %s: %s\n", job.path.c_str(), ex.what());
+		failures++;
+	}
+}
+
+int color_wheel_pipeline::finish() {
+	if (!finished) {
+		finished = true;
+
+		//
+		// Drain the stages front to back: closing the input queue ends the decoder, which closes the decoded queue
+		// and ends the transformers. Every encode job they queued has a matching encoder task.
+		//
+		input_queue.close();
+		decoder.join();
+		for (size_t i = 0; i < transformers.size(); i++) {
+			transformers[i].join();
+		}
+		//
+		// encode_one handles OpenCV's errors itself; anything else an encoder threw comes back here.
+		//
+		try {
+			encoders.wait_idle();
+		}
+		catch (const std::exception& ex) {
+			printf("Error: an encoder failed: %s\n", ex.what());
+			failures++;
+		}
+		encode_queue.close();
+	}
+	return failures;
+}
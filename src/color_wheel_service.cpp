@@ -0,0 +1,530 @@
+/*++
+* Arminder Singh
+* CPE462 Image Processing Final Project
+* I pledge my Honor that I have abided by the Stevens Honor System.
+* - Arminder Singh
+--*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <opencv2/opencv.hpp>
+#include "color_wheel_pipeline.h"
+#include "color_wheel_service.h"
+#include "work_pool.h"
+
+//
+// Socket portability layer. Windows has AF_UNIX sockets through winsock (afunix.h), everything else is POSIX.
+//
+#ifdef _WIN32
+#include <winsock2.h>
+#include <afunix.h>
+#ifdef _MSC_VER
+#pragma comment(lib, "Ws2_32.lib")
+#endif
+typedef SOCKET socket_handle;
+#define close_socket closesocket
+#define SHUTDOWN_READ SD_RECEIVE
+#define SEND_FLAGS 0
+#else
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+typedef int socket_handle;
+#define INVALID_SOCKET (-1)
+#define close_socket close
+#define SHUTDOWN_READ SHUT_RD
+#ifdef MSG_NOSIGNAL
+#define SEND_FLAGS MSG_NOSIGNAL // a client hanging up must not SIGPIPE the whole service
+#else
+#define SEND_FLAGS 0
+#endif
+#endif
+
+#define SERVICE_READ_BUFFER_SIZE (64 * 1024)
+#define SERVICE_MAX_LINE 4096
+#define SERVICE_LISTEN_BACKLOG 64
+#define SERVICE_ACCEPT_BACKOFF_MS 10 // first wait after a failed accept(), doubled on every failure in a row
+#define SERVICE_ACCEPT_BACKOFF_MAX_MS 1000
+
+//
+// State shared by the accept loop and every connection.
+//
+typedef struct {
+	cv::String socket_path;
+	work_pool* encoders;
+	std::atomic<bool> stopping;
+	std::mutex lock; // guards open_connections
+	std::vector<socket_handle> open_connections;
+} service_state;
+
+//
+// Buffered reader over a connection, so header lines don't cost a recv() per byte.
+//
+typedef struct {
+	socket_handle fd;
+	std::vector<char> buffer;
+	size_t start;
+	size_t end;
+} connection_reader;
+
+//
+// Everything a connection keeps warm between requests.
+//
+typedef struct {
+	std::vector<uchar> input_bytes;
+	cv::Mat decoded;
+	cv::Mat outputs[COLOR_WHEEL_OUT_MAX];
+	std::vector<uchar> encoded[COLOR_WHEEL_OUT_MAX];
+	cv::String paths[COLOR_WHEEL_OUT_MAX];
+} connection_buffers;
+
+static bool reader_fill(connection_reader* reader) {
+	int got;
+
+	if (reader->start == reader->end) {
+		reader->start = reader->end = 0;
+	}
+	if (reader->end == reader->buffer.size()) {
+		return false;
+	}
+	got = (int)recv(reader->fd, reader->buffer.data() + reader->end, (int)(reader->buffer.size() - reader->end), 0);
+	if (got <= 0) {
+		return false;
+	}
+	reader->end += (size_t)got;
+	return true;
+}
+
+//
+// Reads one '\n'-terminated line (without the terminator, '\r' stripped). False on EOF, error or an over-long line.
+//
+static bool read_line(connection_reader* reader, std::string& line) {
+	line.clear();
+	for (;;) {
+		while (reader->start < reader->end) {
+			char c = reader->buffer[reader->start++];
+			if (c == '\n') {
+				if (!line.empty() && line[line.size() - 1] == '\r') {
+					line.erase(line.size() - 1);
+				}
+				return true;
+			}
+			if (line.size() >= SERVICE_MAX_LINE) {
+				return false;
+			}
+			line.push_back(c);
+		}
+		if (!reader_fill(reader)) {
+			return false;
+		}
+	}
+}
+
+static bool read_exact(connection_reader* reader, uchar* dst, size_t count) {
+	//
+	// Whatever is already buffered first, then straight into the destination.
+	//
+	size_t buffered = reader->end - reader->start;
+	size_t from_buffer = (buffered < count) ? buffered : count;
+
+	memcpy(dst, reader->buffer.data() + reader->start, from_buffer);
+	reader->start += from_buffer;
+	dst += from_buffer;
+	count -= from_buffer;
+
+	while (count > 0) {
+		int chunk = (count > (1u << 30)) ? (1 << 30) : (int)count;
+		int got = (int)recv(reader->fd, (char*)dst, chunk, 0);
+		if (got <= 0) {
+			return false;
+		}
+		dst += got;
+		count -= (size_t)got;
+	}
+	return true;
+}
+
+static bool send_all(socket_handle fd, const void* data, size_t count) {
+	const char* src = (const char*)data;
+
+	while (count > 0) {
+		int chunk = (count > (1u << 30)) ? (1 << 30) : (int)count;
+		int sent = (int)send(fd, src, chunk, SEND_FLAGS);
+		if (sent <= 0) {
+			return false;
+		}
+		src += sent;
+		count -= (size_t)sent;
+	}
+	return true;
+}
+
+static bool send_string(socket_handle fd, const std::string& s) {
+	return send_all(fd, s.data(), s.size());
+}
+
+static bool send_error(socket_handle fd, const char* message) {
+	return send_string(fd, std::string("ERR ") + message + "\n");
+}
+
+static bool make_address(const char* socket_path, struct sockaddr_un* addr) {
+	memset(addr, 0, sizeof(*addr));
+	addr->sun_family = AF_UNIX;
+	if (strlen(socket_path) >= sizeof(addr->sun_path)) {
+		return false;
+	}
+	strncpy(addr->sun_path, socket_path, sizeof(addr->sun_path) - 1);
+	return true;
+}
+
+//
+// Connects to our own socket so a blocked accept() returns and notices the service is stopping.
+//
+static void wake_listener(const char* socket_path) {
+	struct sockaddr_un addr;
+	socket_handle fd = socket(AF_UNIX, SOCK_STREAM, 0);
+
+	if (fd == INVALID_SOCKET) {
+		return;
+	}
+	if (make_address(socket_path, &addr)) {
+		connect(fd, (struct sockaddr*)&addr, sizeof(addr));
+	}
+	close_socket(fd);
+}
+
+//
+// The encoder tasks of one request. They point into run_request's frame, so it must not return (or unwind, when the
+// transform throws halfway through) while one of them is still queued or running; the destructor waits for them.
+//
+class pending_encodes {
+public:
+	pending_encodes() : remaining(0), failed(false) {}
+	~pending_encodes() {
+		wait();
+	}
+
+	pending_encodes(const pending_encodes&) = delete;
+	pending_encodes& operator=(const pending_encodes&) = delete;
+
+	void started() {
+		std::lock_guard<std::mutex> guard(lock);
+		remaining++;
+	}
+
+	void finished(bool ok) {
+		std::lock_guard<std::mutex> guard(lock);
+		if (!ok) {
+			failed = true;
+		}
+		if (--remaining == 0) {
+			done.notify_all();
+		}
+	}
+
+	//
+	// Blocks until every started task has finished. Returns false if any of them failed.
+	//
+	bool wait() {
+		std::unique_lock<std::mutex> guard(lock);
+		done.wait(guard, [this] { return remaining == 0; });
+		return !failed;
+	}
+
+private:
+	std::mutex lock;
+	std::condition_variable done;
+	int remaining;
+	bool failed;
+};
+
+//
+// Runs the transform on 'buffers->decoded' and encodes (or writes) all seven outputs on the encoder pool, each one
+// as soon as the transform emits it. Returns false if any output failed.
+//
+static bool run_request(service_state* state, connection_buffers* buffers, const color_wheel_options* options, bool in_memory) {
+	pending_encodes encodes;
+
+	color_wheel_transform(buffers->decoded, options, buffers->outputs, [&](color_wheel_output output, const cv::Mat& result) {
+		cv::Mat image = result;
+
+		encodes.started();
+		state->encoders->submit([&encodes, buffers, in_memory, output, image] {
+			bool ok = false;
+			try {
+				if (in_memory) {
+					ok = cv::imencode(".jpg", image, buffers->encoded[output]);
+				}
+				else {
+					ok = cv::imwrite(buffers->paths[output], image);
+				}
+			}
+			catch (const cv::Exception& ex) {
+				printf("Error: OpenCV failed encoding %s: %s\n", color_wheel_output_names[output], ex.what());
+			}
+			encodes.finished(ok);
+		});
+	});
+
+	return encodes.wait();
+}
+
+static void fill_options(color_wheel_options* options, int angle, int equalize, int expand) {
+	options->rotation_angle = angle;
+	options->do_histogram_equalization = (equalize != 0);
+	options->canvas = (expand != 0) ? ROTATION_CANVAS_EXPAND : ROTATION_CANVAS_CROP;
+	options->mix_seed = (unsigned int)cv::getTickCount(); // a different mix per request, like the command line modes
+}
+
+//
+// Serves a PATH request whose header line is 'line'. Returns false if the connection can't go on (the client hung up,
+// or the request was malformed, so the lines after it can't be told apart from the next request).
+//
+static bool serve_path_request(socket_handle fd, connection_reader* reader, service_state* state, connection_buffers* buffers, const std::string& line) {
+	color_wheel_options options;
+	int angle, equalize, expand;
+	std::string input, prefix;
+
+	if (sscanf(line.c_str(), "PATH %d %d %d", &angle, &equalize, &expand) != 3) {
+		send_error(fd, "malformed PATH request");
+		return false;
+	}
+	if (!read_line(reader, input) || !read_line(reader, prefix)) {
+		return false;
+	}
+	fill_options(&options, angle, equalize, expand);
+
+	buffers->decoded = cv::imread(input, cv::IMREAD_COLOR);
+	if (buffers->decoded.empty()) {
+		return send_error(fd, "can't parse the input file");
+	}
+	for (int i = 0; i < COLOR_WHEEL_OUT_MAX; i++) {
+		buffers->paths[i] = prefix + color_wheel_output_names[i];
+	}
+	if (!run_request(state, buffers, &options, false)) {
+		return send_error(fd, "couldn't write an output");
+	}
+
+	std::string reply = "OK 7\n";
+	for (int i = 0; i < COLOR_WHEEL_OUT_MAX; i++) {
+		reply += buffers->paths[i] + "\n";
+	}
+	return send_string(fd, reply);
+}
+
+//
+// Serves a DATA request whose header line is 'line'. Returns false if the connection can't go on, as above.
+//
+static bool serve_data_request(socket_handle fd, connection_reader* reader, service_state* state, connection_buffers* buffers, const std::string& line) {
+	color_wheel_options options;
+	int angle, equalize, expand;
+	unsigned long byte_count;
+	bool ok;
+
+	//
+	// Without a good byte count there's no finding where the payload ends and the next request starts.
+	//
+	if (sscanf(line.c_str(), "DATA %d %d %d %lu", &angle, &equalize, &expand, &byte_count) != 4) {
+		send_error(fd, "malformed DATA request");
+		return false;
+	}
+	if ((byte_count == 0) || (byte_count > COLOR_WHEEL_SERVICE_MAX_INPUT)) {
+		send_error(fd, "bad DATA size");
+		return false;
+	}
+	fill_options(&options, angle, equalize, expand);
+
+	buffers->input_bytes.resize(byte_count);
+	if (!read_exact(reader, buffers->input_bytes.data(), byte_count)) {
+		return false;
+	}
+	buffers->decoded = cv::imdecode(buffers->input_bytes, cv::IMREAD_COLOR, &buffers->decoded);
+	if (buffers->decoded.empty()) {
+		return send_error(fd, "can't parse the input bytes");
+	}
+	if (!run_request(state, buffers, &options, true)) {
+		return send_error(fd, "couldn't encode an output");
+	}
+
+	ok = send_string(fd, "OK 7\n");
+	for (int i = 0; (i < COLOR_WHEEL_OUT_MAX) && ok; i++) {
+		char header[64];
+		snprintf(header, sizeof(header), "%s %lu\n", color_wheel_output_names[i], (unsigned long)buffers->encoded[i].size());
+		ok = send_string(fd, header) && send_all(fd, buffers->encoded[i].data(), buffers->encoded[i].size());
+	}
+	return ok;
+}
+
+//
+// Serves requests on one connection until the client hangs up (or the service stops).
+//
+static void handle_connection(socket_handle fd, service_state* state) {
+	connection_reader reader;
+	std::unique_ptr<connection_buffers> buffers(new connection_buffers());
+	std::string line;
+
+	reader.fd = fd;
+	reader.buffer.resize(SERVICE_READ_BUFFER_SIZE);
+	reader.start = reader.end = 0;
+
+	while (read_line(&reader, line)) {
+		bool ok;
+
+		try {
+			if (strncmp(line.c_str(), "PATH ", 5) == 0) {
+				ok = serve_path_request(fd, &reader, state, buffers.get(), line);
+			}
+			else if (strncmp(line.c_str(), "DATA ", 5) == 0) {
+				ok = serve_data_request(fd, &reader, state, buffers.get(), line);
+			}
+			else if (strncmp(line.c_str(), "SHUTDOWN", 8) == 0) {
+				send_string(fd, "OK 0\n");
+				state->stopping = true;
+				wake_listener(state->socket_path.c_str());
+				ok = false;
+			}
+			else {
+				ok = send_error(fd, "unknown request");
+			}
+		}
+		catch (const cv::Exception& ex) {
+			printf("Error: OpenCV failed on a request: %s\n", ex.what());
+			ok = send_error(fd, "OpenCV error");
+		}
+
+		if (!ok) {
+			break;
+		}
+	}
+
+	{
+		std::lock_guard<std::mutex> guard(state->lock);
+		for (size_t i = 0; i < state->open_connections.size(); i++) {
+			if (state->open_connections[i] == fd) {
+				state->open_connections.erase(state->open_connections.begin() + i);
+				break;
+			}
+		}
+	}
+	close_socket(fd);
+}
+
+int color_wheel_service_run(const char* socket_path, unsigned int encode_workers) {
+	struct sockaddr_un addr;
+	socket_handle listener;
+	service_state state;
+	work_pool encoders(encode_workers);
+	std::list<std::pair<std::thread, std::shared_ptr<std::atomic<bool>>>> connections;
+	int accept_failures = 0;
+	int accept_backoff_ms = SERVICE_ACCEPT_BACKOFF_MS;
+
+#ifdef _WIN32
+	WSADATA wsa_data;
+	if (WSAStartup(MAKEWORD(2, 2), &wsa_data) != 0) {
+		printf("Error: couldn't initialize winsock!\n");
+		return -1;
+	}
+#endif
+
+	state.socket_path = socket_path;
+	state.encoders = &encoders;
+	state.stopping = false;
+
+	if (!make_address(socket_path, &addr)) {
+		printf("Error: socket path %s is too long!\n", socket_path);
+		return -1;
+	}
+
+	//
+	// A stale socket file from a previous run would make bind() fail.
+	//
+	remove(socket_path);
+	listener = socket(AF_UNIX, SOCK_STREAM, 0);
+	if ((listener == INVALID_SOCKET) ||
+		(bind(listener, (struct sockaddr*)&addr, sizeof(addr)) != 0) ||
+		(listen(listener, SERVICE_LISTEN_BACKLOG) != 0)) {
+		printf("Error: couldn't listen on %s!\n", socket_path);
+		if (listener != INVALID_SOCKET) {
+			close_socket(listener);
+		}
+		return -1;
+	}
+	printf("Info: color wheel service listening on %s with %u encoders\n", socket_path, encoders.size());
+
+	while (!state.stopping) {
+		socket_handle client = accept(listener, NULL, NULL);
+		if (client == INVALID_SOCKET) {
+			//
+			// Usually out of descriptors for the moment: wait a little longer after each failure instead of spinning.
+			//
+			if (accept_failures == 0) {
+				printf("Error: accept failed on %s, retrying\n", socket_path);
+			}
+			std::this_thread::sleep_for(std::chrono::milliseconds(accept_backoff_ms));
+			accept_backoff_ms = (2 * accept_backoff_ms < SERVICE_ACCEPT_BACKOFF_MAX_MS) ? 2 * accept_backoff_ms : SERVICE_ACCEPT_BACKOFF_MAX_MS;
+			accept_failures++;
+			continue;
+		}
+		accept_failures = 0;
+		accept_backoff_ms = SERVICE_ACCEPT_BACKOFF_MS;
+		if (state.stopping) {
+			close_socket(client);
+			break;
+		}
+
+		//
+		// Reap connection threads that have already finished so a long-lived service doesn't accumulate them.
+		//
+		for (auto it = connections.begin(); it != connections.end();) {
+			if (*it->second) {
+				it->first.join();
+				it = connections.erase(it);
+			}
+			else {
+				++it;
+			}
+		}
+
+		{
+			std::lock_guard<std::mutex> guard(state.lock);
+			state.open_connections.push_back(client);
+		}
+		std::shared_ptr<std::atomic<bool>> finished(new std::atomic<bool>(false));
+		connections.emplace_back(std::thread([client, &state, finished] {
+			handle_connection(client, &state);
+			*finished = true;
+		}), finished);
+	}
+
+	//
+	// Stop: shut the receiving side of the remaining connections, so each finishes (and replies to) the requests it
+	// has already read and then sees EOF, and wait for them.
+	//
+	close_socket(listener);
+	{
+		std::lock_guard<std::mutex> guard(state.lock);
+		for (size_t i = 0; i < state.open_connections.size(); i++) {
+			shutdown(state.open_connections[i], SHUTDOWN_READ);
+		}
+	}
+	for (auto it = connections.begin(); it != connections.end(); ++it) {
+		it->first.join();
+	}
+	remove(socket_path);
+
+#ifdef _WIN32
+	WSACleanup();
+#endif
+	printf("Info: color wheel service stopped\n");
+	return 0;
+}
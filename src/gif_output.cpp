@@ -0,0 +1,271 @@
+/*++
+* Arminder Singh
+* CPE462 Image Processing Final Project
+* I pledge my Honor that I have abided by the Stevens Honor System.
+* - Arminder Singh
+--*/
+
+#include <stdio.h>
+#include <string.h>
+#include <opencv2/opencv.hpp>
+#include "gif_output.h"
+#include "trace.h" // must come before gif.h, it routes gif.h's trace hooks to the tracer
+
+//
+// gif.h's parallel work (building the palette histogram) runs on OpenCV's thread pool, like the rest of the program.
+//
+#define GIF_PARALLEL_FOR(numTasks, task) cv::parallel_for_(cv::Range(0, (numTasks)), [&](const cv::Range& range) { \
+	for (int i = range.start; i < range.end; i++) { \
+		(task)(i); \
+	} \
+})
+
+//
+// gif-h library, this is public domain software, available here: https://github.com/charlietangora/gif-h
+//
+#include "gif.h"
+
+//
+// Palettized frames waiting for the encoder thread, each one frame-sized buffer.
+//
+#define GIF_OUTPUT_FRAMES_IN_FLIGHT 2
+
+void gif_output_default_options(gif_output_options* options) {
+	options->delay = GIF_OUTPUT_DEFAULT_DELAY;
+	options->dither = GIF_DITHER_NONE;
+	options->palette = GIF_PALETTE_LOCAL;
+	options->tiled = false;
+}
+
+//
+// Describes a Mat to gif.h without copying it. OpenCV stores color as BGR(A), so red is the third sample.
+//
+static bool make_gif_source(const cv::Mat& frame, GifFrameSource* src) {
+	if (frame.depth() != CV_8U) {
+		return false;
+	}
+
+	src->data = frame.ptr<uchar>(0);
+	src->rowStride = frame.step[0];
+	src->pixelStride = (uint32_t)frame.channels();
+	src->padding[0] = 0;
+	switch (frame.channels()) {
+		case 1:
+			src->rOffset = src->gOffset = src->bOffset = 0;
+			return true;
+		case 3:
+		case 4:
+			src->rOffset = 2;
+			src->gOffset = 1;
+			src->bOffset = 0;
+			return true;
+		default:
+			return false;
+	}
+}
+
+//
+// gif.h's dither constants for each mode.
+//
+static int gif_dither_value(gif_dither_mode dither) {
+	switch (dither) {
+		case GIF_DITHER_FLOYD_STEINBERG:
+			return kGifDitherFloydSteinberg;
+		case GIF_DITHER_ORDERED:
+			return kGifDitherOrdered;
+		default:
+			return kGifDitherNone;
+	}
+}
+
+//
+// Checks that the frames can be written as one GIF, and traces their dimensions.
+//
+static int check_gif_frames(const cv::Mat* frames, int num_frames, trace_span& span) {
+	if (num_frames <= 0) {
+		printf("Error: no GIF frames!\n");
+		return -1;
+	}
+	for (int i = 0; i < num_frames; i++) {
+		if (frames[i].empty() || (frames[i].rows != frames[0].rows) || (frames[i].cols != frames[0].cols)) {
+			printf("Error: GIF frames must be non-empty and all the same size!\n");
+			return -1;
+		}
+	}
+	span.arg("width", frames[0].cols);
+	span.arg("height", frames[0].rows);
+	span.arg("frames", num_frames);
+	return 0;
+}
+
+//
+// Checks the frames and describes them to gif.h.
+//
+static int make_gif_sources(const cv::Mat* frames, int num_frames, std::vector<GifFrameSource>& sources, trace_span& span) {
+	if (check_gif_frames(frames, num_frames, span) != 0) {
+		return -1;
+	}
+	sources.resize(num_frames);
+	for (int i = 0; i < num_frames; i++) {
+		if (!make_gif_source(frames[i], &sources[i])) {
+			printf("Error: GIF frames must be 8-bit grayscale, BGR or BGRA!\n");
+			return -1;
+		}
+	}
+	return 0;
+}
+
+//
+// Sets up a writer just begun for the frames to come: tiled if asked for, and asynchronous.
+//
+static void start_gif_output(GifWriter* writer, uint32_t width, uint32_t height, const gif_output_options* options) {
+	//
+	// One band per thread of OpenCV's pool (gif.h doesn't cut small frames, or a single thread's, at all).
+	//
+	if (options->tiled) {
+		GifUseTiledEncoding(writer, cv::getNumThreads());
+	}
+
+	//
+	// Frame N is LZW encoded and written on the writer's own thread while frame N + 1 is palettized here.
+	//
+	GifStartAsync(writer, width, height, GIF_OUTPUT_FRAMES_IN_FLIGHT);
+}
+
+//
+// Writes the frames to a writer just begun, and ends it (even if a frame failed). Returns 0, or -1 if a frame or the
+// writer's output failed.
+//
+static int write_gif_frames(GifWriter* writer, const std::vector<GifFrameSource>& sources, uint32_t width, uint32_t height,
+	const gif_output_options* options) {
+	int gif_dither = gif_dither_value(options->dither);
+	bool gray = true;
+	bool frames_ok = true;
+
+	//
+	// Grayscale frames are written exactly, as gray levels, with nothing to quantize (so dither and palette don't
+	// matter to them).
+	//
+	for (size_t i = 0; i < sources.size(); i++) {
+		gray = gray && (sources[i].pixelStride == 1);
+	}
+	if (gray) {
+		start_gif_output(writer, width, height, options);
+		for (size_t i = 0; i < sources.size(); i++) {
+			frames_ok = GifWriteGrayFrame(writer, sources[i].data, (uint32_t)sources[i].rowStride, width, height, options->delay) && frames_ok;
+		}
+		return (GifEnd(writer) && frames_ok) ? 0 : -1;
+	}
+
+	if (options->palette == GIF_PALETTE_GLOBAL) {
+		GifPalette global_palette;
+
+		GifMakeGlobalPalette(sources.data(), (int)sources.size(), width, height, 8, options->dither != GIF_DITHER_NONE, &global_palette);
+		GifUseGlobalPalette(writer, &global_palette);
+	}
+
+	//
+	// Frames with few colors get an exact palette of just as many bits as they need (the global palette, if there is
+	// one, is used as it is).
+	//
+	start_gif_output(writer, width, height, options);
+	for (size_t i = 0; i < sources.size(); i++) {
+		frames_ok = GifWriteFrameFromSource(writer, &sources[i], width, height, options->delay, kGifBitDepthAuto, gif_dither) && frames_ok;
+	}
+	return (GifEnd(writer) && frames_ok) ? 0 : -1;
+}
+
+int write_gif(const cv::String& path, const cv::Mat* frames, int num_frames, const gif_output_options* options) {
+	GifWriter writer = {};
+	std::vector<GifFrameSource> sources;
+	trace_span span("write_gif");
+
+	if (make_gif_sources(frames, num_frames, sources, span) != 0) {
+		return -1;
+	}
+	if (!GifBegin(&writer, path.c_str(), (uint32_t)frames[0].cols, (uint32_t)frames[0].rows, options->delay, kGifBitDepthAuto,
+		gif_dither_value(options->dither))) {
+		printf("Error: couldn't create %s!\n", path.c_str());
+		return -1;
+	}
+	if (write_gif_frames(&writer, sources, (uint32_t)frames[0].cols, (uint32_t)frames[0].rows, options) != 0) {
+		printf("Error: couldn't write %s!\n", path.c_str());
+		return -1;
+	}
+	return 0;
+}
+
+//
+// Callback sink appending to a std::vector<uchar>.
+//
+static bool append_gif_bytes(void* context, const uint8_t* data, size_t size) {
+	std::vector<uchar>* buf = (std::vector<uchar>*)context;
+
+	buf->insert(buf->end(), data, data + size);
+	return true;
+}
+
+int encode_gif(const cv::Mat* frames, int num_frames, const gif_output_options* options, std::vector<uchar>& buf) {
+	GifWriter writer = {};
+	std::vector<GifFrameSource> sources;
+	trace_span span("encode_gif");
+
+	buf.clear();
+	if (make_gif_sources(frames, num_frames, sources, span) != 0) {
+		return -1;
+	}
+	GifBeginCallback(&writer, append_gif_bytes, &buf, (uint32_t)frames[0].cols, (uint32_t)frames[0].rows, options->delay, kGifBitDepthAuto,
+		gif_dither_value(options->dither));
+	if (write_gif_frames(&writer, sources, (uint32_t)frames[0].cols, (uint32_t)frames[0].rows, options) != 0) {
+		buf.clear();
+		return -1;
+	}
+	return 0;
+}
+
+int write_indexed_gif(const cv::String& path, const cv::Mat* indices, const color_lut* palettes, int num_frames, const gif_output_options* options) {
+	GifWriter writer = {};
+	trace_span span("write_indexed_gif");
+	uint32_t width, height;
+	bool frames_ok = true;
+
+	if (check_gif_frames(indices, num_frames, span) != 0) {
+		return -1;
+	}
+	for (int i = 0; i < num_frames; i++) {
+		if (indices[i].type() != CV_8UC1) {
+			printf("Error: indexed GIF frames must be 8-bit single channel!\n");
+			return -1;
+		}
+	}
+	width = (uint32_t)indices[0].cols;
+	height = (uint32_t)indices[0].rows;
+	if (!GifBegin(&writer, path.c_str(), width, height, options->delay)) {
+		printf("Error: couldn't create %s!\n", path.c_str());
+		return -1;
+	}
+
+	start_gif_output(&writer, width, height, options);
+	for (int i = 0; i < num_frames; i++) {
+		GifPalette palette;
+
+		//
+		// color_lut is BGR; every one of its 256 entries is a palette color.
+		//
+		palette.bitDepth = 8;
+		memcpy(palette.r, palettes[i].r, 256);
+		memcpy(palette.g, palettes[i].g, 256);
+		memcpy(palette.b, palettes[i].b, 256);
+		frames_ok = GifWriteIndexedFrame(&writer, indices[i].ptr<uchar>(0), (uint32_t)indices[i].step[0], &palette, width, height,
+			options->delay) && frames_ok;
+	}
+
+	//
+	// The writer is ended even after a failed frame, so its file and buffers are released.
+	//
+	if (!GifEnd(&writer) || !frames_ok) {
+		printf("Error: couldn't write %s!\n", path.c_str());
+		return -1;
+	}
+	return 0;
+}
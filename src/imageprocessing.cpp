@@ -12,10 +12,17 @@
 #include <stdlib.h>
 #include <math.h>
 #include <opencv2/opencv.hpp>
-//
-// gif-h library, this is public domain software, available here: https://github.com/charlietangora/gif-h
-//
-//#include <gif.h>
+#include <thread>
+#include <vector>
+#include "benchmark.h"
+#include "channel_view.h"
+#include "color_wheel.h"
+#include "color_wheel_pipeline.h"
+#include "color_wheel_service.h"
+#include "gif_output.h"
+#include "lut.h"
+#include "strip_stream.h"
+#include "trace.h"
 
 /*++
   Resources used:
@@ -28,101 +35,60 @@
 
 typedef enum {
 	MODE_COLOR_WHEEL = 0,
-	//MODE_GIF_OUTPUT,
+	MODE_COLOR_WHEEL_BATCH,
+	MODE_COLOR_WHEEL_STREAM,
+	MODE_COLOR_WHEEL_SERVICE,
+	MODE_COLOR_WHEEL_BENCHMARK,
+	MODE_GIF_OUTPUT,
 	MODE_MAX,
 	MODE_UNKNOWN = 0xFFFFFFFF
 } img_mode;
 
 using namespace cv; // makes it so any OpenCV methods do not need to be prefixed with "cv::"
 
+//
+// Streaming mode is only built with libjpeg (see strip_stream.h).
+//
+#ifdef HAVE_LIBJPEG
+#define STREAM_MODE_HELP " | color_wheel_stream"
+#define STREAM_MODE_LIST ", color_wheel_stream"
+#else
+#define STREAM_MODE_HELP ""
+#define STREAM_MODE_LIST ""
+#endif
+
 void print_help() {
-	printf("CPE462_Project.exe [color_wheel]\n");
-	printf("Options for color_wheel mode: \n[angle_to_rotate_by_as_an_integer] [equalize_histogram]\n");
-	//printf("Options for convert_to_gif_mode: [input_img_1] [input_img_2] [input_img_3]\n");
+	printf("CPE462_Project.exe [color_wheel | color_wheel_batch" STREAM_MODE_HELP " | color_wheel_service | color_wheel_benchmark | output_as_gif]\n");
+	printf("Options for color_wheel mode: \n[input_image] [angle_to_rotate_by_as_an_integer] [equalize_histogram] [expand_canvas]\n");
+	printf("Options for color_wheel_batch mode: \n[input_directory_or_list_file] [angle_to_rotate_by_as_an_integer] [equalize_histogram] [output_directory] [expand_canvas]\n");
+#ifdef HAVE_LIBJPEG
+	printf("Options for color_wheel_stream mode: \n[input_image] [equalize_histogram] [strip_rows]\n");
+#endif
+	printf("Options for color_wheel_service mode: \n[socket_path] [encode_workers]\n");
+	printf("Options for color_wheel_benchmark mode: \n[test_image] [output_json] [repetitions] [max_side]\n");
+	printf("Options for output_as_gif mode: \n[input_image] [angle_to_rotate_by_as_an_integer] [equalize_histogram] [frame_delay] [expand_canvas] [tiled]\n");
 	return;
 }
 
 
 //
-// Color wheel mode needs these arguments (some are optional, but must be listed in the order specified):
-//   input_image - image to be used as input to the color wheel (must be JPEG). Required, must be a file path.
-//   angle - how many degrees counter-clockwise you want to rotate the image. Optional, will be 0 unless specified
-//   equalize_histogram - do histogram equalization on the image before creating the output images. 
-//   Optional, ignored if incorrect.
-// 
-// Assumptions:
-//   The image is 3 channels (color space is NOT assumed)
-//   Alpha channel is ignored.
-// 
-// Output is always out_ch_1, out_ch_2, out_ch_3 JPG files, the color mixed version out_mixed.jpg, output jpgs colormapped using COLORMAP_HSV (out_1,2,3.jpg), and the out_gif and out_ch_gif GIF files in the directory the program was run in.
+// Parses the optional [angle] [equalize_histogram] arguments starting at argv[first_option], and the optional
+// [expand_canvas] argument at argv[canvas_option].
 //
+int parse_color_wheel_options(int argc, char* argv[], int first_option, int canvas_option, color_wheel_options* options) {
+	color_wheel_default_options(options);
 
-int main_color_wheel(int argc, char* argv[]) {
-	Mat image_in; // one image in, always.
-	Mat image_out_temp;
-	Mat channel_out[3]; // channels [1,2,3] image out. (TODO: could we determine color space of the image in a future iteration to make these R, G, B?)
-	Mat hsv_channel_out[3];
-	Mat mixed_image_out, hsv_mixed_image_out; // add a mixed image output
-	Mat rotation_matrix, affine_matrix;
-	Mat rearranged_channels[3];
-	Mat hsv_rearranged_channels[3];
-	Point2f sourceTriangle[3];
-	Point2f destTriangle[3];
-	time_t second = time(NULL);
-	cv::Point center_img;
-	cv::String in_string; // input string
-	const cv::String out_string_1 = "out_1.jpg";
-	const cv::String out_string_2 = "out_2.jpg";
-	const cv::String out_string_3 = "out_3.jpg";
-	const cv::String out_ch_string_1 = "out_ch_1.jpg";
-	const cv::String out_ch_string_2 = "out_ch_2.jpg";
-	const cv::String out_ch_string_3 = "out_ch_3.jpg";
-	const cv::String out_string_mixed = "out_mixed.jpg";
-	const cv::String hsv_out_string_mixed = "hsv_out_mixed.jpg";
-	const char *out_gif_string = "out_gif.gif";
-	bool do_histogram_equalization = false; //do not do histogram equalization by default.
-	bool mix_colors = false; // default to not mixing colors
-	bool was_any_transform_done = false; // need to check if any transforms are done to image to choose whether to apply a transformation to original input or to the current running output.
-	unsigned int rotation_angle = 0; //default to keeping image angle as is.
-	char* input_file_ext;
-	//
-	// Sanity check the arguments for color wheel mode
-	//
-	// Seed RNG as well
-	//
-	srand(second);
-	if (argc < 3) {
-		// less than 3 arguments means we DEFINITELY didn't get an input image, error out immediately.
-		printf("Error: not enough arguments!\n");
-		print_help();
-		return -1;
-	}
-	//
-	// Check the file extension of the input, make sure it is JPG/JPEG.
-	// Note: while we *could* support TIFF, PNG, etc, and OpenCV *should* not care, to keep the project simple, restrict to JPG.
-	// We will error out later if the format is NOT actually JPEG.
-	//
-	input_file_ext = strrchr(argv[2], '.');
-	if ((strncmp(input_file_ext + 1, "jpg", 3) != 0) && (strncmp(input_file_ext + 1, "jpeg", 4) != 0)) {
-		//
-		// Input image file extension is not 'jpg', error out.
-		//
-		printf("Error: File does not have .jpg or .jpeg extension! File must have these extensions.\n");
-		return -1;
-	}
-	in_string = (cv::String)argv[2];
-	
 	//
 	// Warning: due to time constraints, I couldn't account for all of the undefined behavior here, 
 	// so please be careful when specifying parameters.
 	//
-	if (argc >= 4) {
+	if (argc > first_option) {
 		// parse all the "Optional" parameters here. we always enter this if we have at least one optional parameter passed in.
-		if (strncmp(argv[3], "0", 1) != 0) {
+		if (strncmp(argv[first_option], "0", 1) != 0) {
 			try {
 				// custom angle is specified, set it.
 				printf("Info: setting rotation angle\n");
-				rotation_angle = atoi(argv[3]);	
+				options->rotation_angle = atoi(argv[first_option]);
 			}
 			catch (std::invalid_argument const& ex) {
 				printf("Error: Third argument is not an integer\n");
@@ -130,9 +96,13 @@ int main_color_wheel(int argc, char* argv[]) {
 				return -1;
 			}
 		}
-		if (strncmp(argv[4], "equalize_histogram", 21) == 0) {
+		if ((argc > first_option + 1) && (strncmp(argv[first_option + 1], "equalize_histogram", 21) == 0)) {
 			printf("Info: doing histogram equalization\n");
-			do_histogram_equalization = true;
+			options->do_histogram_equalization = true;
+		}
+		if ((argc > canvas_option) && (strncmp(argv[canvas_option], "expand_canvas", 14) == 0)) {
+			printf("Info: expanding the canvas to fit the rotated image\n");
+			options->canvas = ROTATION_CANVAS_EXPAND;
 		}
 		//
 		// framerate control is scrapped until a future iteration.
@@ -152,127 +122,403 @@ int main_color_wheel(int argc, char* argv[]) {
 		// }
 		
 	}
+	return 0;
+}
 
-	image_in = imread(in_string, cv::IMREAD_COLOR);
-	if (image_in.empty()) {
-		printf("Error: OpenCV can't parse the input file!\n");
-		return -1;
+//
+// Check the file extension of an input, make sure it is JPG/JPEG.
+// Note: while we *could* support TIFF, PNG, etc, and OpenCV *should* not care, to keep the project simple, restrict to JPG.
+// We will error out later if the format is NOT actually JPEG.
+//
+bool has_jpeg_extension(const char* path) {
+	const char* input_file_ext = strrchr(path, '.');
+
+	if (input_file_ext == NULL) {
+		return false;
 	}
+	return ((strncmp(input_file_ext + 1, "jpg", 3) == 0) || (strncmp(input_file_ext + 1, "jpeg", 4) == 0));
+}
 
+//
+// Color wheel mode needs these arguments (some are optional, but must be listed in the order specified):
+//   input_image - image to be used as input to the color wheel (must be JPEG). Required, must be a file path.
+//   angle - how many degrees counter-clockwise you want to rotate the image. Optional, will be 0 unless specified
+//   equalize_histogram - do histogram equalization on the image before creating the output images. 
+//   Optional, ignored if incorrect.
+//   expand_canvas - for angles that aren't a multiple of 90, grow the output so the rotated corners aren't cropped.
+//   Optional, ignored if incorrect. (Multiples of 90 always swap the output dimensions as needed.)
+// 
+// Assumptions:
+//   The image is 3 channels (color space is NOT assumed)
+//   Alpha channel is ignored.
+// 
+// Output is always out_ch_1, out_ch_2, out_ch_3 JPG files, the color mixed version out_mixed.jpg, and output jpgs colormapped using COLORMAP_HSV (out_1,2,3.jpg) in the directory the program was run in.
+// (The GIFs are made by output_as_gif mode.)
+//
+
+int main_color_wheel(int argc, char* argv[]) {
+	time_t second = time(NULL);
+	color_wheel_options options;
 	//
-	// The test vector is a BGR8 image, no alpha channel, note that the results of the following might change dependent on source image's color space.
-	//
-	
-	//
-	// Orient the image as needed. (To keep the code simple, this must always remain the first transform)
+	// Sanity check the arguments for color wheel mode
 	//
+	if (argc < 3) {
+		// less than 3 arguments means we DEFINITELY didn't get an input image, error out immediately.
+		printf("Error: not enough arguments!\n");
+		print_help();
+		return -1;
+	}
+	if (!has_jpeg_extension(argv[2])) {
+		//
+		// Input image file extension is not 'jpg', error out.
+		//
+		printf("Error: File does not have .jpg or .jpeg extension! File must have these extensions.\n");
+		return -1;
+	}
+	if (parse_color_wheel_options(argc, argv, 3, 5, &options) != 0) {
+		return -1;
+	}
+	options.mix_seed = (unsigned int)second; // a different channel mix every run
+
 	//
-	// if we have an effective angle of 0 (that is, after doing mod 360 on the angle), we know we aren't rotating, so this code should be skipped for speed reasons in that case.
+	// A single image still goes through the pipeline: the transform emits each output as soon as it is ready
+	// and the seven encodes run concurrently on the encoder pool.
 	//
-	if ((rotation_angle % 360) != 0) {
-		////
-		//// NOTE: these triangle points are completely arbitrary and are a variation of the ones used in the tutorial here: https://docs.opencv.org/4.5.5/d4/d61/tutorial_warp_affine.html
-		////
-		sourceTriangle[0] = Point2f(0, 0);
-		sourceTriangle[1] = Point2f(image_in.cols - 1, 0);
-		sourceTriangle[2] = Point2f(0, image_in.rows - 1);
-		destTriangle[0] = Point2f(0, image_in.rows * 0.6);
-		destTriangle[1] = Point2f(image_in.cols * 0.9, image_in.rows * 0.7);
-		destTriangle[2] = Point2f(image_in.cols * 0.3, image_in.rows * 0.4);
-		rotation_angle = rotation_angle % 360;
-		affine_matrix = getAffineTransform(sourceTriangle, destTriangle);
-		center_img = Point(image_in.cols / 2, image_in.rows / 2);
-		rotation_matrix = cv::getRotationMatrix2D(center_img, (double)rotation_angle, 1.0);
-		cv::warpAffine(image_in, image_out_temp, rotation_matrix, image_in.size() );
-		if (was_any_transform_done == false) {
-			was_any_transform_done = true;
+	{
+		color_wheel_pipeline pipeline(&options, 1, COLOR_WHEEL_OUT_MAX);
+		pipeline.add((cv::String)argv[2], "");
+		if (pipeline.finish() != 0) {
+			return -1;
 		}
 	}
+	return 0;
 
-	//
-	// extract the image channels, and dump them out to the disk as JPG.
-	//
-	cv::split(((was_any_transform_done == true) ? image_out_temp : image_in), channel_out);
+}
 
-	cv::imwrite(out_ch_string_1, channel_out[0]);
-	cv::imwrite(out_ch_string_2, channel_out[1]);
-	cv::imwrite(out_ch_string_3, channel_out[2]);
+//
+// Collects the JPEG inputs for batch mode. 'source' is either a list file (.txt/.lst, one path per line, '#' starts
+// a comment) or a directory, in which case every .jpg/.jpeg directly inside it is used.
+//
+int collect_batch_inputs(const char* source, std::vector<cv::String>& inputs) {
+	const char* source_ext = strrchr(source, '.');
+	std::vector<cv::String> candidates;
+
+	if ((source_ext != NULL) && ((strncmp(source_ext + 1, "txt", 3) == 0) || (strncmp(source_ext + 1, "lst", 3) == 0))) {
+		char line[4096];
+		FILE* list_file = fopen(source, "r");
+		if (list_file == NULL) {
+			printf("Error: can't open list file %s!\n", source);
+			return -1;
+		}
+		while (fgets(line, sizeof(line), list_file) != NULL) {
+			size_t len = strlen(line);
+			while ((len > 0) && ((line[len - 1] == '\n') || (line[len - 1] == '\r'))) {
+				line[--len] = '\0';
+			}
+			if ((len == 0) || (line[0] == '#')) {
+				continue;
+			}
+			candidates.push_back((cv::String)line);
+		}
+		fclose(list_file);
+	}
+	else {
+		cv::glob((cv::String)source + "/*", candidates, false);
+	}
 
-	//
-	// Do histogram equalization on the channels, if the user requested it.
-	//
-	if (do_histogram_equalization == true) {
-		cv::equalizeHist(channel_out[0], channel_out[0]);
-		cv::equalizeHist(channel_out[1], channel_out[1]);
-		cv::equalizeHist(channel_out[2], channel_out[2]);
+	for (size_t i = 0; i < candidates.size(); i++) {
+		if (has_jpeg_extension(candidates[i].c_str())) {
+			inputs.push_back(candidates[i]);
+		}
+		else {
+			printf("Info: skipping non-JPEG input %s\n", candidates[i].c_str());
+		}
+	}
+	return 0;
+}
+
+//
+// Output prefix for one batch input: <output_dir>/<input file name without extension>_
+//
+cv::String batch_output_prefix(const cv::String& output_dir, const cv::String& input) {
+	size_t name_start = input.find_last_of("/\\");
+	size_t name_end = input.find_last_of('.');
+
+	name_start = (name_start == cv::String::npos) ? 0 : name_start + 1;
+	if ((name_end == cv::String::npos) || (name_end < name_start)) {
+		name_end = input.size();
 	}
+	return output_dir + "/" + input.substr(name_start, name_end - name_start) + "_";
+}
 
+//
+// Batch color wheel mode runs the color wheel over many images in one process:
+//   input - a directory of JPEGs, or a .txt/.lst file listing one JPEG path per line. Required.
+//   angle, equalize_histogram - same as color wheel mode, applied to every image. Optional.
+//   output_dir - where the outputs go, each named <input name>_out_*.jpg. Optional, defaults to the working directory.
+//   expand_canvas - same as color wheel mode. Optional.
+//
+// Images stream through the decode -> transform -> encode pipeline. Several transformers work on different images
+// at once, and the encodes of every image are spread over the work-stealing encoder pool, so one huge image doesn't
+// leave the other cores idle.
+//
+int main_color_wheel_batch(int argc, char* argv[]) {
+	time_t second = time(NULL);
+	color_wheel_options options;
+	std::vector<cv::String> inputs;
+	cv::String output_dir = ".";
+	unsigned int num_threads = std::thread::hardware_concurrency();
+	int failures;
+
+	if (argc < 3) {
+		printf("Error: not enough arguments!\n");
+		print_help();
+		return -1;
+	}
+	if (parse_color_wheel_options(argc, argv, 3, 6, &options) != 0) {
+		return -1;
+	}
+	options.mix_seed = (unsigned int)second;
+	if (argc >= 6) {
+		output_dir = (cv::String)argv[5];
+	}
+	if (collect_batch_inputs(argv[2], inputs) != 0) {
+		return -1;
+	}
+	if (inputs.empty()) {
+		printf("Error: no JPEG inputs found in %s!\n", argv[2]);
+		return -1;
+	}
 
 	//
-	// apply colormaps to the channels.
+	// Encoding dominates, so most threads go to the encoder pool and roughly a quarter to transforming.
 	//
+	if (num_threads == 0) {
+		num_threads = 1;
+	}
+	{
+		unsigned int transform_workers = (num_threads / 4 > 0) ? num_threads / 4 : 1;
+		color_wheel_pipeline pipeline(&options, transform_workers, num_threads);
 
+		printf("Info: processing %d images on %u transform and %u encode workers\n", (int)inputs.size(), transform_workers, num_threads);
+		for (size_t i = 0; i < inputs.size(); i++) {
+			pipeline.add(inputs[i], batch_output_prefix(output_dir, inputs[i]));
+		}
+		failures = pipeline.finish();
+	}
 
-	cv::applyColorMap(channel_out[0], hsv_channel_out[0], COLORMAP_HSV);
-	cv::applyColorMap(channel_out[1], hsv_channel_out[1], COLORMAP_HSV);
-	cv::applyColorMap(channel_out[2], hsv_channel_out[2], COLORMAP_HSV);
+	if (failures != 0) {
+		printf("Info: %d images processed with %d failures\n", (int)inputs.size(), failures);
+		return -1;
+	}
+	printf("Info: %d images processed successfully\n", (int)inputs.size());
+	return 0;
+}
 
+#ifdef HAVE_LIBJPEG
 
-	cv::imwrite(out_string_1, hsv_channel_out[0]);
-	cv::imwrite(out_string_2, hsv_channel_out[1]);
-	cv::imwrite(out_string_3, hsv_channel_out[2]);
+//
+// Streaming color wheel mode, for images too large to hold in memory:
+//   input_image - JPEG to process. Required.
+//   equalize_histogram - same as color wheel mode (histogram comes from a cheap downscaled pre-pass). Optional.
+//   strip_rows - scanlines decoded and encoded per strip. Optional, defaults to STRIP_STREAM_DEFAULT_ROWS.
+//
+// Produces the same out_*.jpg files as color wheel mode, with memory bounded by a few strips. Rotation isn't available.
+//
+int main_color_wheel_stream(int argc, char* argv[]) {
+	time_t second = time(NULL);
+	color_wheel_options options;
+	int strip_rows = STRIP_STREAM_DEFAULT_ROWS;
 
-	//
-	// Mix the channels from earlier into a new BGR8 image.
-	//
+	if (argc < 3) {
+		printf("Error: not enough arguments!\n");
+		print_help();
+		return -1;
+	}
+	if (!has_jpeg_extension(argv[2])) {
+		printf("Error: File does not have .jpg or .jpeg extension! File must have these extensions.\n");
+		return -1;
+	}
 
-	unsigned int first_channel = (rand() % 3);
-	switch(first_channel) {
-		case 0:
-			rearranged_channels[0] = channel_out[0];
-			rearranged_channels[1] = channel_out[2];
-			rearranged_channels[2] = channel_out[1];
-			break;
-		case 1:
-			rearranged_channels[0] = channel_out[1];
-			rearranged_channels[1] = channel_out[2];
-			rearranged_channels[2] = channel_out[0];
-			break;
-		case 2:
-			rearranged_channels[0] = channel_out[2];
-			rearranged_channels[1] = channel_out[0];
-			rearranged_channels[2] = channel_out[1];
-			break;
-	}
-
-	cv::merge(rearranged_channels, 3, mixed_image_out);
-	cv::imwrite(out_string_mixed, mixed_image_out);
+	color_wheel_default_options(&options);
+	options.mix_seed = (unsigned int)second;
+	if ((argc >= 4) && (strncmp(argv[3], "equalize_histogram", 21) == 0)) {
+		printf("Info: doing histogram equalization\n");
+		options.do_histogram_equalization = true;
+	}
+	if (argc >= 5) {
+		strip_rows = atoi(argv[4]);
+		if (strip_rows <= 0) {
+			printf("Error: strip_rows must be a positive integer\n");
+			return -1;
+		}
+	}
+
+	return color_wheel_stream((cv::String)argv[2], "", &options, strip_rows);
+}
+
+#endif
+
+//
+// Color wheel service mode, a long-lived daemon for callers that process many images:
+//   socket_path - Unix domain socket to listen on. Required.
+//   encode_workers - encoder threads shared by all connections. Optional, defaults to one per hardware thread.
+//
+// See color_wheel_service.h for the request protocol.
+//
+int main_color_wheel_service(int argc, char* argv[]) {
+	unsigned int encode_workers = 0;
+
+	if (argc < 3) {
+		printf("Error: not enough arguments!\n");
+		print_help();
+		return -1;
+	}
+	if (argc >= 4) {
+		int workers = atoi(argv[3]);
+		if (workers <= 0) {
+			printf("Error: encode_workers must be a positive integer\n");
+			return -1;
+		}
+		encode_workers = (unsigned int)workers;
+	}
+
+	return color_wheel_service_run(argv[2], encode_workers);
+}
+
+//
+// Benchmark mode, times every color wheel stage separately (see benchmark.h):
+//   test_image - real image to include in the sweep. Optional, defaults to tests/test_img_in_512.jpg.
+//   output_json - where the median/p95 report goes. Optional, defaults to benchmark.json.
+//   repetitions - timed runs per case. Optional, defaults to BENCHMARK_DEFAULT_REPETITIONS.
+//   max_side - largest synthetic input, the sweep doubles from 256 up to it. Optional, defaults to BENCHMARK_DEFAULT_MAX_SIDE.
+//
+int main_color_wheel_benchmark(int argc, char* argv[]) {
+	cv::String test_image = "tests/test_img_in_512.jpg";
+	cv::String output_json = "benchmark.json";
+	int repetitions = BENCHMARK_DEFAULT_REPETITIONS;
+	int max_side = BENCHMARK_DEFAULT_MAX_SIDE;
+
+	if (argc >= 3) {
+		test_image = (cv::String)argv[2];
+	}
+	if (argc >= 4) {
+		output_json = (cv::String)argv[3];
+	}
+	if (argc >= 5) {
+		repetitions = atoi(argv[4]);
+		if (repetitions <= 0) {
+			printf("Error: repetitions must be a positive integer\n");
+			return -1;
+		}
+	}
+	if (argc >= 6) {
+		max_side = atoi(argv[5]);
+		if (max_side < 256) {
+			printf("Error: max_side must be at least 256\n");
+			return -1;
+		}
+	}
+
+	return color_wheel_benchmark(test_image, output_json, repetitions, max_side);
+}
+
+//
+// The tables the color wheel colored its channel outputs with (the colormap, with the channel's equalization folded in
+// like color_wheel_transform does), so the colormapped GIF can be written from the channels as palette indices.
+//
+void colormapped_gif_palettes(const color_wheel_images* images, const color_wheel_options* options, color_lut palettes[3]) {
+	for (int i = 0; i < 3; i++) {
+		const Mat& plane = images->images[COLOR_WHEEL_OUT_CH_1 + i];
+		point_lut channel_ops;
+
+		point_lut_identity(&channel_ops);
+		if (options->do_histogram_equalization == true) {
+			int hist[256] = { 0 };
+			uchar equalize_lut[256];
+
+			for (int y = 0; y < plane.rows; y++) {
+				const uchar* row = plane.ptr<uchar>(y);
+				for (int x = 0; x < plane.cols; x++) {
+					hist[row[x]]++;
+				}
+			}
+			build_equalize_lut(hist, plane.rows * plane.cols, equalize_lut);
+			point_lut_chain(&channel_ops, equalize_lut);
+		}
+		color_lut_compile(&channel_ops, colormap_lut(COLORMAP_HSV), &palettes[i]);
+	}
+}
+
+//
+// GIF output mode runs the color wheel in memory and writes the frames as animated GIFs instead of JPEGs:
+//   input_image - same as color wheel mode. Required.
+//   angle, equalize_histogram - same as color wheel mode. Optional.
+//   frame_delay - hundredths of a second per frame ("0" keeps the default, GIF_OUTPUT_DEFAULT_DELAY). Optional.
+//   expand_canvas - same as color wheel mode. Optional.
+//   tiled - "tiled" LZW encodes each big frame as bands on all cores; the bands show one after another in browsers, so
+//           it's meant for stills. Optional.
+//
+// Output is out_ch_gif.gif (the three channels) and out_gif.gif (the three colormapped channels). The frames go to
+// the GIF encoder straight from the output Mats, and the two GIFs are written concurrently. The channel GIF is written
+// as gray levels and the colormapped GIF from the channels and their colormaps, so both come out exact with no
+// quantizing, and there's nothing to dither or build a palette for.
+//
+int main_convert_to_gif(int argc, char* argv[]) {
+	time_t second = time(NULL);
+	color_wheel_options options;
+	color_wheel_images images;
+	color_lut colormaps[3];
+	gif_output_options gif_options;
+	int channel_ret = -1, ret;
+
+	if (argc < 3) {
+		printf("Error: not enough arguments!\n");
+		print_help();
+		return -1;
+	}
+	if (!has_jpeg_extension(argv[2])) {
+		printf("Error: File does not have .jpg or .jpeg extension! File must have these extensions.\n");
+		return -1;
+	}
+	if (parse_color_wheel_options(argc, argv, 3, 6, &options) != 0) {
+		return -1;
+	}
+	options.mix_seed = (unsigned int)second;
+	gif_output_default_options(&gif_options);
+	if ((argc >= 6) && (strncmp(argv[5], "0", 1) != 0)) {
+		int frame_delay = atoi(argv[5]);
+		if (frame_delay <= 0) {
+			printf("Error: frame_delay must be a positive integer\n");
+			return -1;
+		}
+		gif_options.delay = (unsigned int)frame_delay;
+	}
+	if ((argc >= 8) && (strncmp(argv[7], "tiled", 6) == 0)) {
+		gif_options.tiled = true;
+	}
 
 	//
-	// Write the GIF - scrapped
+	// Decoded straight into the slot the transform works in, so the image isn't copied before it's consumed.
 	//
-	//GifWriter writer = {};
-	//GifBegin(&writer, out_gif_string, image_in.cols, image_in.rows, 333);
-	//for (int i = 0; i < 3; i++) {
-	//	unsigned char* image_out = channel_out[i].data;
-	//	GifWriteFrame(&writer, image_out, channel_out[i].cols, channel_out[i].rows, 333);
-	//}
-	//GifEnd(&writer);
-	return 0;
+	images.images[COLOR_WHEEL_OUT_MIXED] = imread(argv[2], cv::IMREAD_COLOR);
+	if (images.images[COLOR_WHEEL_OUT_MIXED].empty()) {
+		printf("Error: OpenCV can't parse the input file %s!\n", argv[2]);
+		return -1;
+	}
+	if (color_wheel_process_in_place(&options, &images) != 0) {
+		return -1;
+	}
 
-}
+	std::thread channel_gif([&] {
+		channel_ret = write_gif("out_ch_gif.gif", &images.images[COLOR_WHEEL_OUT_CH_1], 3, &gif_options);
+	});
+	colormapped_gif_palettes(&images, &options, colormaps);
+	ret = write_indexed_gif("out_gif.gif", &images.images[COLOR_WHEEL_OUT_CH_1], colormaps, 3, &gif_options);
+	channel_gif.join();
 
-//int main_convert_to_gif(int argc, char*argv[]) {
-//	Mat image_1_in, image_2_in, image_3_in;
-//	int image_1[][];
-//	int image_2[][];
-//	int image_3[][];
-//	//
-//	// Notes before grinding:
-//	//   one image is required to make a static gif
-//	//   presence of two or three images implies an animated gif
-//	//
-//}
+	return ((ret == 0) && (channel_ret == 0)) ? 0 : -1;
+}
 
 //
 // CLI syntax *should* be this:
@@ -286,7 +532,8 @@ int main(int argc, char *argv[])
 
 	//
 	// Mode selector:
-	// Only valid mode is 'color_wheel' for now.
+	// Valid modes are 'color_wheel', 'color_wheel_batch', 'color_wheel_stream', 'color_wheel_service',
+	// 'color_wheel_benchmark' and 'output_as_gif' for now.
 	//
 	// If we don't have a valid mode selected, since mode is default set to UNKNOWN, exit once we check for modes.
 	//
@@ -294,39 +541,101 @@ int main(int argc, char *argv[])
 	//   Color wheel: the "main" mode of the program, this is where most our actual functionality is, including orientation,
 	//   image filtering, etc. (The other modes are basically helpers to convert images as needed)
 	//   
-	//   Output as GIF: Takes as input one to three images (the frames as JPG) and outputs the GIF of those three frames at a 
-	//   specified frame rate. (Shelved)
+	//   Batch color wheel: the color wheel over a whole directory (or list file) of images in one process.
+	//
+	//   Streaming color wheel: the color wheel in bounded memory, a strip at a time, for gigapixel inputs. Only in builds
+	//   with libjpeg (HAVE_LIBJPEG).
+	//
+	//   Color wheel service: the color wheel as a daemon on a Unix domain socket, so per-process and per-image setup is
+	//   paid once for a whole stream of requests.
+	//
+	//   Color wheel benchmark: times each stage of the color wheel over the test image and a synthetic size sweep.
+	//
+	// Any mode can be traced: set COLOR_WHEEL_TRACE to a file name and a Chrome trace-event JSON of the run is written
+	// there (see trace.h).
+	//
+	//   Output as GIF: runs the color wheel on an image and outputs the channel and colormapped frames as animated GIFs at
+	//   a specified frame delay.
 	//
 	//
 	
-	if (strncmp(argv[1], "color_wheel", 11) == 0) {
-		mode = MODE_COLOR_WHEEL;
+	if (argc < 2) {
+		printf("Error: no running mode specified!\n");
+		print_help();
+		return ret;
 	}
+
 	//
-	// shelved until the future.
-	// 
-	//else if (strncmp(argv[1], "output_as_gif", 13) == 0) {
-	//	mode = MODE_GIF_OUTPUT;
-	//}
+	// The color_wheel_* modes must be checked first, color_wheel is a prefix of all of them.
+	//
+	if (strncmp(argv[1], "color_wheel_batch", 17) == 0) {
+		mode = MODE_COLOR_WHEEL_BATCH;
+	}
+#ifdef HAVE_LIBJPEG
+	else if (strncmp(argv[1], "color_wheel_stream", 18) == 0) {
+		mode = MODE_COLOR_WHEEL_STREAM;
+	}
+#endif
+	else if (strncmp(argv[1], "color_wheel_service", 19) == 0) {
+		mode = MODE_COLOR_WHEEL_SERVICE;
+	}
+	else if (strncmp(argv[1], "color_wheel_benchmark", 21) == 0) {
+		mode = MODE_COLOR_WHEEL_BENCHMARK;
+	}
+	else if (strncmp(argv[1], "color_wheel", 11) == 0) {
+		mode = MODE_COLOR_WHEEL;
+	}
+	else if (strncmp(argv[1], "output_as_gif", 13) == 0) {
+		mode = MODE_GIF_OUTPUT;
+	}
+
+	const char* trace_path = getenv("COLOR_WHEEL_TRACE");
+	if ((trace_path != NULL) && (trace_path[0] != '\0') && (trace_open(trace_path) != 0)) {
+		return ret;
+	}
 
 	//
 	// Check our running mode at this point. If unknown, exit.
+	// The whole run is one span, so the stage spans nest under the mode in the trace viewer.
 	//
-	switch (mode) {
-		case MODE_UNKNOWN:
-		default:
-			printf("Error: Unknown running mode specified! Valid modes are [color_wheel]\n");
-			print_help();
-			break;
-		case MODE_COLOR_WHEEL:
-			printf("Running in color wheel mode\n");
-			ret = main_color_wheel(argc, argv);
-			break;
-		//case MODE_GIF_OUTPUT:
-		//	printf("Converting images to GIF\n");
-		//	//ret = main_convert_to_gif(argc, argv);
+	{
+		trace_span span(argv[1]);
 
+		switch (mode) {
+			case MODE_UNKNOWN:
+			default:
+				printf("Error: Unknown running mode specified! Valid modes are [color_wheel, color_wheel_batch" STREAM_MODE_LIST ", color_wheel_service, color_wheel_benchmark, output_as_gif]\n");
+				print_help();
+				break;
+			case MODE_COLOR_WHEEL:
+				printf("Running in color wheel mode\n");
+				ret = main_color_wheel(argc, argv);
+				break;
+			case MODE_COLOR_WHEEL_BATCH:
+				printf("Running in batch color wheel mode\n");
+				ret = main_color_wheel_batch(argc, argv);
+				break;
+#ifdef HAVE_LIBJPEG
+			case MODE_COLOR_WHEEL_STREAM:
+				printf("Running in streaming color wheel mode\n");
+				ret = main_color_wheel_stream(argc, argv);
+				break;
+#endif
+			case MODE_COLOR_WHEEL_SERVICE:
+				printf("Running in color wheel service mode\n");
+				ret = main_color_wheel_service(argc, argv);
+				break;
+			case MODE_COLOR_WHEEL_BENCHMARK:
+				printf("Running in color wheel benchmark mode\n");
+				ret = main_color_wheel_benchmark(argc, argv);
+				break;
+			case MODE_GIF_OUTPUT:
+				printf("Converting images to GIF\n");
+				ret = main_convert_to_gif(argc, argv);
+				break;
+		}
 	}
+	trace_close();
 
 	return ret;
 
@@ -0,0 +1,97 @@
+/*++
+* Arminder Singh
+* CPE462 Image Processing Final Project
+* I pledge my Honor that I have abided by the Stevens Honor System.
+* - Arminder Singh
+--*/
+
+#include <mutex>
+#include <opencv2/opencv.hpp>
+#include <opencv2/core/hal/intrin.hpp>
+#include "lut.h"
+
+//
+// Number of colormaps OpenCV has (COLORMAP_AUTUMN ... COLORMAP_DEEPGREEN). Only the ones actually used get built.
+//
+#define MAX_COLORMAPS 22
+
+void point_lut_identity(point_lut* lut) {
+	for (int i = 0; i < 256; i++) {
+		lut->map[i] = (uchar)i;
+	}
+}
+
+void point_lut_chain(point_lut* lut, const uchar next[256]) {
+	for (int i = 0; i < 256; i++) {
+		lut->map[i] = next[lut->map[i]];
+	}
+}
+
+const color_lut* colormap_lut(int colormap) {
+	static color_lut tables[MAX_COLORMAPS];
+	static std::once_flag built[MAX_COLORMAPS];
+
+	CV_Assert(colormap >= 0 && colormap < MAX_COLORMAPS);
+
+	//
+	// Run the colormap over a 0..255 ramp once; the result is exactly the table cv::applyColorMap uses.
+	//
+	std::call_once(built[colormap], [colormap] {
+		cv::Mat ramp(1, 256, CV_8UC1);
+		cv::Mat mapped;
+		for (int i = 0; i < 256; i++) {
+			ramp.at<uchar>(0, i) = (uchar)i;
+		}
+		cv::applyColorMap(ramp, mapped, colormap);
+		for (int i = 0; i < 256; i++) {
+			const uchar* bgr = mapped.ptr<uchar>(0) + i * 3;
+			tables[colormap].b[i] = bgr[0];
+			tables[colormap].g[i] = bgr[1];
+			tables[colormap].r[i] = bgr[2];
+		}
+	});
+	return &tables[colormap];
+}
+
+void color_lut_compile(const point_lut* pre, const color_lut* colormap, color_lut* out) {
+	for (int i = 0; i < 256; i++) {
+		int v = (pre != NULL) ? pre->map[i] : i;
+		out->b[i] = colormap->b[v];
+		out->g[i] = colormap->g[v];
+		out->r[i] = colormap->r[v];
+	}
+}
+
+void color_lut_apply(const cv::Mat& src, const color_lut* lut, cv::Mat& dst) {
+	CV_Assert(src.type() == CV_8UC1);
+
+	dst.create(src.rows, src.cols, CV_8UC3);
+	for (int y = 0; y < src.rows; y++) {
+		const uchar* in = src.ptr<uchar>(y);
+		uchar* out = dst.ptr<uchar>(y);
+		int x = 0;
+
+#if CV_SIMD
+		//
+		// Gather a vector of b, g and r entries from the planar table and store them interleaved.
+		//
+		const int lanes = cv::v_uint8::nlanes;
+		int idx[cv::v_uint8::nlanes];
+		for (; x <= src.cols - lanes; x += lanes) {
+			for (int k = 0; k < lanes; k++) {
+				idx[k] = in[x + k];
+			}
+			cv::v_store_interleave(out + x * 3, cv::vx_lut(lut->b, idx), cv::vx_lut(lut->g, idx), cv::vx_lut(lut->r, idx));
+		}
+#endif
+		for (; x < src.cols; x++) {
+			uchar v = in[x];
+			out[x * 3 + 0] = lut->b[v];
+			out[x * 3 + 1] = lut->g[v];
+			out[x * 3 + 2] = lut->r[v];
+		}
+	}
+#if CV_SIMD
+	cv::vx_cleanup();
+#endif
+}
@@ -0,0 +1,251 @@
+/*++
+* Arminder Singh
+* CPE462 Image Processing Final Project
+* I pledge my Honor that I have abided by the Stevens Honor System.
+* - Arminder Singh
+--*/
+
+#include <math.h>
+#include <string.h>
+#include <opencv2/opencv.hpp>
+#include "rotation.h"
+
+//
+// Output is processed in ROTATION_TILE x ROTATION_TILE pixel blocks. For the right-angle paths a block reads a
+// ROTATION_TILE x ROTATION_TILE block of the source column-wise, which still fits in L1/L2 at this size; for the
+// bilinear path it keeps the diagonal source footprint of a block small.
+//
+#define ROTATION_TILE 64
+
+//
+// Fixed-point layout of the bilinear path (same scheme cv::warpAffine uses): source coordinates are accumulated
+// with AB_BITS fractional bits, then reduced to INTER_BITS fractional bits for the interpolation weights.
+//
+#define AB_BITS 10
+#define AB_SCALE (1 << AB_BITS)
+#define INTER_BITS 5
+#define INTER_TAB_SIZE (1 << INTER_BITS)
+#define WEIGHT_BITS (2 * INTER_BITS)
+
+typedef struct {
+	uchar v[3];
+} pixel3;
+
+int normalize_rotation_angle(int angle_degrees) {
+	int angle = angle_degrees % 360;
+	return (angle < 0) ? angle + 360 : angle;
+}
+
+//
+// Exact 90/180/270 degree rotation of one band of destination tile rows. T is the whole pixel, so every channel
+// moves with a single load/store.
+//
+template <typename T>
+static void rotate_right_angle_tiles(const cv::Mat& src, cv::Mat& dst, int angle, const cv::Range& tile_rows) {
+	const int src_rows = src.rows;
+	const int src_cols = src.cols;
+
+	for (int ty = tile_rows.start; ty < tile_rows.end; ty++) {
+		int y_start = ty * ROTATION_TILE;
+		int y_end = (y_start + ROTATION_TILE < dst.rows) ? y_start + ROTATION_TILE : dst.rows;
+
+		for (int x_start = 0; x_start < dst.cols; x_start += ROTATION_TILE) {
+			int x_end = (x_start + ROTATION_TILE < dst.cols) ? x_start + ROTATION_TILE : dst.cols;
+
+			for (int y = y_start; y < y_end; y++) {
+				T* out = dst.ptr<T>(y);
+				switch (angle) {
+					case 90:
+						// dst(y, x) = src(x, W - 1 - y)
+						for (int x = x_start; x < x_end; x++) {
+							out[x] = src.ptr<T>(x)[src_cols - 1 - y];
+						}
+						break;
+					case 180: {
+						// dst(y, x) = src(H - 1 - y, W - 1 - x)
+						const T* in = src.ptr<T>(src_rows - 1 - y);
+						for (int x = x_start; x < x_end; x++) {
+							out[x] = in[src_cols - 1 - x];
+						}
+						break;
+					}
+					case 270:
+						// dst(y, x) = src(H - 1 - x, y)
+						for (int x = x_start; x < x_end; x++) {
+							out[x] = src.ptr<T>(src_rows - 1 - x)[y];
+						}
+						break;
+				}
+			}
+		}
+	}
+}
+
+static void rotate_right_angle(const cv::Mat& src, cv::Mat& dst, int angle) {
+	int tile_rows;
+
+	if (angle == 180) {
+		dst.create(src.rows, src.cols, src.type());
+	}
+	else {
+		dst.create(src.cols, src.rows, src.type());
+	}
+	tile_rows = (dst.rows + ROTATION_TILE - 1) / ROTATION_TILE;
+
+	cv::parallel_for_(cv::Range(0, tile_rows), [&](const cv::Range& range) {
+		switch (src.elemSize()) {
+			case 1:
+				rotate_right_angle_tiles<uchar>(src, dst, angle, range);
+				break;
+			case 2:
+				rotate_right_angle_tiles<ushort>(src, dst, angle, range);
+				break;
+			case 3:
+				rotate_right_angle_tiles<pixel3>(src, dst, angle, range);
+				break;
+			case 4:
+				rotate_right_angle_tiles<uint32_t>(src, dst, angle, range);
+				break;
+		}
+	});
+}
+
+//
+// Bilinear warp of one band of destination tiles. inverse_map maps destination to source coordinates.
+// adelta/bdelta hold the per-column x and y contributions in AB_BITS fixed point.
+//
+static void warp_bilinear_tiles(const cv::Mat& src, cv::Mat& dst, const double inverse_map[6], const int* adelta, const int* bdelta, const cv::Range& tiles) {
+	const int cn = src.channels();
+	const int tiles_per_row = (dst.cols + ROTATION_TILE - 1) / ROTATION_TILE;
+	const int round_delta = AB_SCALE / INTER_TAB_SIZE / 2;
+
+	for (int tile = tiles.start; tile < tiles.end; tile++) {
+		int y_start = (tile / tiles_per_row) * ROTATION_TILE;
+		int x_start = (tile % tiles_per_row) * ROTATION_TILE;
+		int y_end = (y_start + ROTATION_TILE < dst.rows) ? y_start + ROTATION_TILE : dst.rows;
+		int x_end = (x_start + ROTATION_TILE < dst.cols) ? x_start + ROTATION_TILE : dst.cols;
+
+		for (int y = y_start; y < y_end; y++) {
+			uchar* out = dst.ptr<uchar>(y) + x_start * cn;
+			int x0 = cvRound((inverse_map[1] * y + inverse_map[2]) * AB_SCALE) + round_delta;
+			int y0 = cvRound((inverse_map[4] * y + inverse_map[5]) * AB_SCALE) + round_delta;
+
+			for (int x = x_start; x < x_end; x++, out += cn) {
+				int fx_full = (x0 + adelta[x]) >> (AB_BITS - INTER_BITS);
+				int fy_full = (y0 + bdelta[x]) >> (AB_BITS - INTER_BITS);
+				int sx = fx_full >> INTER_BITS;
+				int sy = fy_full >> INTER_BITS;
+				int fx = fx_full & (INTER_TAB_SIZE - 1);
+				int fy = fy_full & (INTER_TAB_SIZE - 1);
+				int w00 = (INTER_TAB_SIZE - fx) * (INTER_TAB_SIZE - fy);
+				int w01 = fx * (INTER_TAB_SIZE - fy);
+				int w10 = (INTER_TAB_SIZE - fx) * fy;
+				int w11 = fx * fy;
+
+				if ((unsigned)sx < (unsigned)(src.cols - 1) && (unsigned)sy < (unsigned)(src.rows - 1)) {
+					//
+					// Fast path, all four taps are inside the source.
+					//
+					const uchar* p0 = src.ptr<uchar>(sy) + sx * cn;
+					const uchar* p1 = p0 + src.step[0];
+					for (int c = 0; c < cn; c++) {
+						int v = p0[c] * w00 + p0[c + cn] * w01 + p1[c] * w10 + p1[c + cn] * w11;
+						out[c] = (uchar)((v + (1 << (WEIGHT_BITS - 1))) >> WEIGHT_BITS);
+					}
+				}
+				else if (sx < -1 || sy < -1 || sx >= src.cols || sy >= src.rows) {
+					memset(out, 0, cn);
+				}
+				else {
+					//
+					// Straddling the edge: taps outside the source read the constant (black) border.
+					//
+					const int taps_x[2] = { sx, sx + 1 };
+					const int taps_y[2] = { sy, sy + 1 };
+					const int weights[4] = { w00, w01, w10, w11 };
+					int sums[4] = { 0, 0, 0, 0 };
+					for (int j = 0; j < 2; j++) {
+						if (taps_y[j] < 0 || taps_y[j] >= src.rows) {
+							continue;
+						}
+						for (int i = 0; i < 2; i++) {
+							if (taps_x[i] < 0 || taps_x[i] >= src.cols) {
+								continue;
+							}
+							const uchar* p = src.ptr<uchar>(taps_y[j]) + taps_x[i] * cn;
+							for (int c = 0; c < cn; c++) {
+								sums[c] += p[c] * weights[j * 2 + i];
+							}
+						}
+					}
+					for (int c = 0; c < cn; c++) {
+						out[c] = (uchar)((sums[c] + (1 << (WEIGHT_BITS - 1))) >> WEIGHT_BITS);
+					}
+				}
+			}
+		}
+	}
+}
+
+static void rotate_bilinear(const cv::Mat& src, cv::Mat& dst, int angle, rotation_canvas canvas) {
+	//
+	// Same center the color wheel always rotated around (integer division, like the original cv::Point).
+	//
+	cv::Point2f center((float)(src.cols / 2), (float)(src.rows / 2));
+	cv::Mat forward_map = cv::getRotationMatrix2D(center, (double)angle, 1.0);
+	cv::Mat inverse_map_mat;
+	double inverse_map[6];
+	int out_rows = src.rows;
+	int out_cols = src.cols;
+
+	if (canvas == ROTATION_CANVAS_EXPAND) {
+		double radians = angle * CV_PI / 180.0;
+		double abs_cos = fabs(cos(radians));
+		double abs_sin = fabs(sin(radians));
+
+		//
+		// Grow the canvas to the rotated bounding box and move the rotation center to the middle of it.
+		// (The small epsilon stops 999.9999999 from becoming 1001 pixels.)
+		//
+		out_cols = cvCeil(src.cols * abs_cos + src.rows * abs_sin - 1e-6);
+		out_rows = cvCeil(src.cols * abs_sin + src.rows * abs_cos - 1e-6);
+		forward_map.at<double>(0, 2) += out_cols / 2.0 - center.x;
+		forward_map.at<double>(1, 2) += out_rows / 2.0 - center.y;
+	}
+
+	cv::invertAffineTransform(forward_map, inverse_map_mat);
+	for (int i = 0; i < 6; i++) {
+		inverse_map[i] = inverse_map_mat.at<double>(i / 3, i % 3);
+	}
+
+	dst.create(out_rows, out_cols, src.type());
+
+	std::vector<int> adelta(out_cols);
+	std::vector<int> bdelta(out_cols);
+	for (int x = 0; x < out_cols; x++) {
+		adelta[x] = cvRound(inverse_map[0] * x * AB_SCALE);
+		bdelta[x] = cvRound(inverse_map[3] * x * AB_SCALE);
+	}
+
+	int tiles = ((out_rows + ROTATION_TILE - 1) / ROTATION_TILE) * ((out_cols + ROTATION_TILE - 1) / ROTATION_TILE);
+	cv::parallel_for_(cv::Range(0, tiles), [&](const cv::Range& range) {
+		warp_bilinear_tiles(src, dst, inverse_map, adelta.data(), bdelta.data(), range);
+	});
+}
+
+void rotate_image(const cv::Mat& src, cv::Mat& dst, int angle_degrees, rotation_canvas canvas) {
+	int angle = normalize_rotation_angle(angle_degrees);
+
+	CV_Assert(src.depth() == CV_8U && src.channels() >= 1 && src.channels() <= 4);
+	CV_Assert(src.data != dst.data);
+
+	if (angle == 0) {
+		src.copyTo(dst);
+	}
+	else if ((angle % 90) == 0) {
+		rotate_right_angle(src, dst, angle);
+	}
+	else {
+		rotate_bilinear(src, dst, angle, canvas);
+	}
+}
@@ -0,0 +1,337 @@
+/*++
+* Arminder Singh
+* CPE462 Image Processing Final Project
+* I pledge my Honor that I have abided by the Stevens Honor System.
+* - Arminder Singh
+--*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+#include <opencv2/opencv.hpp>
+#include "channel_view.h"
+#include "lut.h"
+#include "rotation.h"
+#include "strip_stream.h"
+
+#ifdef HAVE_LIBJPEG
+
+#include <setjmp.h>
+#include <jpeglib.h>
+
+//
+// Same quality cv::imwrite uses for JPEG by default.
+//
+#define STRIP_STREAM_JPEG_QUALITY 95
+
+//
+// libjpeg reports fatal errors through error_exit, which by default calls exit(). Jump back to the stream function
+// instead so it can clean up and fail just this image.
+//
+typedef struct {
+	struct jpeg_error_mgr pub;
+	jmp_buf setjmp_buffer;
+} stream_error_mgr;
+
+static void stream_error_exit(j_common_ptr cinfo) {
+	stream_error_mgr* err = (stream_error_mgr*)cinfo->err;
+
+	(*cinfo->err->output_message)(cinfo);
+	longjmp(err->setjmp_buffer, 1);
+}
+
+typedef struct {
+	struct jpeg_decompress_struct cinfo;
+	FILE* f;
+	bool created;
+} stream_decoder;
+
+typedef struct {
+	struct jpeg_compress_struct cinfo;
+	FILE* f;
+	bool created;
+} stream_encoder;
+
+//
+// Opens the input and starts decompression to RGB, optionally downscaled by 1/scale_denom.
+//
+static bool decoder_open(stream_decoder* dec, stream_error_mgr* err, const char* path, unsigned int scale_denom) {
+	dec->f = fopen(path, "rb");
+	if (dec->f == NULL) {
+		printf("Error: can't open %s!\n", path);
+		return false;
+	}
+	dec->cinfo.err = &err->pub;
+	jpeg_create_decompress(&dec->cinfo);
+	dec->created = true;
+	jpeg_stdio_src(&dec->cinfo, dec->f);
+	jpeg_read_header(&dec->cinfo, TRUE);
+	dec->cinfo.out_color_space = JCS_RGB;
+	dec->cinfo.scale_num = 1;
+	dec->cinfo.scale_denom = scale_denom;
+	jpeg_start_decompress(&dec->cinfo);
+	return true;
+}
+
+static void decoder_close(stream_decoder* dec, bool finish) {
+	if (dec->created) {
+		if (finish) {
+			jpeg_finish_decompress(&dec->cinfo);
+		}
+		jpeg_destroy_decompress(&dec->cinfo);
+		dec->created = false;
+	}
+	if (dec->f != NULL) {
+		fclose(dec->f);
+		dec->f = NULL;
+	}
+}
+
+//
+// Reads up to 'rows' scanlines into consecutive rows of 'strip'. Returns how many were read.
+//
+static int decoder_read_strip(stream_decoder* dec, uchar* strip, size_t row_bytes, int rows, std::vector<JSAMPROW>& row_ptrs) {
+	int got = 0;
+
+	for (int r = 0; r < rows; r++) {
+		row_ptrs[r] = strip + r * row_bytes;
+	}
+	while ((got < rows) && (dec->cinfo.output_scanline < dec->cinfo.output_height)) {
+		got += (int)jpeg_read_scanlines(&dec->cinfo, &row_ptrs[got], (JDIMENSION)(rows - got));
+	}
+	return got;
+}
+
+static bool encoder_open(stream_encoder* enc, stream_error_mgr* err, const char* path, int width, int height, int components) {
+	enc->f = fopen(path, "wb");
+	if (enc->f == NULL) {
+		printf("Error: couldn't write %s!\n", path);
+		return false;
+	}
+	enc->cinfo.err = &err->pub;
+	jpeg_create_compress(&enc->cinfo);
+	enc->created = true;
+	jpeg_stdio_dest(&enc->cinfo, enc->f);
+	enc->cinfo.image_width = (JDIMENSION)width;
+	enc->cinfo.image_height = (JDIMENSION)height;
+	enc->cinfo.input_components = components;
+	enc->cinfo.in_color_space = (components == 1) ? JCS_GRAYSCALE : JCS_RGB;
+	jpeg_set_defaults(&enc->cinfo);
+	jpeg_set_quality(&enc->cinfo, STRIP_STREAM_JPEG_QUALITY, TRUE);
+	jpeg_start_compress(&enc->cinfo, TRUE);
+	return true;
+}
+
+static void encoder_write_strip(stream_encoder* enc, uchar* strip, size_t row_bytes, int rows, std::vector<JSAMPROW>& row_ptrs) {
+	for (int r = 0; r < rows; r++) {
+		row_ptrs[r] = strip + r * row_bytes;
+	}
+	jpeg_write_scanlines(&enc->cinfo, row_ptrs.data(), (JDIMENSION)rows);
+}
+
+static void encoder_close(stream_encoder* enc, bool finish) {
+	if (enc->created) {
+		if (finish) {
+			jpeg_finish_compress(&enc->cinfo);
+		}
+		jpeg_destroy_compress(&enc->cinfo);
+		enc->created = false;
+	}
+	if (enc->f != NULL) {
+		fclose(enc->f);
+		enc->f = NULL;
+	}
+}
+
+//
+// Everything the passes change lives here, in color_wheel_stream's frame, rather than in locals of the function that
+// calls setjmp: a longjmp out of libjpeg leaves those locals indeterminate if they changed since the setjmp. It's
+// also why the passes themselves keep no locals with destructors (longjmp would skip them).
+//
+typedef struct {
+	stream_error_mgr err;
+	stream_decoder dec;
+	stream_encoder enc[COLOR_WHEEL_OUT_MAX];
+	std::vector<uchar> strip;
+	std::vector<uchar> gray_strip;
+	std::vector<uchar> color_strip;
+	std::vector<JSAMPROW> row_ptrs;
+	cv::String output_paths[COLOR_WHEEL_OUT_MAX];
+} stream_state;
+
+//
+// The equalization pre-pass and the main pass. libjpeg errors longjmp out of here to stream_run.
+//
+static int stream_passes(stream_state* st, const char* input, const color_wheel_options* options, int strip_rows) {
+	uchar equalize_luts[3][256];
+	color_lut channel_colormaps[3];
+	const uchar* mix_luts[3] = { NULL, NULL, NULL };
+	bool do_histogram_equalization = options->do_histogram_equalization;
+	int width, height;
+	const int* order = color_wheel_mix_order(options->mix_seed);
+
+	//
+	// Equalization pre-pass: a downscaled decode is enough to get the histogram shape.
+	// Note: the decoder outputs RGB, so BGR channel c is RGB component 2 - c.
+	//
+	if (do_histogram_equalization == true) {
+		int hist[3][256];
+
+		memset(hist, 0, sizeof(hist));
+		if (!decoder_open(&st->dec, &st->err, input, 4)) {
+			return -1;
+		}
+		size_t row_bytes = (size_t)st->dec.cinfo.output_width * 3;
+		int total = 0;
+		st->strip.resize(row_bytes * strip_rows);
+		for (;;) {
+			int rows = decoder_read_strip(&st->dec, st->strip.data(), row_bytes, strip_rows, st->row_ptrs);
+			if (rows == 0) {
+				break;
+			}
+			for (int r = 0; r < rows; r++) {
+				const uchar* px = st->strip.data() + r * row_bytes;
+				for (JDIMENSION x = 0; x < st->dec.cinfo.output_width; x++, px += 3) {
+					hist[0][px[2]]++;
+					hist[1][px[1]]++;
+					hist[2][px[0]]++;
+				}
+			}
+			total += rows * (int)st->dec.cinfo.output_width;
+		}
+		decoder_close(&st->dec, true);
+
+		for (int c = 0; c < 3; c++) {
+			build_equalize_lut(hist[c], total, equalize_luts[c]);
+			mix_luts[c] = equalize_luts[c];
+		}
+	}
+
+	//
+	// Compile the per-channel (equalize ->) colormap tables once for the whole image.
+	//
+	for (int c = 0; c < 3; c++) {
+		point_lut channel_ops;
+		point_lut_identity(&channel_ops);
+		if (do_histogram_equalization == true) {
+			point_lut_chain(&channel_ops, equalize_luts[c]);
+		}
+		color_lut_compile(&channel_ops, colormap_lut(cv::COLORMAP_HSV), &channel_colormaps[c]);
+	}
+
+	//
+	// Main pass: full resolution decode, seven incremental encoders.
+	//
+	if (!decoder_open(&st->dec, &st->err, input, 1)) {
+		return -1;
+	}
+	width = (int)st->dec.cinfo.output_width;
+	height = (int)st->dec.cinfo.output_height;
+	for (int i = 0; i < COLOR_WHEEL_OUT_MAX; i++) {
+		int components = (i <= COLOR_WHEEL_OUT_CH_3) ? 1 : 3;
+		if (!encoder_open(&st->enc[i], &st->err, st->output_paths[i].c_str(), width, height, components)) {
+			return -1;
+		}
+	}
+
+	size_t row_bytes = (size_t)width * 3;
+	st->strip.resize(row_bytes * strip_rows);
+	st->gray_strip.resize((size_t)width * strip_rows);
+	st->color_strip.resize(row_bytes * strip_rows);
+
+	for (;;) {
+		int rows = decoder_read_strip(&st->dec, st->strip.data(), row_bytes, strip_rows, st->row_ptrs);
+		if (rows == 0) {
+			break;
+		}
+
+		for (int c = 0; c < 3; c++) {
+			const color_lut* lut = &channel_colormaps[c];
+
+			//
+			// Channel plane strip, then the colormapped strip straight from it (written as RGB).
+			//
+			for (int r = 0; r < rows; r++) {
+				const uchar* px = st->strip.data() + r * row_bytes + (2 - c);
+				uchar* gray = st->gray_strip.data() + r * (size_t)width;
+				uchar* color = st->color_strip.data() + r * row_bytes;
+				for (int x = 0; x < width; x++, px += 3, color += 3) {
+					uchar v = *px;
+					gray[x] = v;
+					color[0] = lut->r[v];
+					color[1] = lut->g[v];
+					color[2] = lut->b[v];
+				}
+			}
+			encoder_write_strip(&st->enc[COLOR_WHEEL_OUT_CH_1 + c], st->gray_strip.data(), (size_t)width, rows, st->row_ptrs);
+			encoder_write_strip(&st->enc[COLOR_WHEEL_OUT_1 + c], st->color_strip.data(), row_bytes, rows, st->row_ptrs);
+		}
+
+		//
+		// Mix in place. In BGR terms out[k] = in[order[k]]; the strip is RGB, so BGR index k is RGB index 2 - k.
+		//
+		for (int r = 0; r < rows; r++) {
+			uchar* px = st->strip.data() + r * row_bytes;
+			for (int x = 0; x < width; x++, px += 3) {
+				uchar bgr[3] = { px[2], px[1], px[0] };
+				for (int k = 0; k < 3; k++) {
+					uchar v = bgr[order[k]];
+					px[2 - k] = (mix_luts[order[k]] != NULL) ? mix_luts[order[k]][v] : v;
+				}
+			}
+		}
+		encoder_write_strip(&st->enc[COLOR_WHEEL_OUT_MIXED], st->strip.data(), row_bytes, rows, st->row_ptrs);
+	}
+
+	decoder_close(&st->dec, true);
+	for (int i = 0; i < COLOR_WHEEL_OUT_MAX; i++) {
+		encoder_close(&st->enc[i], true);
+	}
+	return 0;
+}
+
+//
+// Runs the passes with libjpeg's fatal errors landing here. Nothing in this frame changes after the setjmp.
+//
+static int stream_run(stream_state* st, const char* input, const color_wheel_options* options, int strip_rows) {
+	if (setjmp(st->err.setjmp_buffer)) {
+		return -1;
+	}
+	return stream_passes(st, input, options, strip_rows);
+}
+
+int color_wheel_stream(const cv::String& input, const cv::String& out_prefix, const color_wheel_options* options, int strip_rows) {
+	stream_state st;
+	int ret;
+
+	if (normalize_rotation_angle(options->rotation_angle) != 0) {
+		printf("Error: rotation is not supported when streaming, the whole image would have to be in memory!\n");
+		return -1;
+	}
+	if (strip_rows <= 0) {
+		strip_rows = STRIP_STREAM_DEFAULT_ROWS;
+	}
+
+	memset(&st.dec, 0, sizeof(st.dec));
+	memset(st.enc, 0, sizeof(st.enc));
+	jpeg_std_error(&st.err.pub);
+	st.err.pub.error_exit = stream_error_exit;
+	st.row_ptrs.resize(strip_rows);
+	for (int i = 0; i < COLOR_WHEEL_OUT_MAX; i++) {
+		st.output_paths[i] = out_prefix + color_wheel_output_names[i];
+	}
+
+	ret = stream_run(&st, input.c_str(), options, strip_rows);
+
+	//
+	// Whatever a failure (or libjpeg) left open is released here; after a success everything is closed already.
+	//
+	decoder_close(&st.dec, false);
+	for (int i = 0; i < COLOR_WHEEL_OUT_MAX; i++) {
+		encoder_close(&st.enc[i], false);
+	}
+	return ret;
+}
+
+#endif
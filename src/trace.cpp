@@ -0,0 +1,189 @@
+/*++
+* Arminder Singh
+* CPE462 Image Processing Final Project
+* I pledge my Honor that I have abided by the Stevens Honor System.
+* - Arminder Singh
+--*/
+
+#include <stdio.h>
+#include <string.h>
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "trace.h"
+
+std::atomic<bool> trace_active(false);
+
+typedef struct {
+	char phase; // 'B' or 'E'
+	const char* name;
+	long long timestamp_us;
+	int thread;
+	int num_args;
+	const char* keys[TRACE_MAX_ARGS];
+	long long values[TRACE_MAX_ARGS];
+} trace_event;
+
+//
+// Spans are coarse (whole stages, whole GIF phases), so a single locked vector is plenty. It's written out every
+// TRACE_FLUSH_EVENTS events, so a long-lived process (the service) traces in bounded memory.
+//
+#define TRACE_FLUSH_EVENTS 4096
+
+static std::mutex trace_lock;
+static std::vector<trace_event> trace_events;
+static std::string trace_path;
+static FILE* trace_file = NULL;
+static size_t trace_events_written = 0;
+static std::chrono::steady_clock::time_point trace_start;
+static std::atomic<int> trace_next_thread(1);
+
+//
+// Small stable IDs read better in the viewer than OS thread handles.
+//
+static int trace_thread_id() {
+	static thread_local int id = 0;
+
+	if (id == 0) {
+		id = trace_next_thread++;
+	}
+	return id;
+}
+
+//
+// Writes 's' as a JSON string. Span names can come from user input (file paths, ...), so quotes, backslashes and
+// control characters are escaped.
+//
+static void trace_write_string(FILE* f, const char* s) {
+	fputc('"', f);
+	for (; *s != '\0'; s++) {
+		unsigned char c = (unsigned char)*s;
+		if ((c == '"') || (c == '\\')) {
+			fputc('\\', f);
+			fputc(c, f);
+		}
+		else if (c < 0x20) {
+			fprintf(f, "\\u%04x", c);
+		}
+		else {
+			fputc(c, f);
+		}
+	}
+	fputc('"', f);
+}
+
+//
+// Appends the collected events to the trace file and empties the buffer. Call with trace_lock held.
+//
+static void trace_flush() {
+	for (size_t i = 0; i < trace_events.size(); i++) {
+		const trace_event* event = &trace_events[i];
+
+		fprintf(trace_file, "%s\n{\"name\":", (trace_events_written == 0) ? "" : ",");
+		trace_write_string(trace_file, event->name);
+		fprintf(trace_file, ",\"ph\":\"%c\",\"ts\":%lld,\"pid\":1,\"tid\":%d", event->phase, event->timestamp_us, event->thread);
+		if (event->num_args > 0) {
+			fprintf(trace_file, ",\"args\":{");
+			for (int a = 0; a < event->num_args; a++) {
+				if (a > 0) {
+					fputc(',', trace_file);
+				}
+				trace_write_string(trace_file, event->keys[a]);
+				fprintf(trace_file, ":%lld", event->values[a]);
+			}
+			fprintf(trace_file, "}");
+		}
+		fprintf(trace_file, "}");
+		trace_events_written++;
+	}
+	trace_events.clear();
+}
+
+static void trace_record(char phase, const char* name, int num_args, const char* const* keys, const long long* values) {
+	trace_event event;
+
+	event.phase = phase;
+	event.name = name;
+	event.timestamp_us = (long long)std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - trace_start).count();
+	event.thread = trace_thread_id();
+	event.num_args = (num_args < TRACE_MAX_ARGS) ? num_args : TRACE_MAX_ARGS;
+	for (int i = 0; i < event.num_args; i++) {
+		event.keys[i] = keys[i];
+		event.values[i] = values[i];
+	}
+
+	std::lock_guard<std::mutex> guard(trace_lock);
+	if (trace_active) {
+		trace_events.push_back(event);
+		if (trace_events.size() >= TRACE_FLUSH_EVENTS) {
+			trace_flush();
+		}
+	}
+}
+
+int trace_open(const char* path) {
+	FILE* f = fopen(path, "w");
+
+	if (f == NULL) {
+		printf("Error: couldn't create the trace file %s!\n", path);
+		return -1;
+	}
+	fprintf(f, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+
+	std::lock_guard<std::mutex> guard(trace_lock);
+	trace_path = path;
+	trace_file = f;
+	trace_events.clear();
+	trace_events_written = 0;
+	trace_start = std::chrono::steady_clock::now();
+	trace_active = true;
+	printf("Info: tracing to %s\n", path);
+	return 0;
+}
+
+void trace_close() {
+	if (!trace_active) {
+		return;
+	}
+	trace_active = false;
+
+	std::lock_guard<std::mutex> guard(trace_lock);
+	trace_flush();
+	fprintf(trace_file, "\n]}\n");
+	if (fclose(trace_file) != 0) {
+		printf("Error: couldn't write the trace file %s!\n", trace_path.c_str());
+	}
+	else {
+		printf("Info: wrote %d trace events to %s\n", (int)trace_events_written, trace_path.c_str());
+	}
+	trace_file = NULL;
+}
+
+void trace_begin(const char* name) {
+	trace_record('B', name, 0, NULL, NULL);
+}
+
+void trace_end(const char* name, int num_args, const char* const* keys, const long long* values) {
+	trace_record('E', name, num_args, keys, values);
+}
+
+//
+// GIF phases never nest, so one output offset per thread is enough to get the bytes a phase wrote.
+//
+static thread_local unsigned long long gif_phase_start = 0;
+
+void trace_gif_begin(const char* name, unsigned long long offset) {
+	gif_phase_start = offset;
+	trace_begin(name);
+}
+
+void trace_gif_end(const char* name, unsigned long long offset, unsigned int width, unsigned int height) {
+	static const char* const keys[3] = { "width", "height", "bytes" };
+	long long values[3];
+
+	values[0] = width;
+	values[1] = height;
+	values[2] = (long long)(offset - gif_phase_start);
+	trace_end(name, 3, keys, values);
+}
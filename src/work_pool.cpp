@@ -0,0 +1,239 @@
+/*++
+* Arminder Singh
+* CPE462 Image Processing Final Project
+* I pledge my Honor that I have abided by the Stevens Honor System.
+* - Arminder Singh
+--*/
+
+#include "work_pool.h"
+
+//
+// Which pool (if any) the current thread works for, and its deque. Lets submit() from inside a task push to
+// the worker's own deque instead of a random one.
+//
+static thread_local work_pool* current_pool = NULL;
+static thread_local unsigned int current_index = 0;
+
+work_pool::work_pool(unsigned int num_workers) : queued(0), pending(0), next_queue(0), stopping(false) {
+	if (num_workers == 0) {
+		num_workers = std::thread::hardware_concurrency();
+		if (num_workers == 0) {
+			num_workers = 1;
+		}
+	}
+
+	for (unsigned int i = 0; i < num_workers; i++) {
+		queues.emplace_back(new worker_queue());
+	}
+	for (unsigned int i = 0; i < num_workers; i++) {
+		workers.emplace_back(&work_pool::worker_main, this, i);
+	}
+}
+
+work_pool::~work_pool() {
+	{
+		//
+		// Like wait_idle, but a destructor can't throw: an exception nobody waited for is dropped.
+		//
+		std::unique_lock<std::mutex> lock(idle_lock);
+		all_done.wait(lock, [this] { return pending == 0; });
+		stopping = true;
+	}
+	work_available.notify_all();
+	for (size_t i = 0; i < workers.size(); i++) {
+		workers[i].join();
+	}
+}
+
+void work_pool::push(unsigned int index, std::function<void()> task) {
+	//
+	// Bump 'queued' before the deque lock is released: a thief takes the task (and decrements 'queued') under that
+	// lock, so it can't decrement first and wrap the counter around. The bump is also under idle_lock so a worker can't
+	// check it and go to sleep between the push and the notify. (idle_lock is never held while taking a deque lock.)
+	//
+	{
+		std::lock_guard<std::mutex> guard(queues[index]->lock);
+		queues[index]->tasks.push_back(std::move(task));
+		std::lock_guard<std::mutex> idle_guard(idle_lock);
+		queued++;
+	}
+	work_available.notify_one();
+}
+
+void work_pool::submit(std::function<void()> task) {
+	unsigned int index;
+
+	pending++;
+	if (current_pool == this) {
+		index = current_index;
+	}
+	else {
+		index = next_queue++ % size();
+	}
+	push(index, std::move(task));
+}
+
+bool work_pool::pop_local(unsigned int index, std::function<void()>& task) {
+	if (index >= size()) {
+		return false;
+	}
+	std::lock_guard<std::mutex> guard(queues[index]->lock);
+	if (queues[index]->tasks.empty()) {
+		return false;
+	}
+	task = std::move(queues[index]->tasks.back());
+	queues[index]->tasks.pop_back();
+	queued--;
+	return true;
+}
+
+bool work_pool::steal(unsigned int thief, std::function<void()>& task) {
+	unsigned int n = size();
+
+	//
+	// Start with the thief's neighbour so the workers don't all hammer queue 0.
+	//
+	for (unsigned int i = 1; i <= n; i++) {
+		unsigned int victim = (thief + i) % n;
+		if (victim == thief) {
+			continue;
+		}
+		std::lock_guard<std::mutex> guard(queues[victim]->lock);
+		if (!queues[victim]->tasks.empty()) {
+			task = std::move(queues[victim]->tasks.front());
+			queues[victim]->tasks.pop_front();
+			queued--;
+			return true;
+		}
+	}
+	return false;
+}
+
+void work_pool::task_finished() {
+	if (pending.fetch_sub(1) == 1) {
+		std::lock_guard<std::mutex> guard(idle_lock);
+		all_done.notify_all();
+	}
+}
+
+bool work_pool::try_run_one(unsigned int index) {
+	std::function<void()> task;
+
+	if (!pop_local(index, task) && !steal(index, task)) {
+		return false;
+	}
+
+	//
+	// A task that throws still counts as finished (or wait_idle would never return); the first exception is kept
+	// for wait_idle to rethrow instead of unwinding the worker thread.
+	//
+	try {
+		task();
+	}
+	catch (...) {
+		std::lock_guard<std::mutex> guard(idle_lock);
+		if (!first_error) {
+			first_error = std::current_exception();
+		}
+	}
+	task_finished();
+	return true;
+}
+
+void work_pool::worker_main(unsigned int index) {
+	current_pool = this;
+	current_index = index;
+
+	for (;;) {
+		if (try_run_one(index)) {
+			continue;
+		}
+
+		std::unique_lock<std::mutex> lock(idle_lock);
+		work_available.wait(lock, [this] { return stopping || queued > 0; });
+		if (stopping && queued == 0) {
+			return;
+		}
+	}
+}
+
+void work_pool::run_and_wait(std::vector<std::function<void()>>& tasks) {
+	std::atomic<size_t> remaining(tasks.size());
+	std::exception_ptr error;
+	unsigned int index = (current_pool == this) ? current_index : size();
+
+	if (tasks.empty()) {
+		return;
+	}
+
+	//
+	// Fork everything but the first task, run that one here, then help out until the rest are done. The forked
+	// tasks point into this frame, so it doesn't return (or unwind) before every one of them has finished, whether
+	// or not they (or the first task) threw; the first exception is rethrown once they have.
+	//
+	for (size_t i = 1; i < tasks.size(); i++) {
+		std::function<void()>* t = &tasks[i];
+		submit([this, t, &remaining, &error] {
+			try {
+				(*t)();
+			}
+			catch (...) {
+				std::lock_guard<std::mutex> guard(idle_lock);
+				if (!error) {
+					error = std::current_exception();
+				}
+			}
+			//
+			// Decrement under idle_lock so the waiter below can't miss it; after that nothing in this frame is touched.
+			//
+			{
+				std::lock_guard<std::mutex> guard(idle_lock);
+				remaining--;
+			}
+			work_available.notify_all();
+		});
+	}
+	try {
+		tasks[0]();
+	}
+	catch (...) {
+		std::lock_guard<std::mutex> guard(idle_lock);
+		if (!error) {
+			error = std::current_exception();
+		}
+	}
+	remaining--;
+
+	//
+	// Run queued work while there is some, sleep while there isn't (woken by new work or by the last forked task).
+	//
+	for (;;) {
+		if (try_run_one(index)) {
+			continue;
+		}
+
+		std::unique_lock<std::mutex> lock(idle_lock);
+		work_available.wait(lock, [this, &remaining] { return remaining == 0 || queued > 0; });
+		if (remaining == 0) {
+			break;
+		}
+	}
+
+	if (error) {
+		std::rethrow_exception(error);
+	}
+}
+
+void work_pool::wait_idle() {
+	std::exception_ptr error;
+
+	{
+		std::unique_lock<std::mutex> lock(idle_lock);
+		all_done.wait(lock, [this] { return pending == 0; });
+		error = first_error;
+		first_error = NULL;
+	}
+	if (error) {
+		std::rethrow_exception(error);
+	}
+}
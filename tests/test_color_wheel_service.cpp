@@ -0,0 +1,320 @@
+/*++
+* Arminder Singh
+* CPE462 Image Processing Final Project
+* I pledge my Honor that I have abided by the Stevens Honor System.
+* - Arminder Singh
+--*/
+
+//
+// test_color_wheel_service.cpp
+//
+// Behaviour tests for the color wheel service (POSIX only). Runs the service on a thread and talks to it over its
+// socket as a client would: both request kinds, pipelined requests on one connection, the errors that keep a connection
+// open and the ones that close it, and SHUTDOWN with another connection still open. Built against OpenCV, from the
+// repository root, together with the sources the service uses (color_wheel_service, color_wheel_pipeline,
+// channel_view, lut, rotation, trace and work_pool):
+//
+//   g++ -std=c++14 -O1 -g -fsanitize=thread -Iinclude tests/test_color_wheel_service.cpp src/color_wheel_service.cpp
+//       src/color_wheel_pipeline.cpp src/channel_view.cpp src/lut.cpp src/rotation.cpp src/trace.cpp src/work_pool.cpp
+//       $(pkg-config --cflags --libs opencv4) -pthread -o test_color_wheel_service    (one command)
+//   ./test_color_wheel_service [input_jpeg]
+//
+// input_jpeg defaults to tests/test_img_in_512.jpg. Prints "Info: all color wheel service tests passed" and returns 0,
+// or prints what failed and returns 1.
+//
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include "color_wheel_pipeline.h"
+#include "color_wheel_service.h"
+
+static int failures = 0;
+
+#define CHECK(cond) do { if (!(cond)) { printf("Error: %s:%d: %s\n", __FILE__, __LINE__, #cond); failures++; } } while (0)
+
+//
+// Client side of a connection, buffered the same way as the service's reader.
+//
+typedef struct {
+	int fd;
+	std::vector<unsigned char> buffer;
+	size_t start;
+	size_t end;
+} client;
+
+static bool client_connect(const char* socket_path, client* c) {
+	struct sockaddr_un addr;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strncpy(addr.sun_path, socket_path, sizeof(addr.sun_path) - 1);
+	c->buffer.resize(64 * 1024);
+	c->start = c->end = 0;
+
+	//
+	// The service thread may not be listening yet.
+	//
+	for (int attempt = 0; attempt < 500; attempt++) {
+		c->fd = socket(AF_UNIX, SOCK_STREAM, 0);
+		if (c->fd < 0) {
+			return false;
+		}
+		if (connect(c->fd, (struct sockaddr*)&addr, sizeof(addr)) == 0) {
+			return true;
+		}
+		close(c->fd);
+		std::this_thread::sleep_for(std::chrono::milliseconds(10));
+	}
+	c->fd = -1;
+	return false;
+}
+
+static bool client_send(client* c, const void* data, size_t count) {
+	const char* bytes = (const char*)data;
+	while (count > 0) {
+		ssize_t sent = send(c->fd, bytes, count, MSG_NOSIGNAL);
+		if (sent <= 0) {
+			if ((sent < 0) && (errno == EINTR)) {
+				continue;
+			}
+			return false;
+		}
+		bytes += sent;
+		count -= (size_t)sent;
+	}
+	return true;
+}
+
+static bool client_send_string(client* c, const std::string& s) {
+	return client_send(c, s.data(), s.size());
+}
+
+static bool client_fill(client* c) {
+	ssize_t got;
+	do {
+		got = recv(c->fd, c->buffer.data(), c->buffer.size(), 0);
+	} while ((got < 0) && (errno == EINTR));
+	if (got <= 0) {
+		return false;
+	}
+	c->start = 0;
+	c->end = (size_t)got;
+	return true;
+}
+
+static bool client_read_line(client* c, std::string& line) {
+	line.clear();
+	for (;;) {
+		if ((c->start == c->end) && !client_fill(c)) {
+			return false;
+		}
+		char ch = (char)c->buffer[c->start++];
+		if (ch == '\n') {
+			return true;
+		}
+		line += ch;
+	}
+}
+
+static bool client_read_exact(client* c, std::vector<unsigned char>& out, size_t count) {
+	out.clear();
+	while (out.size() < count) {
+		if ((c->start == c->end) && !client_fill(c)) {
+			return false;
+		}
+		size_t take = c->end - c->start;
+		if (take > count - out.size()) {
+			take = count - out.size();
+		}
+		out.insert(out.end(), c->buffer.begin() + c->start, c->buffer.begin() + c->start + take);
+		c->start += take;
+	}
+	return true;
+}
+
+//
+// True once the service has closed its end: nothing more to read.
+//
+static bool client_at_eof(client* c) {
+	return (c->start == c->end) && !client_fill(c);
+}
+
+static void client_close(client* c) {
+	if (c->fd >= 0) {
+		close(c->fd);
+		c->fd = -1;
+	}
+}
+
+static bool read_file(const char* path, std::vector<unsigned char>& bytes) {
+	FILE* f = fopen(path, "rb");
+	if (f == NULL) {
+		return false;
+	}
+	unsigned char chunk[4096];
+	size_t got;
+	bytes.clear();
+	while ((got = fread(chunk, 1, sizeof(chunk), f)) > 0) {
+		bytes.insert(bytes.end(), chunk, chunk + got);
+	}
+	fclose(f);
+	return !bytes.empty();
+}
+
+static bool file_exists(const std::string& path) {
+	struct stat st;
+	return (stat(path.c_str(), &st) == 0) && (st.st_size > 0);
+}
+
+static std::string data_header(int angle, int equalize, int expand, size_t byte_count) {
+	char header[96];
+	snprintf(header, sizeof(header), "DATA %d %d %d %lu\n", angle, equalize, expand, (unsigned long)byte_count);
+	return header;
+}
+
+//
+// Reads the reply to a DATA request and checks it holds all seven outputs, in color_wheel_output order, as JPEGs.
+//
+static void check_data_reply(client* c) {
+	std::string line;
+	std::vector<unsigned char> image;
+
+	CHECK(client_read_line(c, line) && (line == "OK 7"));
+	for (int i = 0; i < COLOR_WHEEL_OUT_MAX; i++) {
+		char name[64];
+		unsigned long byte_count = 0;
+
+		if (!client_read_line(c, line) || (sscanf(line.c_str(), "%63s %lu", name, &byte_count) != 2)) {
+			CHECK(!"DATA reply output header");
+			return;
+		}
+		CHECK(strcmp(name, color_wheel_output_names[i]) == 0);
+		CHECK(byte_count > 4);
+		if (!client_read_exact(c, image, byte_count)) {
+			CHECK(!"DATA reply output bytes");
+			return;
+		}
+		CHECK((image[0] == 0xFF) && (image[1] == 0xD8)); // JPEG start of image
+		CHECK((image[byte_count - 2] == 0xFF) && (image[byte_count - 1] == 0xD9)); // and end of image
+	}
+}
+
+int main(int argc, char* argv[]) {
+	const char* input_path = (argc >= 2) ? argv[1] : "tests/test_img_in_512.jpg";
+	char socket_path[64];
+	char prefix[64];
+	std::vector<unsigned char> jpeg;
+	std::string line;
+	int service_ret = -1;
+	client a, b;
+
+	if (!read_file(input_path, jpeg)) {
+		printf("Error: can't read the test input %s\n", input_path);
+		return 1;
+	}
+	snprintf(socket_path, sizeof(socket_path), "/tmp/cw_service_test_%d.sock", (int)getpid());
+	snprintf(prefix, sizeof(prefix), "/tmp/cw_service_test_%d_", (int)getpid());
+
+	std::thread service([&] { service_ret = color_wheel_service_run(socket_path, 2); });
+
+	if (!client_connect(socket_path, &a) || !client_connect(socket_path, &b)) {
+		printf("Error: can't connect to the service on %s\n", socket_path);
+		CHECK(client_connect(socket_path, &a) && client_send_string(&a, "SHUTDOWN\n"));
+		service.join();
+		return 1;
+	}
+
+	//
+	// An unknown request is answered with an error, and the connection stays open.
+	//
+	CHECK(client_send_string(&a, "HELLO\n"));
+	CHECK(client_read_line(&a, line) && (line == "ERR unknown request"));
+
+	//
+	// Two DATA requests sent back to back on one connection are both answered, in order (the second one reuses the
+	// connection's warm buffers). They're sent from another thread while this one reads, so neither side can fill up
+	// the socket and block on the other.
+	//
+	std::string header = data_header(45, 1, 1, jpeg.size());
+	bool sent = false;
+	std::thread sender([&] {
+		sent = client_send_string(&a, header) && client_send(&a, jpeg.data(), jpeg.size()) &&
+			client_send_string(&a, header) && client_send(&a, jpeg.data(), jpeg.size());
+	});
+	check_data_reply(&a);
+	check_data_reply(&a);
+	sender.join();
+	CHECK(sent);
+
+	//
+	// A payload that isn't a JPEG, or a PATH to a file that isn't there, fails that request only.
+	//
+	std::vector<unsigned char> garbage(1000, 0x5A);
+	CHECK(client_send_string(&a, data_header(0, 0, 0, garbage.size())) && client_send(&a, garbage.data(), garbage.size()));
+	CHECK(client_read_line(&a, line) && (line == "ERR can't parse the input bytes"));
+	CHECK(client_send_string(&a, "PATH 0 0 0\n/nonexistent/input.jpg\n" + std::string(prefix) + "\n"));
+	CHECK(client_read_line(&a, line) && (line == "ERR can't parse the input file"));
+
+	//
+	// A PATH request writes the seven outputs under the prefix and lists them.
+	//
+	CHECK(client_send_string(&a, "PATH 30 0 0\n" + std::string(input_path) + "\n" + std::string(prefix) + "\n"));
+	CHECK(client_read_line(&a, line) && (line == "OK 7"));
+	for (int i = 0; i < COLOR_WHEEL_OUT_MAX; i++) {
+		std::string expected = std::string(prefix) + color_wheel_output_names[i];
+		CHECK(client_read_line(&a, line) && (line == expected));
+		CHECK(file_exists(expected));
+		remove(expected.c_str());
+	}
+
+	//
+	// A malformed header is answered, then the connection is closed: the service can't tell where the request ends.
+	//
+	CHECK(client_send_string(&a, "DATA 0 0\n"));
+	CHECK(client_read_line(&a, line) && (line == "ERR malformed DATA request"));
+	CHECK(client_at_eof(&a));
+	client_close(&a);
+
+	//
+	// So is a DATA size over the limit, without the service reading (or allocating) the payload.
+	//
+	CHECK(client_connect(socket_path, &a));
+	CHECK(client_send_string(&a, data_header(0, 0, 0, (size_t)COLOR_WHEEL_SERVICE_MAX_INPUT + 1)));
+	CHECK(client_read_line(&a, line) && (line == "ERR bad DATA size"));
+	CHECK(client_at_eof(&a));
+	client_close(&a);
+
+	//
+	// A request on 'b' that has been answered before SHUTDOWN arrives stays answered; then SHUTDOWN on a new connection
+	// closes 'b' too, and the service returns cleanly.
+	//
+	CHECK(client_send_string(&b, header) && client_send(&b, jpeg.data(), jpeg.size()));
+	check_data_reply(&b);
+	CHECK(client_connect(socket_path, &a));
+	CHECK(client_send_string(&a, "SHUTDOWN\n"));
+	CHECK(client_read_line(&a, line) && (line == "OK 0"));
+	CHECK(client_at_eof(&b));
+	client_close(&a);
+	client_close(&b);
+
+	service.join();
+	CHECK(service_ret == 0);
+	CHECK(access(socket_path, F_OK) != 0); // the socket file is removed on the way out
+
+	if (failures != 0) {
+		printf("Error: %d color wheel service checks failed\n", failures);
+		return 1;
+	}
+	printf("Info: all color wheel service tests passed\n");
+	return 0;
+}
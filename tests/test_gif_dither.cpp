@@ -0,0 +1,300 @@
+/*++
+* Arminder Singh
+* CPE462 Image Processing Final Project
+* I pledge my Honor that I have abided by the Stevens Honor System.
+* - Arminder Singh
+--*/
+
+//
+// test_gif_dither.cpp
+//
+// Tests for gif.h's parallel palettizers. GifDitherImage runs Floyd-Steinberg as a wavefront of row tasks, and
+// GifOrderedDitherImage and GifThresholdImage split the rows between tasks; all three must give exactly what a plain
+// serial loop over the pixels gives, for any frame size, palette, stride and last frame, and however the tasks happen to
+// be scheduled. The serial loops below are the references.
+//
+// GIF_PARALLEL_FOR gives every task a thread of its own, and frames are split from 4096 pixels on, so the tasks
+// really run at the same time on small frames. gif.h doesn't need OpenCV, so this builds on its own, and is meant to
+// run under ThreadSanitizer:
+//
+//   g++ -std=c++14 -O1 -g -fsanitize=thread -Iinclude tests/test_gif_dither.cpp -pthread -o test_gif_dither
+//   ./test_gif_dither
+//
+// Prints "Info: all GIF dithering tests passed" and returns 0, or prints what failed and returns 1.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <thread>
+#include <vector>
+
+#define GIF_PARALLEL_FOR(numTasks, task) do { \
+	std::vector<std::thread> gifTaskThreads; \
+	for (int gifTaskIndex = 0; gifTaskIndex < (numTasks); ++gifTaskIndex) { \
+		gifTaskThreads.emplace_back([&, gifTaskIndex] { (task)(gifTaskIndex); }); \
+	} \
+	for (size_t gifThread = 0; gifThread < gifTaskThreads.size(); ++gifThread) { \
+		gifTaskThreads[gifThread].join(); \
+	} \
+} while (0)
+
+#define GIF_PARALLEL_MIN_PIXELS (1 << 12)
+
+#include "gif.h"
+
+static int failures = 0;
+
+#define CHECK(cond) do { if (!(cond)) { printf("Error: %s:%d: %s\n", __FILE__, __LINE__, #cond); failures++; } } while (0)
+
+static unsigned int random_state = 12345;
+
+static uint8_t random_byte() {
+	random_state = random_state * 1103515245u + 12345u;
+	return (uint8_t)(random_state >> 16);
+}
+
+//
+// Writes a palettized pixel the way gif.h does: its color, and the palette index (or the transparent one) in alpha.
+//
+static void put_pixel(uint8_t* out, const GifPalette* pal, int index) {
+	out[0] = pal->r[index];
+	out[1] = pal->g[index];
+	out[2] = pal->b[index];
+	out[3] = (uint8_t)index;
+}
+
+//
+// Textbook Floyd-Steinberg, one pixel after the other in raster order. Error is kept as color*256, never pushes a
+// neighbor below 0, and is dropped where a neighbor would be outside the image.
+//
+static void reference_dither(const uint8_t* last, const GifFrameSource* src, uint8_t* out, uint32_t width, uint32_t height, uint32_t stride,
+	GifPalette* pal) {
+	std::vector<int32_t> quant(3 * (size_t)width * height);
+	const int32_t shares[4][3] = { { 1, 0, 7 }, { -1, 1, 3 }, { 0, 1, 5 }, { 1, 1, 1 } }; // dx, dy, sixteenths
+
+	for (uint32_t y = 0; y < height; y++) {
+		for (uint32_t x = 0; x < width; x++) {
+			const uint8_t* pix = src->data + y * src->rowStride + x * src->pixelStride;
+			int32_t* q = &quant[3 * ((size_t)y * width + x)];
+			q[0] = pix[src->rOffset] * 256;
+			q[1] = pix[src->gOffset] * 256;
+			q[2] = pix[src->bOffset] * 256;
+		}
+	}
+
+	for (uint32_t y = 0; y < height; y++) {
+		for (uint32_t x = 0; x < width; x++) {
+			int32_t* q = &quant[3 * ((size_t)y * width + x)];
+			const uint8_t* last_pix = last ? last + 4 * ((size_t)y * stride + x) : NULL;
+			uint8_t* out_pix = out + 4 * ((size_t)y * stride + x);
+			int32_t rr = (q[0] + 127) / 256;
+			int32_t gg = (q[1] + 127) / 256;
+			int32_t bb = (q[2] + 127) / 256;
+
+			if (last_pix && (last_pix[0] == rr) && (last_pix[1] == gg) && (last_pix[2] == bb)) {
+				out_pix[0] = (uint8_t)rr;
+				out_pix[1] = (uint8_t)gg;
+				out_pix[2] = (uint8_t)bb;
+				out_pix[3] = kGifTransIndex;
+				continue;
+			}
+
+			int index = GifClosestPaletteIndex(pal, rr, gg, bb);
+			int32_t err[3] = { q[0] - pal->r[index] * 256, q[1] - pal->g[index] * 256, q[2] - pal->b[index] * 256 };
+			put_pixel(out_pix, pal, index);
+
+			for (int s = 0; s < 4; s++) {
+				int64_t nx = (int64_t)x + shares[s][0];
+				int64_t ny = (int64_t)y + shares[s][1];
+				if ((nx < 0) || (nx >= width) || (ny >= height)) {
+					continue;
+				}
+				int32_t* n = &quant[3 * ((size_t)ny * width + (size_t)nx)];
+				for (int c = 0; c < 3; c++) {
+					n[c] += GifIMax(-n[c], err[c] * shares[s][2] / 16);
+				}
+			}
+		}
+	}
+}
+
+//
+// Ordered dithering pixel by pixel: the Bayer threshold of the pixel's place in the whole frame, scaled to the spacing
+// of the palette colors, nudges the color before it is matched.
+//
+static void reference_ordered_dither(const uint8_t* last, const GifFrameSource* src, uint8_t* out, uint32_t width, uint32_t height, uint32_t stride,
+	uint32_t left, uint32_t top, GifPalette* pal) {
+	int spread = 256 >> ((pal->bitDepth + 2) / 3);
+
+	for (uint32_t y = 0; y < height; y++) {
+		for (uint32_t x = 0; x < width; x++) {
+			const uint8_t* pix = src->data + y * src->rowStride + x * src->pixelStride;
+			const uint8_t* last_pix = last ? last + 4 * ((size_t)y * stride + x) : NULL;
+			uint8_t* out_pix = out + 4 * ((size_t)y * stride + x);
+			int r = pix[src->rOffset], g = pix[src->gOffset], b = pix[src->bOffset];
+
+			if (last_pix && (last_pix[0] == r) && (last_pix[1] == g) && (last_pix[2] == b)) {
+				memcpy(out_pix, last_pix, 3);
+				out_pix[3] = kGifTransIndex;
+				continue;
+			}
+			int nudge = ((2 * kGifBayer8[(top + y) & 7][(left + x) & 7] - 63) * spread) / 128;
+			put_pixel(out_pix, pal, GifClosestPaletteIndex(pal, r + nudge, g + nudge, b + nudge));
+		}
+	}
+}
+
+//
+// Thresholding pixel by pixel: the closest palette color, or transparent where the last frame already has the color.
+//
+static void reference_threshold(const uint8_t* last, const GifFrameSource* src, uint8_t* out, uint32_t width, uint32_t height, uint32_t stride,
+	GifPalette* pal) {
+	for (uint32_t y = 0; y < height; y++) {
+		for (uint32_t x = 0; x < width; x++) {
+			const uint8_t* pix = src->data + y * src->rowStride + x * src->pixelStride;
+			const uint8_t* last_pix = last ? last + 4 * ((size_t)y * stride + x) : NULL;
+			uint8_t* out_pix = out + 4 * ((size_t)y * stride + x);
+			int r = pix[src->rOffset], g = pix[src->gOffset], b = pix[src->bOffset];
+
+			if (last_pix && (last_pix[0] == r) && (last_pix[1] == g) && (last_pix[2] == b)) {
+				memcpy(out_pix, last_pix, 3);
+				out_pix[3] = kGifTransIndex;
+				continue;
+			}
+			put_pixel(out_pix, pal, GifClosestPaletteIndex(pal, r, g, b));
+		}
+	}
+}
+
+typedef enum {
+	PALETTIZE_FLOYD_STEINBERG,
+	PALETTIZE_ORDERED,
+	PALETTIZE_THRESHOLD,
+} palettizer;
+
+static const char* const palettizer_names[] = { "Floyd-Steinberg", "ordered", "threshold" };
+
+//
+// Palettizes one random frame with gif.h and with the reference, and compares. The frame is a rectangle of a canvas
+// 'stride' pixels wide, read from a BGR source with padded rows; with use_last, part of it is unchanged from the last
+// frame. Runs with and without color caches, and a few times over, so the tasks meet in different orders.
+//
+static void check_palettizer(palettizer kind, uint32_t width, uint32_t height, uint32_t stride, int bit_depth, bool use_last, bool smooth) {
+	size_t row_bytes = 3 * (size_t)width + 7;
+	std::vector<uint8_t> source(row_bytes * height);
+	std::vector<uint8_t> last(4 * (size_t)stride * height), expected(last.size()), out(last.size());
+	std::vector<GifColorCache> caches(2);
+	uint32_t left = stride - width, top = 3;
+	GifFrameSource src;
+	GifPalette pal;
+
+	memset(&pal, 0, sizeof(pal));
+	pal.bitDepth = bit_depth;
+	for (int i = 0; i < 256; i++) {
+		pal.r[i] = random_byte();
+		pal.g[i] = random_byte();
+		pal.b[i] = random_byte();
+	}
+	for (uint32_t y = 0; y < height; y++) {
+		for (uint32_t x = 0; x < width; x++) {
+			uint8_t* pix = &source[y * row_bytes + 3 * x];
+			for (int c = 0; c < 3; c++) {
+				pix[c] = smooth ? (uint8_t)((x * (c + 1) * 255) / (width + 1) + (y * 97) / (height + 1) + (random_byte() & 7)) : random_byte();
+			}
+			uint8_t* last_pix = &last[4 * ((size_t)y * stride + x)];
+			bool same = (random_byte() % 3) == 0;
+			last_pix[0] = same ? pix[2] : random_byte();
+			last_pix[1] = same ? pix[1] : random_byte();
+			last_pix[2] = same ? pix[0] : random_byte();
+			last_pix[3] = random_byte();
+		}
+	}
+	src.data = source.data();
+	src.rowStride = row_bytes;
+	src.pixelStride = 3;
+	src.rOffset = 2;
+	src.gOffset = 1;
+	src.bOffset = 0;
+	src.padding[0] = 0;
+
+	const uint8_t* last_frame = use_last ? last.data() : NULL;
+	GifPalette ref_pal = pal;
+	ref_pal.cache = NULL;
+	if (kind == PALETTIZE_FLOYD_STEINBERG) {
+		reference_dither(last_frame, &src, expected.data(), width, height, stride, &ref_pal);
+	}
+	else if (kind == PALETTIZE_ORDERED) {
+		reference_ordered_dither(last_frame, &src, expected.data(), width, height, stride, left, top, &ref_pal);
+	}
+	else {
+		reference_threshold(last_frame, &src, expected.data(), width, height, stride, &ref_pal);
+	}
+
+	for (int run = 0; run < 4; run++) {
+		GifPalette run_pal = pal;
+		run_pal.cache = NULL;
+		run_pal.numCaches = 0;
+		if (run >= 2) {
+			//
+			// One or two caches of the palette's own; GifTaskColorCaches adds the rest for the other tasks.
+			//
+			memset(caches.data(), 0, sizeof(GifColorCache) * caches.size());
+			GifColorCacheReset(&caches[0]);
+			GifColorCacheReset(&caches[1]);
+			run_pal.cache = caches.data();
+			run_pal.numCaches = run - 1;
+		}
+
+		memset(out.data(), 0xCD, out.size());
+		if (kind == PALETTIZE_FLOYD_STEINBERG) {
+			GifDitherImage(last_frame, &src, out.data(), width, height, stride, &run_pal, NULL);
+		}
+		else if (kind == PALETTIZE_ORDERED) {
+			GifOrderedDitherImage(last_frame, &src, out.data(), width, height, stride, left, top, &run_pal, NULL);
+		}
+		else {
+			GifThresholdImage(last_frame, &src, out.data(), width, height, stride, &run_pal, NULL);
+		}
+
+		//
+		// Only the rectangle is compared: the pixels to its right belong to the rest of the canvas.
+		//
+		for (uint32_t y = 0; y < height; y++) {
+			size_t row = 4 * (size_t)y * stride;
+			if (memcmp(&out[row], &expected[row], 4 * (size_t)width) != 0) {
+				uint32_t x = 0;
+				while (memcmp(&out[row + 4 * x], &expected[row + 4 * x], 4) == 0) {
+					x++;
+				}
+				printf("Error: %s, %ux%u (stride %u), %d bits, %s last frame, run %d: pixel %u, %u differs\n", palettizer_names[kind],
+					width, height, stride, bit_depth, use_last ? "with" : "no", run, x, y);
+				failures++;
+				return;
+			}
+		}
+	}
+}
+
+int main() {
+	const uint32_t sizes[][2] = { { 1, 1 }, { 1, 5000 }, { 2, 2 }, { 5000, 1 }, { 3, 2000 }, { 64, 64 }, { 65, 63 }, { 257, 33 }, { 300, 200 } };
+	const int bit_depths[] = { 1, 3, 8 };
+
+	for (int kind = PALETTIZE_FLOYD_STEINBERG; kind <= PALETTIZE_THRESHOLD; kind++) {
+		for (const uint32_t* size : sizes) {
+			for (int bit_depth : bit_depths) {
+				for (int use_last = 0; use_last < 2; use_last++) {
+					check_palettizer((palettizer)kind, size[0], size[1], size[0], bit_depth, use_last != 0, (bit_depth % 2) != 0);
+					check_palettizer((palettizer)kind, size[0], size[1], size[0] + 9, bit_depth, use_last != 0, (bit_depth % 2) == 0);
+				}
+			}
+		}
+	}
+
+	if (failures != 0) {
+		printf("Error: %d GIF dithering checks failed\n", failures);
+		return 1;
+	}
+	printf("Info: all GIF dithering tests passed\n");
+	return 0;
+}
@@ -0,0 +1,719 @@
+/*++
+* Arminder Singh
+* CPE462 Image Processing Final Project
+* I pledge my Honor that I have abided by the Stevens Honor System.
+* - Arminder Singh
+--*/
+
+//
+// test_gif_roundtrip.cpp
+//
+// Round-trip tests for gif.h: animations whose colors all fit in a palette are written through every kind of output
+// (file, memory, callback, and an async encoder thread), decoded again by the small GIF decoder below, and compared
+// pixel for pixel with what went in. With an exact palette nothing may be lost, whatever the dither mode. Indexed,
+// grayscale, global palette and tiled frames are checked the same way.
+//
+// gif.h spreads its work with GIF_PARALLEL_FOR; here every task gets a thread of its own, so the parallel paths really
+// run in parallel, and they start at smaller frames than usual so that modest test frames are cut into several bands.
+// gif.h doesn't need OpenCV, so this builds on its own, and is meant to run under ThreadSanitizer:
+//
+//   g++ -std=c++14 -O1 -g -fsanitize=thread -Iinclude tests/test_gif_roundtrip.cpp -pthread -o test_gif_roundtrip
+//   ./test_gif_roundtrip
+//
+// Prints "Info: all GIF round-trip tests passed" and returns 0, or prints what failed and returns 1.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <thread>
+#include <vector>
+
+#define GIF_PARALLEL_FOR(numTasks, task) do { \
+	std::vector<std::thread> gifTaskThreads; \
+	for (int gifTaskIndex = 0; gifTaskIndex < (numTasks); ++gifTaskIndex) { \
+		gifTaskThreads.emplace_back([&, gifTaskIndex] { (task)(gifTaskIndex); }); \
+	} \
+	for (size_t gifThread = 0; gifThread < gifTaskThreads.size(); ++gifThread) { \
+		gifTaskThreads[gifThread].join(); \
+	} \
+} while (0)
+
+#define GIF_PARALLEL_MIN_PIXELS (1 << 12)
+
+#include "gif.h"
+
+static int failures = 0;
+
+#define CHECK(cond) do { if (!(cond)) { printf("Error: %s:%d: %s\n", __FILE__, __LINE__, #cond); failures++; } } while (0)
+
+#define TEST_DELAY 4
+
+//
+// A decoded GIF: the canvas (RGB) as it stands at the end of every frame. A frame ends with the first image whose
+// graphics control extension has a delay; images with no delay (the bands of a tiled frame) belong to the frame after
+// them.
+//
+typedef struct {
+	uint32_t width;
+	uint32_t height;
+	std::vector<std::vector<uint8_t>> frames;
+	int num_images; // image descriptors, more than frames when frames are tiled
+} decoded_gif;
+
+//
+// Reads a GIF data sub-block sequence (as after an extension label or LZW minimum code size), appending it to 'data'.
+//
+static bool read_sub_blocks(const std::vector<uint8_t>& gif, size_t* pos, std::vector<uint8_t>* data) {
+	for (;;) {
+		if (*pos >= gif.size()) {
+			return false;
+		}
+		size_t size = gif[(*pos)++];
+		if (size == 0) {
+			return true;
+		}
+		if (*pos + size > gif.size()) {
+			return false;
+		}
+		if (data != NULL) {
+			data->insert(data->end(), gif.begin() + *pos, gif.begin() + *pos + size);
+		}
+		*pos += size;
+	}
+}
+
+//
+// Decodes the LZW data of an image into exactly 'count' indices. False on any malformed code, or if the data ends
+// early or holds more pixels than that. Like browsers, it stops at the last pixel: gif.h writes the clear and end codes
+// after it with the encoder's code size, which can be a bit short of the decoder's.
+//
+static bool lzw_decode(const std::vector<uint8_t>& data, int min_code_size, size_t count, std::vector<uint8_t>* out) {
+	const int clear_code = 1 << min_code_size;
+	const int end_code = clear_code + 1;
+	std::vector<uint16_t> prefix(4096);
+	std::vector<uint8_t> suffix(4096), first(4096);
+	std::vector<uint16_t> length(4096);
+	int code_size = min_code_size + 1;
+	int next_code = clear_code + 2;
+	int prev = -1;
+	size_t bit = 0;
+
+	if ((min_code_size < 2) || (min_code_size > 8)) {
+		return false;
+	}
+	for (int code = 0; code < clear_code; code++) {
+		suffix[code] = first[code] = (uint8_t)code;
+		length[code] = 1;
+	}
+	out->clear();
+	out->reserve(count);
+
+	for (;;) {
+		if (bit + (size_t)code_size > 8 * data.size()) {
+			return false; // ran out before the end code
+		}
+		int code = 0;
+		for (int i = 0; i < code_size; i++, bit++) {
+			code |= ((data[bit >> 3] >> (bit & 7)) & 1) << i;
+		}
+
+		if (code == clear_code) {
+			code_size = min_code_size + 1;
+			next_code = clear_code + 2;
+			prev = -1;
+			continue;
+		}
+		if (code == end_code) {
+			return false; // before the last pixel
+		}
+
+		int emit;
+		if (prev < 0) {
+			if (code >= clear_code) {
+				return false;
+			}
+			emit = code;
+		}
+		else if (code < next_code) {
+			emit = code;
+			if (next_code < 4096) {
+				prefix[next_code] = (uint16_t)prev;
+				suffix[next_code] = first[code];
+				first[next_code] = first[prev];
+				length[next_code] = (uint16_t)(length[prev] + 1);
+				next_code++;
+			}
+		}
+		else if ((code == next_code) && (next_code < 4096)) {
+			prefix[next_code] = (uint16_t)prev;
+			suffix[next_code] = first[prev];
+			first[next_code] = first[prev];
+			length[next_code] = (uint16_t)(length[prev] + 1);
+			emit = next_code++;
+		}
+		else {
+			return false;
+		}
+		if ((next_code == (1 << code_size)) && (code_size < 12)) {
+			code_size++;
+		}
+
+		if (out->size() + length[emit] > count) {
+			return false;
+		}
+		size_t end = out->size() + length[emit];
+		out->resize(end);
+		for (int c = emit; ; c = prefix[c]) {
+			(*out)[--end] = suffix[c];
+			if (length[c] == 1) {
+				break;
+			}
+		}
+		if (out->size() == count) {
+			return true;
+		}
+		prev = code;
+	}
+}
+
+//
+// Decodes a GIF the way gif.h writes them (GIF89a, no interlacing, every image left in place for the next).
+//
+static bool decode_gif(const std::vector<uint8_t>& gif, decoded_gif* out) {
+	std::vector<uint8_t> global_table, local_table, data, indices, canvas;
+	bool transparent = false;
+	int trans_index = 0;
+	int delay = 0;
+	size_t pos = 13;
+
+	out->frames.clear();
+	out->num_images = 0;
+	if ((gif.size() < 14) || (memcmp(gif.data(), "GIF89a", 6) != 0)) {
+		return false;
+	}
+	out->width = gif[6] | (gif[7] << 8);
+	out->height = gif[8] | (gif[9] << 8);
+	if (gif[10] & 0x80) {
+		size_t size = 3 * ((size_t)1 << ((gif[10] & 7) + 1));
+		if (pos + size > gif.size()) {
+			return false;
+		}
+		global_table.assign(gif.begin() + pos, gif.begin() + pos + size);
+		pos += size;
+	}
+	canvas.assign(3 * (size_t)out->width * out->height, 0);
+
+	while (pos < gif.size()) {
+		uint8_t block = gif[pos++];
+
+		if (block == 0x3B) {
+			return pos == gif.size();
+		}
+		if (block == 0x21) {
+			if (pos >= gif.size()) {
+				return false;
+			}
+			uint8_t label = gif[pos++];
+			if (label == 0xF9) {
+				if ((pos + 6 > gif.size()) || (gif[pos] != 4) || (gif[pos + 5] != 0)) {
+					return false;
+				}
+				int disposal = (gif[pos + 1] >> 2) & 7;
+				if (disposal > 1) {
+					return false; // gif.h only ever leaves images in place
+				}
+				transparent = (gif[pos + 1] & 1) != 0;
+				delay = gif[pos + 2] | (gif[pos + 3] << 8);
+				trans_index = gif[pos + 4];
+				pos += 6;
+			}
+			else if (!read_sub_blocks(gif, &pos, NULL)) {
+				return false;
+			}
+			continue;
+		}
+		if ((block != 0x2C) || (pos + 10 > gif.size())) {
+			return false;
+		}
+
+		uint32_t left = gif[pos] | (gif[pos + 1] << 8);
+		uint32_t top = gif[pos + 2] | (gif[pos + 3] << 8);
+		uint32_t width = gif[pos + 4] | (gif[pos + 5] << 8);
+		uint32_t height = gif[pos + 6] | (gif[pos + 7] << 8);
+		uint8_t flags = gif[pos + 8];
+		pos += 9;
+		if ((flags & 0x40) || (left + width > out->width) || (top + height > out->height)) {
+			return false;
+		}
+		const std::vector<uint8_t>* table = &global_table;
+		if (flags & 0x80) {
+			size_t size = 3 * ((size_t)1 << ((flags & 7) + 1));
+			if (pos + size > gif.size()) {
+				return false;
+			}
+			local_table.assign(gif.begin() + pos, gif.begin() + pos + size);
+			pos += size;
+			table = &local_table;
+		}
+		if (table->empty() || (pos >= gif.size())) {
+			return false;
+		}
+
+		int min_code_size = gif[pos++];
+		out->num_images++;
+		data.clear();
+		if (!read_sub_blocks(gif, &pos, &data) || !lzw_decode(data, min_code_size, (size_t)width * height, &indices)) {
+			return false;
+		}
+		for (uint32_t y = 0; y < height; y++) {
+			for (uint32_t x = 0; x < width; x++) {
+				int index = indices[(size_t)y * width + x];
+				if (transparent && (index == trans_index)) {
+					continue;
+				}
+				if (3 * (size_t)index >= table->size()) {
+					return false;
+				}
+				memcpy(&canvas[3 * ((size_t)(top + y) * out->width + left + x)], &(*table)[3 * (size_t)index], 3);
+			}
+		}
+
+		if (delay != 0) {
+			out->frames.push_back(canvas);
+		}
+		transparent = false;
+		delay = 0;
+	}
+	return false; // no trailer
+}
+
+//
+// The colors the test animations are drawn with, all different. Index 0 of a palette is left out for transparency.
+//
+static void make_colors(int num_colors, unsigned int seed, std::vector<uint32_t>* colors) {
+	colors->clear();
+	while ((int)colors->size() < num_colors) {
+		seed = seed * 1103515245u + 12345u;
+		uint32_t color = (seed >> 8) & 0xFFFFFF;
+		bool seen = false;
+		for (size_t i = 0; i < colors->size(); i++) {
+			seen = seen || ((*colors)[i] == color);
+		}
+		if (!seen) {
+			colors->push_back(color);
+		}
+	}
+}
+
+//
+// RGBA frames of an animation drawn only with 'colors': a fixed background and a box that moves and changes its
+// pattern, so each frame's changed rectangle is a different part of the canvas. One frame repeats the one before it,
+// so nothing at all changes.
+//
+static void make_frames(uint32_t width, uint32_t height, int num_frames, const std::vector<uint32_t>& colors,
+	std::vector<std::vector<uint8_t>>* frames) {
+	uint32_t num_colors = (uint32_t)colors.size();
+
+	frames->assign(num_frames, std::vector<uint8_t>(4 * (size_t)width * height));
+	for (int f = 0; f < num_frames; f++) {
+		int drawn = (f == 2) ? 1 : f;
+		uint32_t box_left = (uint32_t)drawn * 7 % (width / 2 + 1);
+		uint32_t box_top = (uint32_t)drawn * 5 % (height / 2 + 1);
+		uint8_t* pixel = (*frames)[f].data();
+
+		for (uint32_t y = 0; y < height; y++) {
+			for (uint32_t x = 0; x < width; x++, pixel += 4) {
+				bool in_box = (x >= box_left) && (x < box_left + width / 3 + 1) && (y >= box_top) && (y < box_top + height / 3 + 1);
+				uint32_t color = in_box ? colors[(x / 2 + y + (uint32_t)drawn * 11) % num_colors] : colors[(x / 5 + (y / 3) * 7) % num_colors];
+				pixel[0] = (uint8_t)(color >> 16);
+				pixel[1] = (uint8_t)(color >> 8);
+				pixel[2] = (uint8_t)color;
+				pixel[3] = 0x55; // ignored
+			}
+		}
+	}
+}
+
+static bool frame_matches(const std::vector<uint8_t>& rgba, const std::vector<uint8_t>& rgb) {
+	if (rgba.size() / 4 != rgb.size() / 3) {
+		return false;
+	}
+	for (size_t i = 0; i < rgb.size() / 3; i++) {
+		if (memcmp(&rgba[4 * i], &rgb[3 * i], 3) != 0) {
+			return false;
+		}
+	}
+	return true;
+}
+
+//
+// Decodes 'gif' and checks it shows exactly 'frames'.
+//
+static void check_decodes_to(const std::vector<uint8_t>& gif, uint32_t width, uint32_t height, const std::vector<std::vector<uint8_t>>& frames,
+	const char* what) {
+	decoded_gif decoded;
+
+	if (!decode_gif(gif, &decoded)) {
+		printf("Error: %s: the GIF doesn't decode\n", what);
+		failures++;
+		return;
+	}
+	if ((decoded.width != width) || (decoded.height != height) || (decoded.frames.size() != frames.size())) {
+		printf("Error: %s: decoded %ux%u with %d frames, expected %ux%u with %d\n", what, decoded.width, decoded.height,
+			(int)decoded.frames.size(), width, height, (int)frames.size());
+		failures++;
+		return;
+	}
+	for (size_t f = 0; f < frames.size(); f++) {
+		if (!frame_matches(frames[f], decoded.frames[f])) {
+			printf("Error: %s: frame %d differs from its input\n", what, (int)f);
+			failures++;
+		}
+	}
+}
+
+static bool append_to_vector(void* context, const uint8_t* data, size_t size) {
+	std::vector<uint8_t>* bytes = (std::vector<uint8_t>*)context;
+	bytes->insert(bytes->end(), data, data + size);
+	return true;
+}
+
+static bool read_file(const char* path, std::vector<uint8_t>* bytes) {
+	FILE* f = fopen(path, "rb");
+	if (f == NULL) {
+		return false;
+	}
+	uint8_t chunk[4096];
+	size_t got;
+	bytes->clear();
+	while ((got = fread(chunk, 1, sizeof(chunk), f)) > 0) {
+		bytes->insert(bytes->end(), chunk, chunk + got);
+	}
+	fclose(f);
+	return true;
+}
+
+typedef enum {
+	SINK_MEMORY,
+	SINK_CALLBACK,
+	SINK_FILE,
+	SINK_FILE_ASYNC,
+	SINK_MEMORY_ASYNC,
+} test_sink;
+
+typedef struct {
+	test_sink sink;
+	int dither;
+	const GifPalette* global_palette; // NULL for a palette per frame
+	int max_bands;                    // GifUseTiledEncoding's maxBands, 0 to write every frame as one image
+} write_options;
+
+//
+// Writes RGBA 'frames' with kGifBitDepthAuto the way 'options' say and returns the GIF's bytes.
+//
+static bool write_frames(const std::vector<std::vector<uint8_t>>& frames, uint32_t width, uint32_t height, const write_options* options,
+	std::vector<uint8_t>* gif) {
+	char path[64];
+	uint8_t* data = NULL;
+	size_t size = 0;
+	GifWriter writer;
+	bool ok;
+
+	snprintf(path, sizeof(path), "/tmp/gif_roundtrip_%d.gif", (int)getpid());
+	gif->clear();
+	switch (options->sink) {
+	case SINK_MEMORY:
+	case SINK_MEMORY_ASYNC:
+		ok = GifBeginMemory(&writer, &data, &size, width, height, TEST_DELAY, kGifBitDepthAuto, options->dither);
+		break;
+	case SINK_CALLBACK:
+		ok = GifBeginCallback(&writer, append_to_vector, gif, width, height, TEST_DELAY, kGifBitDepthAuto, options->dither);
+		break;
+	case SINK_FILE_ASYNC:
+		ok = GifBeginAsync(&writer, path, width, height, TEST_DELAY, 2, kGifBitDepthAuto, options->dither);
+		break;
+	default:
+		ok = GifBegin(&writer, path, width, height, TEST_DELAY, kGifBitDepthAuto, options->dither);
+		break;
+	}
+	if (!ok) {
+		return false;
+	}
+	if (options->global_palette != NULL) {
+		ok = GifUseGlobalPalette(&writer, options->global_palette);
+	}
+	if (options->max_bands != 0) {
+		ok = GifUseTiledEncoding(&writer, options->max_bands) && ok;
+	}
+	if (options->sink == SINK_MEMORY_ASYNC) {
+		ok = GifStartAsync(&writer, width, height, 3) && ok;
+	}
+
+	for (size_t f = 0; f < frames.size(); f++) {
+		ok = GifWriteFrame(&writer, frames[f].data(), width, height, TEST_DELAY, kGifBitDepthAuto, options->dither) && ok;
+	}
+	ok = GifEnd(&writer) && ok;
+
+	if ((options->sink == SINK_MEMORY) || (options->sink == SINK_MEMORY_ASYNC)) {
+		if (data != NULL) {
+			gif->assign(data, data + size);
+			GIF_FREE(data);
+		}
+	}
+	else if ((options->sink == SINK_FILE) || (options->sink == SINK_FILE_ASYNC)) {
+		ok = read_file(path, gif) && ok;
+		remove(path);
+	}
+	return ok && !gif->empty();
+}
+
+//
+// An exact global palette for 'colors': entry 0 is transparency, the colors follow.
+//
+static void make_global_palette(const std::vector<uint32_t>& colors, GifPalette* pal) {
+	memset(pal, 0, sizeof(GifPalette));
+	pal->bitDepth = 1;
+	while ((1 << pal->bitDepth) < (int)colors.size() + 1) {
+		pal->bitDepth++;
+	}
+	for (size_t i = 0; i < colors.size(); i++) {
+		pal->r[i + 1] = (uint8_t)(colors[i] >> 16);
+		pal->g[i + 1] = (uint8_t)(colors[i] >> 8);
+		pal->b[i + 1] = (uint8_t)colors[i];
+	}
+}
+
+//
+// RGB frames written with every kind of output and dither mode come back exactly, and the outputs agree byte for byte
+// (the async encoder included: it writes what the synchronous one would have).
+//
+static void test_rgb_frames(uint32_t width, uint32_t height, int num_colors) {
+	const int dithers[] = { kGifDitherNone, kGifDitherFloydSteinberg, kGifDitherOrdered };
+	const test_sink sinks[] = { SINK_CALLBACK, SINK_FILE, SINK_FILE_ASYNC, SINK_MEMORY_ASYNC };
+	std::vector<std::vector<uint8_t>> frames;
+	std::vector<uint32_t> colors;
+	std::vector<uint8_t> reference, gif;
+	GifPalette global_palette;
+	char what[128];
+
+	make_colors(num_colors, (unsigned int)(width * 31 + num_colors), &colors);
+	make_frames(width, height, 6, colors, &frames);
+	make_global_palette(colors, &global_palette);
+
+	for (int dither : dithers) {
+		write_options options = { SINK_MEMORY, dither, NULL, 0 };
+
+		snprintf(what, sizeof(what), "%ux%u, %d colors, dither %d", width, height, num_colors, dither);
+		if (!write_frames(frames, width, height, &options, &reference)) {
+			printf("Error: %s: the writer failed\n", what);
+			failures++;
+			continue;
+		}
+		check_decodes_to(reference, width, height, frames, what);
+
+		for (test_sink sink : sinks) {
+			options.sink = sink;
+			CHECK(write_frames(frames, width, height, &options, &gif));
+			if (gif != reference) {
+				printf("Error: %s: output kind %d wrote different bytes than memory\n", what, (int)sink);
+				failures++;
+			}
+		}
+
+		options.sink = SINK_MEMORY;
+		options.global_palette = &global_palette;
+		snprintf(what, sizeof(what), "%ux%u, %d colors, dither %d, global palette", width, height, num_colors, dither);
+		CHECK(write_frames(frames, width, height, &options, &gif));
+		if (dither != kGifDitherOrdered) {
+			check_decodes_to(gif, width, height, frames, what);
+		}
+		else {
+			//
+			// Frames are matched against a global palette as they come, with no exact palette to skip dithering, and
+			// the Bayer offsets move pixels off their color on purpose. All that's asked is a good GIF.
+			//
+			decoded_gif decoded;
+			CHECK(decode_gif(gif, &decoded) && (decoded.frames.size() == frames.size()));
+		}
+
+		options.sink = SINK_MEMORY_ASYNC;
+		CHECK(write_frames(frames, width, height, &options, &reference));
+		CHECK(reference == gif);
+	}
+}
+
+//
+// Indexed and grayscale frames (which skip the quantizing) come back exactly too, mixed in one GIF with RGB frames.
+//
+static void test_indexed_and_gray_frames(uint32_t width, uint32_t height) {
+	std::vector<std::vector<uint8_t>> indices(5, std::vector<uint8_t>((size_t)width * height));
+	std::vector<std::vector<uint8_t>> expected(6, std::vector<uint8_t>(4 * (size_t)width * height));
+	std::vector<uint32_t> colors;
+	GifPalette palettes[2];
+	uint8_t* data = NULL;
+	size_t size = 0;
+	GifWriter writer;
+	bool ok;
+
+	//
+	// A full 256-color palette (every index is a color, 0 included) and a 4-color one.
+	//
+	make_colors(256, 7, &colors);
+	for (int p = 0; p < 2; p++) {
+		memset(&palettes[p], 0, sizeof(GifPalette));
+		palettes[p].bitDepth = (p == 0) ? 8 : 2;
+		for (int i = 0; i < (1 << palettes[p].bitDepth); i++) {
+			palettes[p].r[i] = (uint8_t)(colors[i + 17 * p] >> 16);
+			palettes[p].g[i] = (uint8_t)(colors[i + 17 * p] >> 8);
+			palettes[p].b[i] = (uint8_t)colors[i + 17 * p];
+		}
+	}
+
+	//
+	// Frames 0, 2 and 4 are gray levels (frame 4 a copy of frame 2), frames 1 and 3 index a palette, and frame 5 is RGB.
+	//
+	for (int f = 0; f < 5; f++) {
+		const GifPalette* pal = (f == 1) ? &palettes[0] : &palettes[1];
+		int source = (f == 4) ? 2 : f;
+		for (uint32_t y = 0; y < height; y++) {
+			for (uint32_t x = 0; x < width; x++) {
+				size_t i = (size_t)y * width + x;
+				uint8_t index;
+				if ((source % 2) == 0) {
+					index = (uint8_t)((x * 3 + y * (uint32_t)(source + 1)) & 0xFF);
+				}
+				else {
+					index = (uint8_t)(((x / 4) * 13 + y / 2 + (uint32_t)source) % (uint32_t)(1 << pal->bitDepth));
+				}
+				indices[f][i] = index;
+				expected[f][4 * i] = ((source % 2) == 0) ? index : pal->r[index];
+				expected[f][4 * i + 1] = ((source % 2) == 0) ? index : pal->g[index];
+				expected[f][4 * i + 2] = ((source % 2) == 0) ? index : pal->b[index];
+			}
+		}
+	}
+	std::vector<std::vector<uint8_t>> rgb_frames;
+	make_colors(40, 3, &colors);
+	make_frames(width, height, 1, colors, &rgb_frames);
+	expected[5] = rgb_frames[0];
+
+	ok = GifBeginMemory(&writer, &data, &size, width, height, TEST_DELAY);
+	for (int f = 0; f < 5; f++) {
+		if ((f % 2) == 0) {
+			ok = GifWriteGrayFrame(&writer, indices[f].data(), width, width, height, TEST_DELAY) && ok;
+		}
+		else {
+			ok = GifWriteIndexedFrame(&writer, indices[f].data(), width, (f == 1) ? &palettes[0] : &palettes[1], width, height, TEST_DELAY) && ok;
+		}
+	}
+	ok = GifWriteFrame(&writer, rgb_frames[0].data(), width, height, TEST_DELAY, kGifBitDepthAuto) && ok;
+	ok = GifEnd(&writer) && ok;
+	CHECK(ok);
+
+	std::vector<uint8_t> gif(data, data + size);
+	GIF_FREE(data);
+	check_decodes_to(gif, width, height, expected, "indexed and gray frames");
+}
+
+//
+// Frames cut into bands (several image descriptors per frame, the bands encoded on threads of their own) show exactly
+// what went in, and the tiled writer's outputs agree byte for byte, async included.
+//
+static void test_tiled_frames(uint32_t width, uint32_t height, int num_colors) {
+	const int dithers[] = { kGifDitherNone, kGifDitherFloydSteinberg };
+	const test_sink sinks[] = { SINK_FILE, SINK_MEMORY_ASYNC };
+	std::vector<std::vector<uint8_t>> frames;
+	std::vector<uint32_t> colors;
+	std::vector<uint8_t> reference, gif;
+	GifPalette global_palette;
+	decoded_gif decoded;
+	char what[128];
+
+	make_colors(num_colors, (unsigned int)(height * 17 + num_colors), &colors);
+	make_frames(width, height, 6, colors, &frames);
+	make_global_palette(colors, &global_palette);
+
+	for (int dither : dithers) {
+		write_options options = { SINK_MEMORY, dither, NULL, GIF_MAX_TASKS };
+
+		snprintf(what, sizeof(what), "%ux%u, %d colors, dither %d, tiled", width, height, num_colors, dither);
+		if (!write_frames(frames, width, height, &options, &reference)) {
+			printf("Error: %s: the writer failed\n", what);
+			failures++;
+			continue;
+		}
+		check_decodes_to(reference, width, height, frames, what);
+
+		//
+		// Frames with enough changed pixels really were split.
+		//
+		if ((uint64_t)width * height >= 2 * GIF_PARALLEL_MIN_PIXELS) {
+			CHECK(decode_gif(reference, &decoded) && (decoded.num_images > (int)frames.size()));
+		}
+
+		for (test_sink sink : sinks) {
+			options.sink = sink;
+			CHECK(write_frames(frames, width, height, &options, &gif));
+			if (gif != reference) {
+				printf("Error: %s: output kind %d wrote different bytes than memory\n", what, (int)sink);
+				failures++;
+			}
+		}
+
+		options.sink = SINK_MEMORY;
+		options.global_palette = &global_palette;
+		snprintf(what, sizeof(what), "%ux%u, %d colors, dither %d, tiled, global palette", width, height, num_colors, dither);
+		CHECK(write_frames(frames, width, height, &options, &gif));
+		check_decodes_to(gif, width, height, frames, what);
+	}
+
+	//
+	// Gray frames go through the same bands.
+	//
+	std::vector<std::vector<uint8_t>> gray(3, std::vector<uint8_t>((size_t)width * height));
+	std::vector<std::vector<uint8_t>> expected(3, std::vector<uint8_t>(4 * (size_t)width * height));
+	uint8_t* data = NULL;
+	size_t size = 0;
+	GifWriter writer;
+	bool ok;
+
+	for (int f = 0; f < 3; f++) {
+		for (size_t i = 0; i < (size_t)width * height; i++) {
+			gray[f][i] = (uint8_t)((i * (size_t)(f + 3) / 7) & 0xFF);
+			memset(&expected[f][4 * i], gray[f][i], 3);
+		}
+	}
+	ok = GifBeginMemory(&writer, &data, &size, width, height, TEST_DELAY);
+	ok = GifUseTiledEncoding(&writer, GIF_MAX_TASKS) && ok;
+	for (int f = 0; f < 3; f++) {
+		ok = GifWriteGrayFrame(&writer, gray[f].data(), width, width, height, TEST_DELAY) && ok;
+	}
+	ok = GifEnd(&writer) && ok;
+	CHECK(ok);
+	gif.assign(data, data + size);
+	GIF_FREE(data);
+	check_decodes_to(gif, width, height, expected, "tiled gray frames");
+}
+
+int main() {
+	const uint32_t sizes[][2] = { { 1, 1 }, { 37, 23 }, { 700, 500 } };
+	const int color_counts[] = { 1, 2, 17, 255 };
+
+	for (const uint32_t* size : sizes) {
+		for (int num_colors : color_counts) {
+			test_rgb_frames(size[0], size[1], num_colors);
+		}
+		test_indexed_and_gray_frames(size[0], size[1]);
+		test_tiled_frames(size[0], size[1], 17);
+	}
+	test_tiled_frames(400, 300, 255);
+
+	if (failures != 0) {
+		printf("Error: %d GIF round-trip checks failed\n", failures);
+		return 1;
+	}
+	printf("Info: all GIF round-trip tests passed\n");
+	return 0;
+}
@@ -0,0 +1,189 @@
+/*++
+* Arminder Singh
+* CPE462 Image Processing Final Project
+* I pledge my Honor that I have abided by the Stevens Honor System.
+* - Arminder Singh
+--*/
+
+//
+// test_strip_stream.cpp
+//
+// Checks the strip-streaming mode (HAVE_LIBJPEG) against the whole-image transform: runs both on the same input, with
+// and without equalization, and compares the seven outputs. Also checks that the strip height doesn't change a single
+// output byte, and that rotation and unreadable inputs are refused. Built against OpenCV and libjpeg, from the
+// repository root, together with the sources both paths use (strip_stream, color_wheel_pipeline, channel_view, lut,
+// rotation, trace and work_pool):
+//
+//   g++ -std=c++14 -O1 -g -DHAVE_LIBJPEG -Iinclude tests/test_strip_stream.cpp src/strip_stream.cpp
+//       src/color_wheel_pipeline.cpp src/channel_view.cpp src/lut.cpp src/rotation.cpp src/trace.cpp src/work_pool.cpp
+//       $(pkg-config --cflags --libs opencv4) -ljpeg -pthread -o test_strip_stream    (one command)
+//   ./test_strip_stream [input_jpeg]
+//
+// input_jpeg defaults to tests/test_img_in_512.jpg. Prints "Info: all strip stream tests passed" and returns 0, or
+// prints what failed and returns 1.
+//
+
+#ifndef HAVE_LIBJPEG
+#error "the strip-streaming mode is only built with HAVE_LIBJPEG defined (and libjpeg linked), see the build line above"
+#endif
+
+#include <stdio.h>
+#include <unistd.h>
+#include <string>
+#include <vector>
+#include <opencv2/opencv.hpp>
+
+#include "color_wheel_pipeline.h"
+#include "strip_stream.h"
+
+static int failures = 0;
+
+#define CHECK(cond) do { if (!(cond)) { printf("Error: %s:%d: %s\n", __FILE__, __LINE__, #cond); failures++; } } while (0)
+
+//
+// Mean absolute difference per sample. The streamed outputs are JPEGs, so the in-memory outputs are put through the
+// same encoding (quality 95, the default 4:2:0 subsampling for color) before comparing; what's left is the
+// equalization difference plus a little rounding between libjpeg builds.
+//
+// With no equalization both paths map the same pixels through the same tables, so only that rounding remains.
+// With equalization the stream builds its LUTs from the 1/4-scale pre-pass histogram, which moves a level by a few
+// steps (5 at most on the test image). The grayscale planes don't go through the LUTs; the mixed output does, and
+// each colormap output multiplies the step by the HSV ramp's slope (about 6 per level), so those get the looser bound.
+//
+#define STRIP_STREAM_EXACT_TOLERANCE 1.0
+#define STRIP_STREAM_EQUALIZED_TOLERANCE 8.0
+
+static double mean_abs_diff(const cv::Mat& a, const cv::Mat& b) {
+	return cv::norm(a, b, cv::NORM_L1) / ((double)a.total() * a.channels());
+}
+
+static bool read_file(const std::string& path, std::vector<uchar>& bytes) {
+	FILE* f = fopen(path.c_str(), "rb");
+	if (f == NULL) {
+		return false;
+	}
+	uchar chunk[4096];
+	size_t got;
+	bytes.clear();
+	while ((got = fread(chunk, 1, sizeof(chunk), f)) > 0) {
+		bytes.insert(bytes.end(), chunk, chunk + got);
+	}
+	fclose(f);
+	return !bytes.empty();
+}
+
+static void remove_outputs(const std::string& prefix) {
+	for (int i = 0; i < COLOR_WHEEL_OUT_MAX; i++) {
+		remove((prefix + color_wheel_output_names[i]).c_str());
+	}
+}
+
+//
+// Streams 'input' with one option set and checks every output against the whole-image transform, then streams it again
+// at other strip heights and checks the files come out byte for byte the same.
+//
+static void test_stream_matches_transform(const char* input_path, const cv::Mat& input, bool equalize, const std::string& prefix) {
+	color_wheel_options options = { 0, equalize, ROTATION_CANVAS_CROP, 12345 };
+	cv::Mat image = input.clone();
+	cv::Mat expected[COLOR_WHEEL_OUT_MAX];
+	std::vector<uchar> streamed[COLOR_WHEEL_OUT_MAX];
+	const int other_rows[] = { 1, 7, 100, input.rows + 50 };
+
+	color_wheel_transform(image, &options, NULL, [&expected](color_wheel_output which, const cv::Mat& out) {
+		expected[which] = out.clone();
+	});
+
+	CHECK(color_wheel_stream(input_path, prefix, &options, 0) == 0);
+	for (int i = 0; i < COLOR_WHEEL_OUT_MAX; i++) {
+		std::string path = prefix + color_wheel_output_names[i];
+		std::vector<uchar> encoded;
+		cv::Mat got = cv::imread(path, cv::IMREAD_UNCHANGED);
+		cv::Mat reference;
+
+		CHECK(read_file(path, streamed[i]));
+		if (got.empty() || expected[i].empty()) {
+			CHECK(!"streamed and whole-image output both present");
+			continue;
+		}
+		CHECK(got.size() == expected[i].size());
+		CHECK(got.channels() == expected[i].channels());
+		if ((got.size() != expected[i].size()) || (got.channels() != expected[i].channels())) {
+			continue;
+		}
+
+		cv::imencode(".jpg", expected[i], encoded, { cv::IMWRITE_JPEG_QUALITY, 95 });
+		reference = cv::imdecode(encoded, cv::IMREAD_UNCHANGED);
+		double diff = mean_abs_diff(got, reference);
+		bool uses_equalize_lut = equalize && (i >= COLOR_WHEEL_OUT_1);
+		double tolerance = uses_equalize_lut ? STRIP_STREAM_EQUALIZED_TOLERANCE : STRIP_STREAM_EXACT_TOLERANCE;
+		if (diff > tolerance) {
+			printf("Error: %s (equalize %d) is %.2f levels off the whole-image output on average, over %.1f\n",
+				color_wheel_output_names[i], (int)equalize, diff, tolerance);
+			failures++;
+		}
+	}
+
+	//
+	// Strip boundaries that don't line up with the 4:2:0 MCU rows, one row at a time, and one strip for the whole image.
+	//
+	for (int rows : other_rows) {
+		CHECK(color_wheel_stream(input_path, prefix, &options, rows) == 0);
+		for (int i = 0; i < COLOR_WHEEL_OUT_MAX; i++) {
+			std::vector<uchar> bytes;
+			CHECK(read_file(prefix + color_wheel_output_names[i], bytes) && (bytes == streamed[i]));
+		}
+	}
+	remove_outputs(prefix);
+}
+
+int main(int argc, char* argv[]) {
+	const char* input_path = (argc >= 2) ? argv[1] : "tests/test_img_in_512.jpg";
+	char prefix[64];
+	char bad_input[64];
+	cv::Mat input = cv::imread(input_path);
+
+	if (input.empty()) {
+		printf("Error: can't read the test input %s\n", input_path);
+		return 1;
+	}
+	snprintf(prefix, sizeof(prefix), "/tmp/cw_strip_test_%d_", (int)getpid());
+	snprintf(bad_input, sizeof(bad_input), "/tmp/cw_strip_test_%d_bad.jpg", (int)getpid());
+
+	test_stream_matches_transform(input_path, input, false, prefix);
+	test_stream_matches_transform(input_path, input, true, prefix);
+
+	//
+	// Rotation is refused up front; a multiple of 360 isn't a rotation.
+	//
+	color_wheel_options options = { 90, false, ROTATION_CANVAS_CROP, 0 };
+	CHECK(color_wheel_stream(input_path, prefix, &options, 0) == -1);
+	options.rotation_angle = -360;
+	CHECK(color_wheel_stream(input_path, prefix, &options, 0) == 0);
+	remove_outputs(prefix);
+	options.rotation_angle = 0;
+
+	//
+	// A missing input fails before libjpeg is involved; one that isn't a JPEG fails inside jpeg_read_header, through
+	// the error_exit longjmp, with and without the equalization pre-pass.
+	//
+	CHECK(color_wheel_stream("/nonexistent/input.jpg", prefix, &options, 0) == -1);
+	FILE* f = fopen(bad_input, "wb");
+	CHECK(f != NULL);
+	if (f != NULL) {
+		std::vector<uchar> garbage(1000, 0x5A);
+		fwrite(garbage.data(), 1, garbage.size(), f);
+		fclose(f);
+		CHECK(color_wheel_stream(bad_input, prefix, &options, 0) == -1);
+		options.do_histogram_equalization = true;
+		CHECK(color_wheel_stream(bad_input, prefix, &options, 0) == -1);
+		remove(bad_input);
+	}
+	remove_outputs(prefix);
+
+	if (failures != 0) {
+		printf("Error: %d strip stream checks failed\n", failures);
+		return 1;
+	}
+	printf("Info: all strip stream tests passed\n");
+	return 0;
+}
@@ -0,0 +1,217 @@
+/*++
+* Arminder Singh
+* CPE462 Image Processing Final Project
+* I pledge my Honor that I have abided by the Stevens Honor System.
+* - Arminder Singh
+--*/
+
+//
+// test_work_pool.cpp
+//
+// Behaviour tests for work_pool (the batch mode's work-stealing pool). The pool doesn't need OpenCV, so this builds
+// on its own; running it under ThreadSanitizer is the point:
+//
+//   g++ -std=c++14 -O1 -g -fsanitize=thread -Iinclude tests/test_work_pool.cpp src/work_pool.cpp -pthread -o test_work_pool
+//   ./test_work_pool
+//
+// Prints "Info: all work_pool tests passed" and returns 0, or prints what failed and returns 1.
+//
+
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <stdexcept>
+#include <stdio.h>
+#include <thread>
+#include <vector>
+
+#include "work_pool.h"
+
+static int failures = 0;
+
+#define CHECK(cond) do { if (!(cond)) { printf("Error: %s:%d: %s\n", __FILE__, __LINE__, #cond); failures++; } } while (0)
+
+//
+// Every submitted task runs exactly once, and wait_idle returns only after the last one.
+//
+static void test_submit_runs_every_task(unsigned int num_workers) {
+	const int num_tasks = 2000;
+	std::vector<std::atomic<int>> runs(num_tasks);
+	work_pool pool(num_workers);
+
+	for (int i = 0; i < num_tasks; i++) {
+		runs[i] = 0;
+	}
+	for (int i = 0; i < num_tasks; i++) {
+		pool.submit([&runs, i] { runs[i]++; });
+	}
+	pool.wait_idle();
+
+	int wrong = 0;
+	for (int i = 0; i < num_tasks; i++) {
+		wrong += (runs[i].load() != 1);
+	}
+	CHECK(wrong == 0);
+}
+
+//
+// Tasks submitted from inside a task (which go to the worker's own deque) run too.
+//
+static void test_submit_from_task(unsigned int num_workers) {
+	std::atomic<int> ran(0);
+	work_pool pool(num_workers);
+
+	for (int i = 0; i < 50; i++) {
+		pool.submit([&pool, &ran] {
+			for (int j = 0; j < 20; j++) {
+				pool.submit([&ran] { ran++; });
+			}
+			ran++;
+		});
+	}
+	pool.wait_idle();
+	CHECK(ran.load() == 50 * 21);
+}
+
+//
+// run_and_wait forks sub-tasks from inside tasks and joins them. Every level waits on work it may have to run itself,
+// so this would deadlock on a one-worker pool if the waiting thread didn't help out.
+//
+static void test_nested_run_and_wait(unsigned int num_workers) {
+	std::atomic<long> sum(0);
+	work_pool pool(num_workers);
+
+	for (int outer = 0; outer < 16; outer++) {
+		pool.submit([&pool, &sum, outer] {
+			std::vector<std::function<void()>> tasks;
+			std::vector<long> parts(8, 0);
+			for (int inner = 0; inner < 8; inner++) {
+				tasks.push_back([&parts, outer, inner] { parts[inner] = outer * 8 + inner; });
+			}
+			pool.run_and_wait(tasks);
+
+			//
+			// The parts are plain longs: run_and_wait returning has to make every sub-task's writes visible.
+			//
+			long total = 0;
+			for (int inner = 0; inner < 8; inner++) {
+				total += parts[inner];
+			}
+			sum += total;
+		});
+	}
+	pool.wait_idle();
+	CHECK(sum.load() == (long)(16 * 8) * (16 * 8 - 1) / 2);
+}
+
+//
+// A throwing task doesn't take its worker down: wait_idle rethrows the exception once everything has run, the wait
+// after that is clean, and the pool keeps working.
+//
+static void test_submit_exception(unsigned int num_workers) {
+	std::atomic<int> ran(0);
+	bool caught = false;
+	work_pool pool(num_workers);
+
+	for (int i = 0; i < 100; i++) {
+		pool.submit([&ran, i] {
+			ran++;
+			if ((i % 25) == 10) {
+				throw std::runtime_error("task failed");
+			}
+		});
+	}
+	try {
+		pool.wait_idle();
+	}
+	catch (const std::runtime_error&) {
+		caught = true;
+	}
+	CHECK(caught);
+	CHECK(ran.load() == 100);
+
+	caught = false;
+	for (int i = 0; i < 100; i++) {
+		pool.submit([&ran] { ran++; });
+	}
+	try {
+		pool.wait_idle();
+	}
+	catch (...) {
+		caught = true;
+	}
+	CHECK(!caught);
+	CHECK(ran.load() == 200);
+}
+
+//
+// run_and_wait rethrows the first exception of its tasks, but only after all of them have finished (they point into
+// the caller's frame). The slow tasks make sure some are still running when the first one throws.
+//
+static void test_run_and_wait_exception(unsigned int num_workers) {
+	work_pool pool(num_workers);
+
+	for (int rep = 0; rep < 50; rep++) {
+		std::vector<std::function<void()>> tasks;
+		std::atomic<int> ran(0);
+		bool caught = false;
+
+		for (int i = 0; i < 8; i++) {
+			tasks.push_back([&ran, i] {
+				std::this_thread::sleep_for(std::chrono::microseconds(20 * i));
+				ran++;
+				if ((i == 0) || (i == 5)) {
+					throw std::runtime_error("sub-task failed");
+				}
+			});
+		}
+		try {
+			pool.run_and_wait(tasks);
+		}
+		catch (const std::runtime_error&) {
+			caught = true;
+		}
+		CHECK(caught);
+		CHECK(ran.load() == 8);
+	}
+	pool.wait_idle();
+}
+
+//
+// The destructor waits for queued tasks instead of dropping them, and swallows their exceptions.
+//
+static void test_destructor_drains(unsigned int num_workers) {
+	std::atomic<int> ran(0);
+	{
+		work_pool pool(num_workers);
+		for (int i = 0; i < 500; i++) {
+			pool.submit([&ran, i] {
+				ran++;
+				if (i == 7) {
+					throw std::runtime_error("nobody waits for this");
+				}
+			});
+		}
+	}
+	CHECK(ran.load() == 500);
+}
+
+int main() {
+	const unsigned int worker_counts[] = { 1, 2, 4, 8 };
+
+	for (unsigned int num_workers : worker_counts) {
+		test_submit_runs_every_task(num_workers);
+		test_submit_from_task(num_workers);
+		test_nested_run_and_wait(num_workers);
+		test_submit_exception(num_workers);
+		test_run_and_wait_exception(num_workers);
+		test_destructor_drains(num_workers);
+	}
+
+	if (failures != 0) {
+		printf("Error: %d work_pool checks failed\n", failures);
+		return 1;
+	}
+	printf("Info: all work_pool tests passed\n");
+	return 0;
+}